@@ -0,0 +1,476 @@
+/*funray - yet another raytracer
+Copyright (C) 2008  Christian Zeller (chrizel@gmail.com) and
+		    Simon Goller (neosam@gmail.com).
+
+This program is free software; you can redistribute it and/or modify 
+it under the terms of the GNU General Public License as published 
+by the Free Software Foundation; either version 3 of the License, 
+or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful, but 
+WITHOUT ANY WARRANTY; without even the implied warranty of 
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License along 
+with this program; if not, see <http://www.gnu.org/licenses/>. */
+
+// Headless benchmark: renders the example scenes and a few generated
+// ones with different thread counts and writes the timings and ray
+// rates as JSON, so that runs of different versions can be compared.
+
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+
+#include <QCoreApplication>
+#include <QDebug>
+#include <QFile>
+#include <QList>
+#include <QString>
+#include <QStringList>
+#include <QTextStream>
+#include <QThread>
+#include <QTime>
+
+#include "camera.h"
+#include "dela_glue.h"
+#include "light.h"
+#include "primitives.h"
+#include "renderer.h"
+#include "scene.h"
+#include "stats.h"
+#include "threadpool.h"
+#include "widebvh.h"
+
+struct BenchResult
+{
+    QString scene;
+    QString accel;
+    int threads;
+    int ms;
+    RayStats stats;
+    SceneMemory memory;
+};
+
+// Deterministic random numbers, so every run renders the same scene
+static unsigned int seed = 1;
+static float random01()
+{
+    seed = seed * 1664525u + 1013904223u;
+    return (seed >> 8) * (1.0f / 16777216.0f);
+}
+
+// count small spheres scattered over a checkered plane
+static Scene *randomSpheres(int count)
+{
+    Scene *scene = new Scene();
+    scene->setCamera(new Camera(vec(0, 12, -30), vec(0, -0.4, 1), vec(0, 1, 0),
+				1.333, 1.0));
+    scene->setLight(new Light(vec(10, 30, -10), vec(1, 1, 1), 80));
+    scene->addPrimitive(new Plane(vec(0, 0, 0), vec(0, 1, 0), vec(1, 1, 1)));
+
+    seed = count;
+    float size = sqrt((float)count) * 0.8;
+    for (int i = 0; i < count; i++) {
+	float radius = 0.1 + 0.3 * random01();
+	vec pos((random01() - 0.5) * size, radius + 3 * random01(),
+		random01() * size);
+	vec color(random01(), random01(), random01());
+	scene->addPrimitive(new Sphere(pos, radius, color));
+    }
+
+    scene->build();
+    return scene;
+}
+
+// A ring of big mirror spheres, most rays bounce several times
+static Scene *mirrorRing()
+{
+    Scene *scene = new Scene();
+    scene->setCamera(new Camera(vec(0, 2, -12), vec(0, -0.1, 1), vec(0, 1, 0),
+				1.333, 1.0));
+    scene->setLight(new Light(vec(0, 15, 0), vec(1, 1, 1), 50));
+    scene->addPrimitive(new Plane(vec(0, 0, 0), vec(0, 1, 0), vec(1, 1, 1)));
+
+    for (int i = 0; i < 12; i++) {
+	float a = i * 2 * M_PI / 12;
+	Sphere *sphere = new Sphere(vec(6 * cos(a), 1.5, 6 * sin(a)), 1.5,
+				    vec(0.8, 0.8, 0.9));
+	sphere->setMirror(0.9);
+	scene->addPrimitive(sphere);
+    }
+
+    scene->build();
+    return scene;
+}
+
+// scene1.lisp scaled up: a wall of size x size unit spheres
+static Scene *sphereWall(int size)
+{
+    Scene *scene = new Scene();
+    scene->setCamera(new Camera(vec(size * 0.7, size * 0.7, -size * 0.4),
+				vec(-1, -1, 1), vec(0, 1, 0), 1.333, 1.0));
+    scene->setLight(new Light(vec(size * 0.3, size * 0.6, -size * 0.3),
+			      vec(.2, .2, .2), size * 4));
+    scene->addPrimitive(new Plane(vec(0, 0, 0), vec(0, 1, 0), vec(1, 1, 1)));
+
+    for (int y = 0; y < size; y++) {
+	for (int x = -size / 2; x < size / 2; x++) {
+	    vec color((x + size / 2.0) / size, (y + 1.0) / size, 0);
+	    scene->addPrimitive(new Sphere(vec(x, y + 0.5, 3), 0.5, color));
+	}
+    }
+
+    scene->build();
+    return scene;
+}
+
+// scene2.lisp scaled up: rings rings of 20, 40, 60, ... spheres
+static Scene *sphereRings(int rings)
+{
+    Scene *scene = new Scene();
+    scene->setCamera(new Camera(vec(rings * 5, rings * 4, -rings * 5),
+				vec(-1, -1, 1), vec(0, 1, 0), 1.333, 1.0));
+    scene->setLight(new Light(vec(0, 8, -8), vec(.2, .2, .2), rings * 10));
+    scene->addPrimitive(new Plane(vec(0, 0, 0), vec(0, 1, 0), vec(1, 1, 1)));
+
+    for (int i = 1; i <= rings; i++) {
+	int count = i * 20;
+	for (int a = 1; a <= count; a++) {
+	    float xsin = sin(2 * M_PI / count * a);
+	    float zcos = cos(2 * M_PI / count * a);
+	    vec color(xsin, (float)i / rings - 1.0 / rings, zcos);
+	    scene->addPrimitive(new Sphere(vec(xsin * 6 * i, 1, zcos * 6 * i), 1,
+					   color));
+	}
+    }
+
+    scene->build();
+    return scene;
+}
+
+// A torus of 2 * size * size triangles around the y axis
+static TriangleMesh *torus(int size)
+{
+    TriangleMesh *mesh = new TriangleMesh(vec(0.3, 0.6, 1));
+    for (int i = 0; i < size; i++) {
+	for (int j = 0; j < size; j++) {
+	    float u = 2 * M_PI * i / size;
+	    float v = 2 * M_PI * j / size;
+	    float r = 2 + 0.7 * cos(v);
+	    mesh->vertices.push_back(vec(r * cos(u), 0.2 + 0.7 * sin(v), r * sin(u)));
+
+	    int a = i * size + j;
+	    int b = (i + 1) % size * size + j;
+	    int c = (i + 1) % size * size + (j + 1) % size;
+	    int d = i * size + (j + 1) % size;
+	    int quad[6] = { a, b, c, a, c, d };
+	    mesh->indices.insert(mesh->indices.end(), quad, quad + 6);
+	}
+    }
+    return mesh;
+}
+
+// A torus around a mirror sphere
+static Scene *meshTorus(int size)
+{
+    Scene *scene = new Scene();
+    scene->setCamera(new Camera(vec(0, 3, -8), vec(0, -0.35, 1), vec(0, 1, 0),
+				1.333, 1.0));
+    scene->setLight(new Light(vec(3, 8, -4), vec(.2, .2, .2), 30));
+    scene->addPrimitive(new Plane(vec(0, -1, 0), vec(0, 1, 0), vec(1, 1, 1)));
+    scene->addPrimitive(new Sphere(vec(0, 0, 0), 0.8, vec(1, 0.3, 0.3)));
+    scene->addPrimitive(torus(size));
+
+    scene->build();
+    return scene;
+}
+
+// count * count randomly turned instances of one group, a torus of
+// 10^4 triangles around a sphere
+static Scene *torusInstances(int count)
+{
+    Scene *scene = new Scene();
+    scene->setCamera(new Camera(vec(0, 20, -30), vec(0, -0.6, 1), vec(0, 1, 0),
+				1.333, 1.0));
+    scene->setLight(new Light(vec(10, 40, -20), vec(.2, .2, .2), 100));
+    scene->addPrimitive(new Plane(vec(0, -1, 0), vec(0, 1, 0), vec(1, 1, 1)));
+
+    Scene *group = new Scene();
+    group->addPrimitive(new Sphere(vec(0, 0.2, 0), 0.8, vec(1, 0.3, 0.3)));
+    TriangleMesh *mesh = torus(71);
+    mesh->setMirror(0);
+    group->addPrimitive(mesh);
+    group->build();
+    scene->addGroup(group);
+
+    seed = count;
+    for (int i = 0; i < count; i++) {
+	for (int j = 0; j < count; j++) {
+	    vec pos((i - count / 2) * 6.0, 0, j * 6.0);
+	    vec angles(random01() * 360, random01() * 360, 0);
+	    scene->addPrimitive(new Instance(group, Transform::translation(pos)
+					     * Transform::rotation(angles)));
+	}
+    }
+
+    scene->build();
+    return scene;
+}
+
+static Scene *createScene(const QString &name)
+{
+    if (name == "scene1-1m")
+	return sphereWall(1000);
+    if (name == "scene2-1m")
+	return sphereRings(316);
+    if (name == "random-10k")
+	return randomSpheres(10000);
+    if (name == "random-100k")
+	return randomSpheres(100000);
+    if (name == "mirror-ring")
+	return mirrorRing();
+    if (name == "torus-10k")
+	return meshTorus(71);
+    if (name == "torus-1m")
+	return meshTorus(707);
+    if (name == "instances-10k")
+	return torusInstances(100);
+    return loadScene(name);
+}
+
+static double perSecond(quint64 count, int ms)
+{
+    return ms > 0 ? count * 1000.0 / ms : 0;
+}
+
+// Renders one scene with every thread count
+static bool benchScene(const QString &name, const QString &accel,
+		       const QList<int> &threadCounts, int width, int height,
+		       int samples, int repeat, QList<BenchResult> &results)
+{
+    Scene *scene = createScene(name);
+    if (!scene)
+	return false;
+
+    Renderer renderer(*scene, width, height);
+    renderer.setSamples(samples);
+
+    for (int j = 0; j < threadCounts.size(); j++) {
+	ThreadPool::instance().setThreadCount(threadCounts[j]);
+
+	BenchResult result;
+	result.scene = name;
+	result.accel = accel;
+	result.threads = threadCounts[j];
+	result.memory = scene->memory();
+	result.ms = -1;
+	for (int k = 0; k < repeat; k++) {
+	    QTime t;
+	    t.start();
+	    renderer.render();
+	    int ms = t.elapsed();
+	    if (result.ms < 0 || ms < result.ms)
+		result.ms = ms;
+	}
+	result.stats = renderer.getStats();
+	results << result;
+
+	std::cout << qPrintable(result.scene) << ", " << qPrintable(result.accel)
+		  << ", " << result.threads << " threads: " << result.ms << " ms, "
+		  << perSecond(result.stats.totalRays(), result.ms) / 1e6
+		  << " Mrays/s" << std::endl;
+    }
+
+    delete scene;
+    return true;
+}
+
+// s as the contents of a JSON string
+static QString jsonEscape(const QString &s)
+{
+    QString result;
+    for (int i = 0; i < s.size(); i++) {
+	ushort c = s[i].unicode();
+	if (c == '"' || c == '\\') {
+	    result += QChar('\\');
+	    result += s[i];
+	} else if (c < 0x20)
+	    result += QString("\\u%1").arg(c, 4, 16, QChar('0'));
+	else
+	    result += s[i];
+    }
+    return result;
+}
+
+static void writeJson(QTextStream &out, const QList<BenchResult> &results,
+		      int width, int height, int samples, int repeat)
+{
+    out << "{\n"
+	<< "  \"width\": " << width << ",\n"
+	<< "  \"height\": " << height << ",\n"
+	<< "  \"samples\": " << samples << ",\n"
+	<< "  \"repeat\": " << repeat << ",\n"
+	<< "  \"cores\": " << QThread::idealThreadCount() << ",\n"
+	// 4 unless built with qmake CONFIG+=avx
+	<< "  \"simd_width\": " << SIMD_WIDTH << ",\n"
+	<< "  \"wide_bvh_width\": " << (int)WideBVH::width << ",\n"
+	<< "  \"results\": [\n";
+
+    for (int i = 0; i < results.size(); i++) {
+	const BenchResult &r = results[i];
+
+	// efficiency against the run of the same scene with the
+	// fewest threads, usually the single threaded one
+	const BenchResult *base = &r;
+	for (int j = 0; j < results.size(); j++) {
+	    if (results[j].scene == r.scene && results[j].accel == r.accel
+		&& results[j].threads < base->threads)
+		base = &results[j];
+	}
+	double efficiency = r.ms > 0
+	    ? (double)base->ms * base->threads / ((double)r.ms * r.threads) : 0;
+
+	out << "    {\"scene\": \"" << jsonEscape(r.scene) << "\""
+	    << ", \"accel\": \"" << jsonEscape(r.accel) << "\""
+	    << ", \"structure\": \"" << jsonEscape(r.memory.accelerator) << "\""
+	    << ", \"threads\": " << r.threads
+	    << ", \"ms\": " << r.ms
+	    << ", \"primary_rays\": " << r.stats.primaryRays
+	    << ", \"total_rays\": " << r.stats.totalRays()
+	    << ", \"tests\": " << r.stats.tests
+	    << ", \"primary_rays_per_s\": " << perSecond(r.stats.primaryRays, r.ms)
+	    << ", \"total_rays_per_s\": " << perSecond(r.stats.totalRays(), r.ms)
+	    << ", \"tests_per_s\": " << perSecond(r.stats.tests, r.ms)
+	    << ", \"nodes\": " << r.memory.nodes
+	    << ", \"node_bytes\": " << r.memory.nodeSize
+	    << ", \"memory_bytes\": " << (quint64)r.memory.total()
+	    << ", \"bytes_per_primitive\": "
+	    << (double)r.memory.total()
+	       / std::max(r.memory.primitives + r.memory.triangles
+			  + r.memory.instances, 1)
+	    << ", \"efficiency\": " << efficiency << "}"
+	    << (i + 1 < results.size() ? ",\n" : "\n");
+    }
+
+    out << "  ]\n"
+	<< "}\n";
+}
+
+static void usage(const char *name)
+{
+    std::cout << "Usage: " << name << " [options] [scene-file...]" << std::endl
+	      << std::endl
+	      << "Without scene files scene0.lisp to scene4.lisp and the generated" << std::endl
+	      << "scenes random-10k, random-100k, mirror-ring and torus-10k are" << std::endl
+	      << "rendered. The generated scenes scene1-1m and scene2-1m with 10^6" << std::endl
+	      << "spheres, torus-1m with 10^6 triangles and instances-10k with 10^4" << std::endl
+	      << "instances of a torus are only rendered when given." << std::endl
+	      << std::endl
+	      << "Options:" << std::endl
+	      << "  --size WxH       image size, default 640x480" << std::endl
+	      << "  --threads a,b,.. thread counts, default 1 and doubling up to one per core" << std::endl
+	      << "  --accel a,b,..   acceleration structures: auto, bvh2, wide, compressed8," << std::endl
+	      << "                   compressed16, grid, default auto" << std::endl
+	      << "  --samples n      samples per pixel, default 1" << std::endl
+	      << "  --repeat n       renderings per run, the fastest counts, default 3" << std::endl
+	      << "  -o file          JSON output, default bench.json" << std::endl;
+}
+
+int main(int argc, char **argv)
+{
+    QCoreApplication app(argc, argv);
+
+    QStringList scenes;
+    QList<int> threadCounts;
+    QStringList accels;
+    QString outFile = "bench.json";
+    int width = 640;
+    int height = 480;
+    int samples = 1;
+    int repeat = 3;
+
+    for (int i = 1; i < argc; i++) {
+	QString arg(argv[i]);
+	if (arg == "-o" && i + 1 < argc)
+	    outFile = argv[++i];
+	else if (arg == "--samples" && i + 1 < argc)
+	    samples = atoi(argv[++i]);
+	else if (arg == "--repeat" && i + 1 < argc)
+	    repeat = std::max(atoi(argv[++i]), 1);
+	else if (arg == "--accel" && i + 1 < argc)
+	    accels = QString(argv[++i]).split(",");
+	else if (arg == "--threads" && i + 1 < argc) {
+	    QStringList counts = QString(argv[++i]).split(",");
+	    for (int j = 0; j < counts.size(); j++)
+		threadCounts << std::max(counts[j].toInt(), 1);
+	} else if (arg == "--size" && i + 1 < argc) {
+	    if (sscanf(argv[++i], "%dx%d", &width, &height) != 2
+		|| width <= 0 || height <= 0) {
+		usage(argv[0]);
+		return 1;
+	    }
+	} else if (!arg.startsWith("-"))
+	    scenes << arg;
+	else {
+	    usage(argv[0]);
+	    return 1;
+	}
+    }
+
+    if (scenes.isEmpty()) {
+	for (int i = 0; i <= 4; i++)
+	    scenes << QString("scene%1.lisp").arg(i);
+	scenes << "random-10k" << "random-100k" << "mirror-ring" << "torus-10k";
+    }
+
+    if (threadCounts.isEmpty()) {
+	int cores = std::max(QThread::idealThreadCount(), 1);
+	for (int n = 1; n < cores; n *= 2)
+	    threadCounts << n;
+	threadCounts << cores;
+    }
+
+    if (accels.isEmpty())
+	accels << "auto";
+
+    std::cout << "SIMD width " << SIMD_WIDTH << ", wide BVH nodes with "
+	      << (int)WideBVH::width << " children" << std::endl;
+
+    QList<BenchResult> results;
+    for (int a = 0; a < accels.size(); a++) {
+	if (accels[a] == "auto")
+	    Scene::setDefaultAccelerator(Scene::Automatic);
+	else if (accels[a] == "bvh2")
+	    Scene::setDefaultAccelerator(Scene::BinaryTree);
+	else if (accels[a] == "wide")
+	    Scene::setDefaultAccelerator(Scene::WideTree);
+	else if (accels[a] == "compressed8")
+	    Scene::setDefaultAccelerator(Scene::CompressedTree8);
+	else if (accels[a] == "compressed16")
+	    Scene::setDefaultAccelerator(Scene::CompressedTree16);
+	else if (accels[a] == "grid")
+	    Scene::setDefaultAccelerator(Scene::UniformGrid);
+	else {
+	    usage(argv[0]);
+	    return 1;
+	}
+
+	for (int i = 0; i < scenes.size(); i++) {
+	    if (!benchScene(scenes[i], accels[a], threadCounts, width, height,
+			    samples, repeat, results))
+		return 1;
+	}
+    }
+
+    QFile file(outFile);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+	qDebug() << "funray-bench error: cannot write " << outFile;
+	return 1;
+    }
+    QTextStream out(&file);
+    writeJson(out, results, width, height, samples, repeat);
+
+    return 0;
+}
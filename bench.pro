@@ -0,0 +1,23 @@
+######################################################################
+# Benchmark harness, build with: qmake bench.pro && make
+######################################################################
+
+TEMPLATE = app
+TARGET = funray-bench
+DEPENDPATH += .
+INCLUDEPATH += .
+CONFIG += release console
+CONFIG -= app_bundle
+
+# the ray rates need the statistics counters
+DEFINES += FUNRAY_STATS
+
+# 8 wide SIMD kernels and BVH nodes with AVX2, build with
+# qmake CONFIG+=avx; the default build uses 4 wide SSE2
+avx {
+    QMAKE_CXXFLAGS += -mavx2
+}
+
+# Input
+HEADERS += vector.h renderer.h camera.h primitives.h light.h scene.h dela.h dela_builtins.h dela_parser.h dela_profiler.h dela_schema.h dela_vm.h dela_glue.h threadpool.h bvh.h packet.h planes.h simd.h spheres.h stats.h widebvh.h compressedbvh.h grid.h triangles.h meshloader.h transform.h scenefile.h
+SOURCES += bench.cc renderer.cc camera.cc scene.cc dela.cc dela_builtins.cc dela_parser.cc dela_profiler.cc dela_schema.cc dela_vm.cc dela_glue.cc threadpool.cc bvh.cc planes.cc spheres.cc stats.cc widebvh.cc compressedbvh.cc grid.cc triangles.cc meshloader.cc scenefile.cc
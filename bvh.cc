@@ -0,0 +1,640 @@
+/*funray - yet another raytracer
+Copyright (C) 2008  Christian Zeller (chrizel@gmail.com) and
+		    Simon Goller (neosam@gmail.com).
+
+This program is free software; you can redistribute it and/or modify 
+it under the terms of the GNU General Public License as published 
+by the Free Software Foundation; either version 3 of the License, 
+or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful, but 
+WITHOUT ANY WARRANTY; without even the implied warranty of 
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License along 
+with this program; if not, see <http://www.gnu.org/licenses/>. */
+
+
+#include <QTime>
+
+#include <algorithm>
+#include <vector>
+
+#include "bvh.h"
+#include "threadpool.h"
+#include "vector.h"
+
+// Relative costs used by the surface area heuristic
+static const float traversalCost = 1.0;
+static const float intersectCost = 1.0;
+
+// Leaves with more items are always split
+static const int maxLeafSize = 8;
+
+// Below this depth nodes are split at the median instead, which
+// bounds the depth of degenerate hierarchies
+static const int maxSAHDepth = 32;
+
+// Number of bins per axis for the SAH evaluation
+static const int binCount = 16;
+
+// Passes over more items are split between the pool threads
+static const int parallelSize = 1 << 15;
+
+// Subtrees with less items are built by a single thread
+static const int minTaskSize = 1 << 12;
+
+typedef unsigned long long MortonKey;
+
+static inline float axisOf(const vec &v, int axis)
+{
+    return axis == 0 ? v.x : (axis == 1 ? v.y : v.z);
+}
+
+// Spread the lower 10 bits of v so that there are two zero bits
+// between each of them
+static inline unsigned int expandBits(unsigned int v)
+{
+    v = (v * 0x00010001u) & 0xFF0000FFu;
+    v = (v * 0x00000101u) & 0x0F00F00Fu;
+    v = (v * 0x00000011u) & 0xC30C30C3u;
+    v = (v * 0x00000005u) & 0x49249249u;
+    return v;
+}
+
+// 30 bit morton code of p inside bounds
+static inline unsigned int mortonCode(const vec &p, const BBox &bounds)
+{
+    vec d = bounds.max - bounds.min;
+    float x = d.x > 0 ? (p.x - bounds.min.x) / d.x : 0;
+    float y = d.y > 0 ? (p.y - bounds.min.y) / d.y : 0;
+    float z = d.z > 0 ? (p.z - bounds.min.z) / d.z : 0;
+    unsigned int ix = (unsigned int)std::min(std::max(x * 1024, 0.0f), 1023.0f);
+    unsigned int iy = (unsigned int)std::min(std::max(y * 1024, 0.0f), 1023.0f);
+    unsigned int iz = (unsigned int)std::min(std::max(z * 1024, 0.0f), 1023.0f);
+    return (expandBits(ix) << 2) | (expandBits(iy) << 1) | expandBits(iz);
+}
+
+// Node of the temporary tree built by the threads, flattened into
+// BVH::nodes at the end
+struct BVHBuildNode
+{
+    BBox box;
+    int begin;
+    int end;
+    int left;
+    int right;
+    int task;	// >= 0: the subtree is built by this task
+};
+
+typedef std::vector<BVHBuildNode> BVHBuildTree;
+
+struct BVHTask
+{
+    int begin;
+    int end;
+    int depth;
+};
+
+// Boxes of items along each axis, sorted into bins by their centers
+struct BVHBins
+{
+    BBox box[3][binCount];
+    int count[3][binCount];
+
+    BVHBins() {
+	for (int a = 0; a < 3; a++)
+	    for (int b = 0; b < binCount; b++)
+		count[a][b] = 0;
+    };
+
+    void merge(const BVHBins &other) {
+	for (int a = 0; a < 3; a++) {
+	    for (int b = 0; b < binCount; b++) {
+		box[a][b].extend(other.box[a][b]);
+		count[a][b] += other.count[a][b];
+	    }
+	}
+    };
+};
+
+// Maps item centers to bins along one axis
+class BVHBinMapping
+{
+private:
+    float min;
+    float scale;
+
+public:
+    BVHBinMapping(const BBox &centerBox, int axis) {
+	float extent = axisOf(centerBox.max, axis) - axisOf(centerBox.min, axis);
+	min = axisOf(centerBox.min, axis);
+	scale = extent > 0 ? binCount * (1 - 1e-5f) / extent : 0;
+    };
+
+    inline int operator()(float c) const {
+	int b = (int)((c - min) * scale);
+	return std::min(std::max(b, 0), binCount - 1);
+    };
+};
+
+class BVHBuilder
+{
+private:
+    const std::vector<BBox> &boxes;
+    const std::vector<vec> &centers;
+    std::vector<int> &items;
+
+public:
+    std::vector<BVHTask> tasks;
+
+    BVHBuilder(const std::vector<BBox> &boxes, const std::vector<vec> &centers,
+	       std::vector<int> &items)
+	: boxes(boxes), centers(centers), items(items) {};
+
+    void bounds(int begin, int end, BBox &box, BBox &centerBox) const;
+    void bin(int begin, int end, const BBox &centerBox, BVHBins &bins) const;
+
+    // single threaded versions of the above
+    void boundsRange(int begin, int end, BBox &box, BBox &centerBox) const;
+    void binRange(int begin, int end, const BBox &centerBox, BVHBins &bins) const;
+    int split(int begin, int end, const BBox &box, const BBox &centerBox, int depth);
+
+    int buildTop(BVHBuildTree &tree, int begin, int end, int depth, int taskSize);
+    int buildSubtree(BVHBuildTree &tree, int begin, int end, int depth);
+};
+
+class BVHBoundsJob : public RangeJob
+{
+private:
+    const BVHBuilder &builder;
+
+public:
+    std::vector<BBox> box;
+    std::vector<BBox> centerBox;
+
+    BVHBoundsJob(const BVHBuilder &builder, int begin, int end)
+	: RangeJob(begin, end, parallelSize), builder(builder),
+	  box(chunkCount()), centerBox(chunkCount()) {};
+
+    virtual void range(int begin, int end, int chunk, int /* thread */) {
+	builder.boundsRange(begin, end, box[chunk], centerBox[chunk]);
+    };
+};
+
+class BVHBinJob : public RangeJob
+{
+private:
+    const BVHBuilder &builder;
+    const BBox &centerBox;
+
+public:
+    std::vector<BVHBins> bins;
+
+    BVHBinJob(const BVHBuilder &builder, int begin, int end, const BBox &centerBox)
+	: RangeJob(begin, end, parallelSize), builder(builder),
+	  centerBox(centerBox), bins(chunkCount()) {};
+
+    virtual void range(int begin, int end, int chunk, int /* thread */) {
+	builder.binRange(begin, end, centerBox, bins[chunk]);
+    };
+};
+
+class BVHSubtreeJob : public Job
+{
+private:
+    BVHBuilder &builder;
+    std::vector<BVHBuildTree> &trees;
+
+public:
+    BVHSubtreeJob(BVHBuilder &builder, std::vector<BVHBuildTree> &trees)
+	: builder(builder), trees(trees) {};
+
+    virtual void execute(int index, int /* thread */) {
+	const BVHTask &task = builder.tasks[index];
+	builder.buildSubtree(trees[index + 1], task.begin, task.end, task.depth);
+    };
+};
+
+void BVHBuilder::bounds(int begin, int end, BBox &box, BBox &centerBox) const
+{
+    if (end - begin > parallelSize) {
+	BVHBoundsJob job(*this, begin, end);
+	ThreadPool::instance().run(job);
+	for (int c = 0; c < job.chunkCount(); c++) {
+	    box.extend(job.box[c]);
+	    centerBox.extend(job.centerBox[c]);
+	}
+    } else {
+	boundsRange(begin, end, box, centerBox);
+    }
+}
+
+void BVHBuilder::boundsRange(int begin, int end, BBox &box, BBox &centerBox) const
+{
+    for (int i = begin; i < end; i++) {
+	box.extend(boxes[items[i]]);
+	centerBox.extend(centers[items[i]]);
+    }
+}
+
+void BVHBuilder::bin(int begin, int end, const BBox &centerBox, BVHBins &bins) const
+{
+    if (end - begin > parallelSize) {
+	BVHBinJob job(*this, begin, end, centerBox);
+	ThreadPool::instance().run(job);
+	for (int c = 0; c < job.chunkCount(); c++)
+	    bins.merge(job.bins[c]);
+    } else {
+	binRange(begin, end, centerBox, bins);
+    }
+}
+
+void BVHBuilder::binRange(int begin, int end, const BBox &centerBox, BVHBins &bins) const
+{
+    BVHBinMapping mapping[3] = {
+	BVHBinMapping(centerBox, 0),
+	BVHBinMapping(centerBox, 1),
+	BVHBinMapping(centerBox, 2)
+    };
+
+    for (int i = begin; i < end; i++) {
+	const vec &c = centers[items[i]];
+	const BBox &box = boxes[items[i]];
+	int b = mapping[0](c.x);
+	bins.box[0][b].extend(box);
+	bins.count[0][b]++;
+	b = mapping[1](c.y);
+	bins.box[1][b].extend(box);
+	bins.count[1][b]++;
+	b = mapping[2](c.z);
+	bins.box[2][b].extend(box);
+	bins.count[2][b]++;
+    }
+}
+
+class BVHBinLess
+{
+private:
+    const std::vector<vec> &centers;
+    BVHBinMapping mapping;
+    int axis;
+    int bin;
+
+public:
+    BVHBinLess(const std::vector<vec> &centers, const BBox &centerBox, int axis, int bin)
+	: centers(centers), mapping(centerBox, axis), axis(axis), bin(bin) {};
+
+    inline bool operator()(int item) const {
+	return mapping(axisOf(centers[item], axis)) < bin;
+    };
+};
+
+class BVHCenterLess
+{
+private:
+    const std::vector<vec> &centers;
+    int axis;
+
+public:
+    BVHCenterLess(const std::vector<vec> &centers, int axis)
+	: centers(centers), axis(axis) {};
+
+    inline bool operator()(int a, int b) const {
+	return axisOf(centers[a], axis) < axisOf(centers[b], axis);
+    };
+};
+
+// Reorders the items and returns the start of the second child, or
+// -1 if a leaf is cheaper
+int BVHBuilder::split(int begin, int end, const BBox &box, const BBox &centerBox, int depth)
+{
+    const int count = end - begin;
+    if (count == 1 || depth >= BVH::maxDepth - 2)
+	return -1;
+
+    vec extent = centerBox.max - centerBox.min;
+    if (depth < maxSAHDepth && (extent.x > 0 || extent.y > 0 || extent.z > 0)) {
+	BVHBins bins;
+	bin(begin, end, centerBox, bins);
+
+	const float area = std::max(box.area(), 1e-20f);
+	float bestCost = HUGE_VALF;
+	int bestAxis = -1;
+	int bestBin = 0;
+
+	for (int axis = 0; axis < 3; axis++) {
+	    if (axisOf(extent, axis) <= 0)
+		continue;
+
+	    // area times count of everything right of each bin border
+	    float rightCost[binCount];
+	    BBox right;
+	    int rightCount = 0;
+	    for (int b = binCount - 1; b > 0; b--) {
+		right.extend(bins.box[axis][b]);
+		rightCount += bins.count[axis][b];
+		rightCost[b] = right.area() * rightCount;
+	    }
+
+	    BBox left;
+	    int leftCount = 0;
+	    for (int b = 1; b < binCount; b++) {
+		left.extend(bins.box[axis][b - 1]);
+		leftCount += bins.count[axis][b - 1];
+		if (!leftCount || leftCount == count)
+		    continue;
+		float cost = traversalCost + intersectCost
+		    * (left.area() * leftCount + rightCost[b]) / area;
+		if (cost < bestCost) {
+		    bestCost = cost;
+		    bestAxis = axis;
+		    bestBin = b;
+		}
+	    }
+	}
+
+	if (bestAxis >= 0) {
+	    if (count <= maxLeafSize && count * intersectCost <= bestCost)
+		return -1;
+
+	    std::vector<int>::iterator mid =
+		std::partition(items.begin() + begin, items.begin() + end,
+			       BVHBinLess(centers, centerBox, bestAxis, bestBin));
+	    return mid - items.begin();
+	}
+    }
+
+    if (count <= maxLeafSize)
+	return -1;
+
+    // median split along the largest extent of the centers
+    int axis = (extent.x > extent.y && extent.x > extent.z) ? 0 : (extent.y > extent.z ? 1 : 2);
+    int mid = begin + count / 2;
+    std::nth_element(items.begin() + begin, items.begin() + mid, items.begin() + end,
+		     BVHCenterLess(centers, axis));
+    return mid;
+}
+
+int BVHBuilder::buildSubtree(BVHBuildTree &tree, int begin, int end, int depth)
+{
+    BBox box, centerBox;
+    bounds(begin, end, box, centerBox);
+
+    const int index = tree.size();
+    tree.push_back(BVHBuildNode());
+    tree[index].box = box;
+    tree[index].begin = begin;
+    tree[index].end = end;
+    tree[index].left = tree[index].right = -1;
+    tree[index].task = -1;
+
+    int mid = split(begin, end, box, centerBox, depth);
+    if (mid >= 0) {
+	int left = buildSubtree(tree, begin, mid, depth + 1);
+	int right = buildSubtree(tree, mid, end, depth + 1);
+	tree[index].left = left;
+	tree[index].right = right;
+    }
+
+    return index;
+}
+
+// Splits the upper levels with all threads working on each node and
+// leaves subtrees of at most taskSize items to single threads
+int BVHBuilder::buildTop(BVHBuildTree &tree, int begin, int end, int depth, int taskSize)
+{
+    const int index = tree.size();
+    tree.push_back(BVHBuildNode());
+    tree[index].left = tree[index].right = -1;
+
+    if (end - begin <= taskSize) {
+	BVHTask task = { begin, end, depth };
+	tree[index].task = tasks.size();
+	tasks.push_back(task);
+	return index;
+    }
+
+    BBox box, centerBox;
+    bounds(begin, end, box, centerBox);
+    tree[index].box = box;
+    tree[index].begin = begin;
+    tree[index].end = end;
+    tree[index].task = -1;
+
+    int mid = split(begin, end, box, centerBox, depth);
+    if (mid >= 0) {
+	int left = buildTop(tree, begin, mid, depth + 1, taskSize);
+	int right = buildTop(tree, mid, end, depth + 1, taskSize);
+	tree[index].left = left;
+	tree[index].right = right;
+    }
+
+    return index;
+}
+
+class BVHPrepareJob : public RangeJob
+{
+private:
+    const std::vector<BBox> &boxes;
+    std::vector<vec> &centers;
+
+public:
+    std::vector<BBox> centerBox;
+
+    BVHPrepareJob(const std::vector<BBox> &boxes, std::vector<vec> &centers)
+	: RangeJob(0, boxes.size(), parallelSize), boxes(boxes),
+	  centers(centers), centerBox(chunkCount()) {};
+
+    virtual void range(int begin, int end, int chunk, int /* thread */) {
+	for (int i = begin; i < end; i++) {
+	    centers[i] = boxes[i].center();
+	    centerBox[chunk].extend(centers[i]);
+	}
+    };
+};
+
+// Sorts the chunks of keys, each chunk is a run for BVHMergeJob
+class BVHMortonJob : public RangeJob
+{
+private:
+    const std::vector<vec> &centers;
+    const BBox &bounds;
+    std::vector<MortonKey> &keys;
+
+public:
+    std::vector<int> runs;
+
+    BVHMortonJob(const std::vector<vec> &centers, const BBox &bounds,
+		 std::vector<MortonKey> &keys)
+	: RangeJob(0, centers.size(), parallelSize), centers(centers),
+	  bounds(bounds), keys(keys), runs(chunkCount() + 1) {
+	runs[chunkCount()] = centers.size();
+    };
+
+    virtual void range(int begin, int end, int chunk, int /* thread */) {
+	for (int i = begin; i < end; i++)
+	    keys[i] = ((MortonKey)mortonCode(centers[i], bounds) << 32) | i;
+	std::sort(keys.begin() + begin, keys.begin() + end);
+	runs[chunk] = begin;
+    };
+};
+
+// Merges pairs of sorted runs from src into dst
+class BVHMergeJob : public Job
+{
+private:
+    const std::vector<MortonKey> &src;
+    std::vector<MortonKey> &dst;
+    const std::vector<int> &runs;
+
+public:
+    BVHMergeJob(const std::vector<MortonKey> &src, std::vector<MortonKey> &dst,
+		const std::vector<int> &runs)
+	: src(src), dst(dst), runs(runs) {};
+
+    inline int count() const {
+	return runs.size() / 2;
+    };
+
+    virtual void execute(int index, int /* thread */) {
+	int a = runs[2 * index];
+	int b = runs[std::min(2 * index + 1, (int)runs.size() - 1)];
+	int c = runs[std::min(2 * index + 2, (int)runs.size() - 1)];
+	std::merge(src.begin() + a, src.begin() + b,
+		   src.begin() + b, src.begin() + c,
+		   dst.begin() + a);
+    };
+};
+
+// Stores boxes and centers in morton order
+class BVHReorderJob : public RangeJob
+{
+private:
+    const std::vector<MortonKey> &keys;
+    const std::vector<BBox> &boxes;
+    const std::vector<vec> &centers;
+
+public:
+    std::vector<BBox> sortedBoxes;
+    std::vector<vec> sortedCenters;
+
+    BVHReorderJob(const std::vector<MortonKey> &keys, const std::vector<BBox> &boxes,
+		  const std::vector<vec> &centers)
+	: RangeJob(0, keys.size(), parallelSize), keys(keys), boxes(boxes),
+	  centers(centers), sortedBoxes(keys.size()), sortedCenters(keys.size()) {};
+
+    virtual void range(int begin, int end, int /* chunk */, int /* thread */) {
+	for (int i = begin; i < end; i++) {
+	    int item = (int)(keys[i] & 0xffffffff);
+	    sortedBoxes[i] = boxes[item];
+	    sortedCenters[i] = centers[item];
+	}
+    };
+};
+
+static int flatten(std::vector<BVHNode> &nodes, const std::vector<BVHBuildTree> &trees,
+		   int tree, int node)
+{
+    const BVHBuildNode &b = trees[tree][node];
+    if (b.task >= 0)
+	return flatten(nodes, trees, b.task + 1, 0);
+
+    const int index = nodes.size();
+    nodes.push_back(BVHNode());
+    nodes[index].box = b.box;
+
+    if (b.left < 0) {
+	nodes[index].offset = b.begin;
+	nodes[index].count = b.end - b.begin;
+    } else {
+	flatten(nodes, trees, tree, b.left);
+	nodes[index].offset = flatten(nodes, trees, tree, b.right);
+	nodes[index].count = 0;
+    }
+
+    return index;
+}
+
+void BVH::build(const std::vector<BBox> &boxes)
+{
+    QTime time;
+    time.start();
+
+    const int n = boxes.size();
+    ThreadPool &pool = ThreadPool::instance();
+
+    nodes.clear();
+    items.resize(n);
+    if (!n) {
+	buildTime = 0;
+	return;
+    }
+
+    // Centers of all boxes and their bounds...
+    std::vector<vec> centers(n);
+    BBox bounds;
+    {
+	BVHPrepareJob job(boxes, centers);
+	pool.run(job);
+	for (int c = 0; c < job.chunkCount(); c++)
+	    bounds.extend(job.centerBox[c]);
+    }
+
+    // ...sort them along a morton curve, so that the items of each
+    // subtree are close in memory...
+    std::vector<MortonKey> keys(n);
+    {
+	BVHMortonJob job(centers, bounds, keys);
+	pool.run(job);
+
+	std::vector<MortonKey> tmp(n);
+	std::vector<int> runs = job.runs;
+	while (runs.size() > 2) {
+	    BVHMergeJob merge(keys, tmp, runs);
+	    pool.run(merge, merge.count());
+	    keys.swap(tmp);
+
+	    std::vector<int> merged;
+	    for (unsigned int r = 0; r < runs.size() - 1; r += 2)
+		merged.push_back(runs[r]);
+	    merged.push_back(n);
+	    runs.swap(merged);
+	}
+    }
+
+    BVHReorderJob reorder(keys, boxes, centers);
+    pool.run(reorder);
+    std::vector<vec>().swap(centers);
+
+    // ...then build the tree over the sorted copy
+    for (int i = 0; i < n; i++)
+	items[i] = i;
+
+    BVHBuilder builder(reorder.sortedBoxes, reorder.sortedCenters, items);
+    std::vector<BVHBuildTree> trees(1);
+    int taskSize = std::max(minTaskSize, n / (pool.threadCount() * 8));
+    builder.buildTop(trees[0], 0, n, 0, taskSize);
+
+    trees.resize(builder.tasks.size() + 1);
+    BVHSubtreeJob job(builder, trees);
+    pool.run(job, builder.tasks.size());
+
+    unsigned int count = 0;
+    for (unsigned int t = 0; t < trees.size(); t++)
+	count += trees[t].size();
+    nodes.reserve(count);
+    flatten(nodes, trees, 0, 0);
+
+    // items refer to the sorted copy, map them back
+    for (int i = 0; i < n; i++)
+	items[i] = (int)(keys[items[i]] & 0xffffffff);
+
+    buildTime = time.elapsed();
+}
+
+unsigned long BVH::memoryUsage() const
+{
+    return nodes.capacity() * sizeof(BVHNode) + items.capacity() * sizeof(int);
+}
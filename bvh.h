@@ -0,0 +1,223 @@
+/*funray - yet another raytracer
+Copyright (C) 2008  Christian Zeller (chrizel@gmail.com) and
+		    Simon Goller (neosam@gmail.com).
+
+This program is free software; you can redistribute it and/or modify 
+it under the terms of the GNU General Public License as published 
+by the Free Software Foundation; either version 3 of the License, 
+or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful, but 
+WITHOUT ANY WARRANTY; without even the implied warranty of 
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License along 
+with this program; if not, see <http://www.gnu.org/licenses/>. */
+
+
+#ifndef BVH_H
+#define BVH_H
+
+#include <vector>
+
+#include "packet.h"
+#include "vector.h"
+
+struct BVHNode
+{
+    BBox box;
+    // leaf: items [offset, offset + count) of BVH::items
+    // inner node: first child follows this node, offset is the
+    // index of the second child and count is 0
+    int offset;
+    int count;
+};
+
+// Bounding volume hierarchy with surface area heuristic splits. It
+// only knows about boxes; after build() the caller stores its objects
+// in the order given by items, so that every leaf covers a contiguous
+// range of them.
+//
+// The build runs on the thread pool: the boxes are presorted along a
+// morton curve, the upper levels are split with binned SAH by all
+// threads together and the remaining subtrees are built as separate
+// tasks.
+class BVH
+{
+public:
+    enum { maxDepth = 64 };
+
+    std::vector<BVHNode> nodes;
+    std::vector<int> items;
+
+    // milliseconds spent in the last build()
+    int buildTime;
+
+    BVH() : buildTime(0) {};
+
+    void build(const std::vector<BBox> &boxes);
+
+    // bytes used by nodes and items
+    unsigned long memoryUsage() const;
+
+    inline bool isEmpty() const {
+	return nodes.empty();
+    };
+
+    // Closest hit: calls leaf.intersect(begin, end, tmax) for every
+    // leaf the ray reaches before tmax, the leaf lowers tmax on hits.
+    template <class Leaf>
+    void intersect(const Ray &ray, float &tmax, Leaf &leaf) const;
+
+    // Any hit: stops at the first leaf.occluded(begin, end, tmax)
+    // returning true.
+    template <class Leaf>
+    bool occluded(const Ray &ray, float tmax, Leaf &leaf) const;
+
+    // Packet versions: a node is visited when any ray of the packet
+    // hits its box. leaf.intersect(begin, end, packet) lowers the
+    // packet tmax values, leaf.occluded(begin, end, packet) returns
+    // true when no ray is left.
+    template <class Leaf>
+    void intersect(RayPacket &packet, Leaf &leaf) const;
+
+    template <class Leaf>
+    void occluded(RayPacket &packet, Leaf &leaf) const;
+};
+
+template <class Leaf>
+void BVH::intersect(const Ray &ray, float &tmax, Leaf &leaf) const
+{
+    if (nodes.empty())
+	return;
+
+    const vec invDir = safeInverse(ray.dir);
+    const BVHNode *stack[maxDepth];
+    int sp = 0;
+    float tnear;
+
+    const BVHNode *node = &nodes[0];
+    if (!node->box.intersect(ray, invDir, tmax, tnear))
+	return;
+
+    for (;;) {
+	if (node->count) {
+	    leaf.intersect(node->offset, node->offset + node->count, tmax);
+	} else {
+	    // visit the nearer child first, remember the other one
+	    const BVHNode *a = node + 1;
+	    const BVHNode *b = &nodes[node->offset];
+	    float ta, tb;
+	    bool hitA = a->box.intersect(ray, invDir, tmax, ta);
+	    bool hitB = b->box.intersect(ray, invDir, tmax, tb);
+	    if (hitA && hitB) {
+		if (tb < ta)
+		    std::swap(a, b);
+		stack[sp++] = b;
+		node = a;
+		continue;
+	    } else if (hitA) {
+		node = a;
+		continue;
+	    } else if (hitB) {
+		node = b;
+		continue;
+	    }
+	}
+
+	// pop the next node which is still closer than tmax
+	do {
+	    if (!sp)
+		return;
+	    node = stack[--sp];
+	} while (!node->box.intersect(ray, invDir, tmax, tnear));
+    }
+}
+
+template <class Leaf>
+bool BVH::occluded(const Ray &ray, float tmax, Leaf &leaf) const
+{
+    if (nodes.empty())
+	return false;
+
+    const vec invDir = safeInverse(ray.dir);
+    const BVHNode *stack[maxDepth];
+    int sp = 0;
+    float tnear;
+
+    stack[sp++] = &nodes[0];
+    while (sp) {
+	const BVHNode *node = stack[--sp];
+	if (!node->box.intersect(ray, invDir, tmax, tnear))
+	    continue;
+
+	if (node->count) {
+	    if (leaf.occluded(node->offset, node->offset + node->count, tmax))
+		return true;
+	} else {
+	    stack[sp++] = &nodes[node->offset];
+	    stack[sp++] = node + 1;
+	}
+    }
+
+    return false;
+}
+
+template <class Leaf>
+void BVH::intersect(RayPacket &packet, Leaf &leaf) const
+{
+    if (nodes.empty() || !packet.count)
+	return;
+
+    // the rays are coherent, so the first one decides which child
+    // is the nearer one for all of them
+    const vec dir(packet.dx[0], packet.dy[0], packet.dz[0]);
+    const BVHNode *stack[maxDepth];
+    int sp = 0;
+
+    stack[sp++] = &nodes[0];
+    while (sp) {
+	const BVHNode *node = stack[--sp];
+	if (!packet.hits(node->box))
+	    continue;
+
+	if (node->count) {
+	    leaf.intersect(node->offset, node->offset + node->count, packet);
+	} else {
+	    const BVHNode *a = node + 1;
+	    const BVHNode *b = &nodes[node->offset];
+	    if ((b->box.center() - a->box.center()).dot(dir) < 0)
+		std::swap(a, b);
+	    stack[sp++] = b;
+	    stack[sp++] = a;
+	}
+    }
+}
+
+template <class Leaf>
+void BVH::occluded(RayPacket &packet, Leaf &leaf) const
+{
+    if (nodes.empty() || !packet.count)
+	return;
+
+    const BVHNode *stack[maxDepth];
+    int sp = 0;
+
+    stack[sp++] = &nodes[0];
+    while (sp) {
+	const BVHNode *node = stack[--sp];
+	if (!packet.hits(node->box))
+	    continue;
+
+	if (node->count) {
+	    if (leaf.occluded(node->offset, node->offset + node->count, packet))
+		return;
+	} else {
+	    stack[sp++] = &nodes[node->offset];
+	    stack[sp++] = node + 1;
+	}
+    }
+}
+
+#endif
@@ -24,12 +24,16 @@ Camera::Camera(const vec &pos,
 	       const vec &dir, 
 	       const vec &up,
 	       float hlen, 
-	       float vlen)
+	       float vlen,
+	       float aperture,
+	       float focus)
     : pos(pos), 
       dir(dir.normal()), 
       up(up.normal()),
       hlen(hlen), 
-      vlen(vlen) 
+      vlen(vlen),
+      aperture(aperture),
+      focus(focus)
 {
 }
 
@@ -37,11 +41,9 @@ Camera::~Camera()
 {
 }
 
-const vec Camera::dirVecFor(int x, int y, int width, int height) const {
-    vec v = vec(-(hlen / 2) + (hlen / width)  * x,
-		(vlen / 2) - (vlen / height) * y,
-		1.333).normal();
-
+// Rotation matrix from the z axis onto dir, applied to v
+static vec rotate(const vec &dir, const vec &v)
+{
     vec a = vec(0.0, 0.0, 1.0);
     vec b = dir;
 
@@ -66,4 +68,71 @@ const vec Camera::dirVecFor(int x, int y, int width, int height) const {
 		 v.z * (n.z * n.z * (1 - ct) + ct) );
 
     return r;
-};
+}
+
+// Reproducible random number in [0, 1) for a pixel, a sample and one
+// of several dimensions, so that threads need no shared state.
+static inline float hashFloat(unsigned int x, unsigned int y, unsigned int sample,
+			      unsigned int dim)
+{
+    unsigned int h = x * 73856093u ^ y * 19349663u ^ sample * 83492791u ^ dim * 2654435761u;
+    h ^= h >> 16;
+    h *= 0x7feb352du;
+    h ^= h >> 15;
+    h *= 0x846ca68bu;
+    h ^= h >> 16;
+    return (h >> 8) * (1.0f / 16777216.0f);
+}
+
+void CameraBasis::setup(const Camera &camera, int width, int height)
+{
+    origin = camera.pos;
+    axisX = rotate(camera.dir, vec(1, 0, 0));
+    axisY = rotate(camera.dir, vec(0, 1, 0));
+    axisZ = rotate(camera.dir, vec(0, 0, 1));
+
+    left = -(camera.hlen / 2);
+    top = camera.vlen / 2;
+    pixelWidth = camera.hlen / width;
+    pixelHeight = camera.vlen / height;
+    depth = 1.333;
+
+    aperture = camera.aperture;
+    focus = camera.focus;
+}
+
+void CameraBasis::rays(int x0, int y0, int x1, int y1, std::vector<Ray> &rays,
+		       int sample) const
+{
+    rays.clear();
+
+    if (sample < 0 && aperture <= 0) {
+	for (int y = y0; y < y1; y++) {
+	    vec row = axisY * (top - pixelHeight * y) + axisZ * depth;
+	    for (int x = x0; x < x1; x++)
+		rays.push_back(Ray(origin, axisX * (left + pixelWidth * x) + row));
+	}
+	return;
+    }
+    // a lens needs jittered rays even for a single sample
+    if (sample < 0)
+	sample = 0;
+
+    for (int y = y0; y < y1; y++) {
+	for (int x = x0; x < x1; x++) {
+	    vec d = direction(x + hashFloat(x, y, sample, 0),
+			      y + hashFloat(x, y, sample, 1));
+	    if (aperture <= 0) {
+		rays.push_back(Ray(origin, d));
+		continue;
+	    }
+
+	    // thin lens: all rays through a pixel meet on the focus plane
+	    vec target = origin + d * (focus / d.dot(axisZ));
+	    float r = aperture * sqrt(hashFloat(x, y, sample, 2));
+	    float phi = 2 * M_PI * hashFloat(x, y, sample, 3);
+	    vec lens = origin + axisX * (r * cos(phi)) + axisY * (r * sin(phi));
+	    rays.push_back(Ray(lens, target - lens));
+	}
+    }
+}
@@ -18,6 +18,8 @@
 #ifndef CAMERA_H
 #define CAMERA_H
 
+#include <vector>
+
 #include "dela.h"
 #include "vector.h"
 
@@ -28,7 +30,9 @@ public:
            const vec &dir, 
 	   const vec &up,
            float hlen, 
-           float vlen);
+           float vlen,
+	   float aperture = 0,
+	   float focus = 10);
     virtual ~Camera();
 
     vec pos;
@@ -37,7 +41,54 @@ public:
     float hlen;
     float vlen;
 
-    const vec dirVecFor(int x, int y, int width, int height) const;
+    // lens radius for depth of field, 0 is a pinhole camera
+    float aperture;
+    // distance of the sharp plane along dir
+    float focus;
+};
+
+// Primary ray generator for one frame. dirVecFor used to rotate the
+// view plane from the z axis onto the camera direction for every
+// pixel. The rotation only depends on the camera, so setup() computes
+// the rotated axes once and a direction is a sum of three scaled axes.
+class CameraBasis
+{
+public:
+    vec origin;
+
+    // the rotated x, y and z axes
+    vec axisX;
+    vec axisY;
+    vec axisZ;
+
+    // view plane at z = depth: pixel (x, y) lies at
+    // (left + x * pixelWidth, top - y * pixelHeight)
+    float left;
+    float top;
+    float pixelWidth;
+    float pixelHeight;
+    float depth;
+
+    float aperture;
+    float focus;
+
+    CameraBasis() : aperture(0), focus(0) {};
+
+    void setup(const Camera &camera, int width, int height);
+
+    inline vec direction(float x, float y) const {
+	return axisX * (left + pixelWidth * x)
+	    + axisY * (top - pixelHeight * y)
+	    + axisZ * depth;
+    };
+
+    // Primary rays of the pixels [x0, x1) x [y0, y1) in row order.
+    // For sample < 0 and no aperture the rays go through the pixel
+    // corners like before. Otherwise the position inside the pixel
+    // and the point on the lens are jittered, differently for every
+    // sample number; sample < 0 is sample 0 then.
+    void rays(int x0, int y0, int x1, int y1, std::vector<Ray> &rays,
+	      int sample = -1) const;
 };
 
 #endif
@@ -34,25 +34,16 @@ with this program; if not, see <http://www.gnu.org/licenses/>. */
 #include "dela.h"
 #include "dela_glue.h"
 
-static void drawRendering(QPainter &painter, Renderer &renderer,
-			  int y1, int y2, int x1, int x2)
-{
-    for (int y = y1; y < y2; y++) {
-        for (int x = x1; x < x2; x++) {
-            const vec & pixel = renderer.getPixel(x, y);
-            painter.setPen(QColor((int)(pixel.x * 255), 
-                                  (int)(pixel.y * 255), 
-                                  (int)(pixel.z * 255)));
-            painter.drawPoint(x, y);
-        }
-    }
-}
-
 Canvas::Canvas(QWidget *parent)
     : QGLWidget(parent),
       watcher(this),
       scene(0),
-      renderer(0)
+      renderer(0),
+      renderWidth(640),
+      renderHeight(480),
+      samples(1),
+      showStats(false),
+      showMemory(false)
 {
     connect(&watcher, SIGNAL(fileChanged(const QString &)), 
 	    this, SLOT(fileChanged(const QString &)));
@@ -75,13 +66,13 @@ bool Canvas::loadScene(const QString &name)
 	scene = 0;
     }
 
-    QFile file(name);
-    if (file.exists()) {
-	dela::Engine e;
-	addDelaGlue(&e);
+    scene = ::loadScene(name);
+    if (scene) {
+	if (showMemory)
+	    scene->memory().report(std::cout);
 
-	scene = dela::ensureType<Scene>(e.evalFile(name, true));
-	renderer = new Renderer(*scene, 640, 480);
+	renderer = new Renderer(*scene, renderWidth, renderHeight);
+	renderer->setSamples(samples);
 
 	renderer->setListener(this);
 	resize(renderer->getWidth(), renderer->getHeight());
@@ -90,7 +81,6 @@ bool Canvas::loadScene(const QString &name)
 
 	return true;
     } else {
-	qDebug() << "Canvas::loadScene error: file not found: " << name;
 	return false;
     }
 }
@@ -119,12 +109,8 @@ void Canvas::save()
 
 void Canvas::saveToFile(const QString &fileName)
 {
-    if (renderer) {
-	QImage image( renderer->getWidth(), renderer->getHeight(), QImage::Format_RGB32 );
-	QPainter painter(&image);
-	drawRendering(painter, *renderer, 0, renderer->getHeight(), 0, renderer->getWidth());
-	image.save(fileName, "png");
-    }
+    if (renderer)
+	renderer->toImage().save(fileName, "png");
 }
 /*
 void Canvas::paintEvent(QPaintEvent *event)
@@ -175,6 +161,27 @@ void Canvas::keyPressEvent(QKeyEvent *event)
     }
 }
 
+void Canvas::setRenderSize(int width, int height)
+{
+    renderWidth = width;
+    renderHeight = height;
+}
+
+void Canvas::setSamples(int samples)
+{
+    this->samples = samples;
+}
+
+void Canvas::setShowStats(bool value)
+{
+    showStats = value;
+}
+
+void Canvas::setShowMemory(bool value)
+{
+    showMemory = value;
+}
+
 void Canvas::setAutoRefresh(bool value)
 {
     if (value) {
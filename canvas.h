@@ -22,6 +22,8 @@ with this program; if not, see <http://www.gnu.org/licenses/>. */
 #include <QWidget>
 #include <QFileSystemWatcher>
 
+#include <iostream>
+
 #include "scene.h"
 #include "renderer.h"
 
@@ -37,6 +39,12 @@ private:
 
     QString fileName;
 
+    int renderWidth;
+    int renderHeight;
+    int samples;
+    bool showStats;
+    bool showMemory;
+
 public:
     Canvas(QWidget *parent = 0);
     virtual ~Canvas();
@@ -55,12 +63,20 @@ public:
 	updateGL();
     };
 
-    virtual void renderLine(Renderer &, int) {
-	//repaint(0, line, renderer.getWidth(), 1);
+    virtual void renderTile(Renderer &, int, int, int, int) {
 	updateGL();
     };
 
+    virtual void renderStats(Renderer &, const RayStats &stats) {
+	if (showStats)
+	    stats.report(std::cout);
+    };
+
     bool loadScene(const QString &fileName);
+    void setRenderSize(int width, int height);
+    void setSamples(int samples);
+    void setShowStats(bool value);
+    void setShowMemory(bool value);
     void setAutoRefresh(bool value);
 
 public slots:
@@ -0,0 +1,206 @@
+/*funray - yet another raytracer
+Copyright (C) 2008  Christian Zeller (chrizel@gmail.com) and
+		    Simon Goller (neosam@gmail.com).
+
+This program is free software; you can redistribute it and/or modify 
+it under the terms of the GNU General Public License as published 
+by the Free Software Foundation; either version 3 of the License, 
+or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful, but 
+WITHOUT ANY WARRANTY; without even the implied warranty of 
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License along 
+with this program; if not, see <http://www.gnu.org/licenses/>. */
+
+#include <QTime>
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <vector>
+
+#include "bvh.h"
+#include "compressedbvh.h"
+#include "vector.h"
+
+template <class Q>
+bool CompressedBVH<Q>::build(const BVH &bvh)
+{
+    QTime t;
+    t.start();
+
+    clear();
+    bool ok = true;
+    if (!bvh.isEmpty()) {
+	nodes.reserve(bvh.nodes.size() / (width - 1) + 1);
+	items.reserve(bvh.items.size());
+	nodes.resize(1);
+	ok = collapse(bvh, 0, 0);
+	if (!ok)
+	    clear();
+    }
+
+    buildTime = t.elapsed();
+    return ok;
+}
+
+template <class Q>
+void CompressedBVH<Q>::clear()
+{
+    std::vector<Node>().swap(nodes);
+    std::vector<int>().swap(items);
+}
+
+// Smallest exponent with origin + maxQ * 2^e >= max
+static int quantizeExponent(float origin, float max, float maxQ)
+{
+    int e = -126;
+    if (max - origin > 0) {
+	frexpf((max - origin) / maxQ, &e);
+	e = std::max(e - 1, -126);
+    }
+    while (origin + maxQ * exponentScale(e) < max)
+	e++;
+    return e;
+}
+
+// q with origin + q * scale <= value, as large as possible
+template <class Q>
+static Q quantizeDown(float value, float origin, float scale)
+{
+    const float maxQ = std::numeric_limits<Q>::max();
+    float q = std::min(std::max(floorf((value - origin) / scale), 0.0f), maxQ);
+    while (q > 0 && origin + q * scale > value)
+	q--;
+    return (Q)q;
+}
+
+// q with origin + q * scale >= value, as small as possible
+template <class Q>
+static Q quantizeUp(float value, float origin, float scale)
+{
+    const float maxQ = std::numeric_limits<Q>::max();
+    float q = std::min(std::max(ceilf((value - origin) / scale), 0.0f), maxQ);
+    while (q < maxQ && origin + q * scale < value)
+	q++;
+    return (Q)q;
+}
+
+class BVHIsInner
+{
+private:
+    const BVH &bvh;
+
+public:
+    BVHIsInner(const BVH &bvh) : bvh(bvh) {};
+
+    inline bool operator()(int index) const {
+	return bvh.nodes[index].count == 0;
+    };
+};
+
+// Fills nodes[node] from the binary node at index in the same way as
+// WideBVH::collapse, then collapses its inner children into the nodes
+// it appended for them.
+template <class Q>
+bool CompressedBVH<Q>::collapse(const BVH &bvh, int index, int node)
+{
+    std::vector<int> children;
+    const BVHNode &root = bvh.nodes[index];
+    if (root.count) {
+	children.push_back(index);
+    } else {
+	children.push_back(index + 1);
+	children.push_back(root.offset);
+    }
+
+    while ((int)children.size() < width) {
+	int best = -1;
+	float bestArea = -1;
+	for (unsigned int i = 0; i < children.size(); i++) {
+	    const BVHNode &child = bvh.nodes[children[i]];
+	    if (!child.count && child.box.area() > bestArea) {
+		best = i;
+		bestArea = child.box.area();
+	    }
+	}
+	if (best < 0)
+	    break;
+
+	int opened = children[best];
+	children[best] = opened + 1;
+	children.push_back(bvh.nodes[opened].offset);
+    }
+
+    // inner children first, see CompressedBVHNode
+    std::stable_partition(children.begin(), children.end(), BVHIsInner(bvh));
+
+    const float maxQ = std::numeric_limits<Q>::max();
+    const BBox &box = root.box;
+    int exponent[3] = {
+	quantizeExponent(box.min.x, box.max.x, maxQ),
+	quantizeExponent(box.min.y, box.max.y, maxQ),
+	quantizeExponent(box.min.z, box.max.z, maxQ)
+    };
+    const vec scale(exponentScale(exponent[0]), exponentScale(exponent[1]),
+		    exponentScale(exponent[2]));
+
+    Node &n = nodes[node];
+    n.origin[0] = box.min.x;
+    n.origin[1] = box.min.y;
+    n.origin[2] = box.min.z;
+    for (int a = 0; a < 3; a++)
+	n.exponent[a] = exponent[a];
+    n.used = 0;
+    n.children = nodes.size();
+    n.items = items.size();
+    for (int c = 0; c < width; c++) {
+	n.count[c] = 0;
+	n.minX[c] = n.minY[c] = n.minZ[c] = 0;
+	n.maxX[c] = n.maxY[c] = n.maxZ[c] = 0;
+    }
+
+    std::vector<int> inner;
+    for (unsigned int c = 0; c < children.size(); c++) {
+	const BVHNode &child = bvh.nodes[children[c]];
+	if (child.count > maxLeafSize)
+	    return false;
+
+	n.minX[c] = quantizeDown<Q>(child.box.min.x, n.origin[0], scale.x);
+	n.minY[c] = quantizeDown<Q>(child.box.min.y, n.origin[1], scale.y);
+	n.minZ[c] = quantizeDown<Q>(child.box.min.z, n.origin[2], scale.z);
+	n.maxX[c] = quantizeUp<Q>(child.box.max.x, n.origin[0], scale.x);
+	n.maxY[c] = quantizeUp<Q>(child.box.max.y, n.origin[1], scale.y);
+	n.maxZ[c] = quantizeUp<Q>(child.box.max.z, n.origin[2], scale.z);
+	n.count[c] = child.count;
+	n.used |= 1 << c;
+
+	if (child.count)
+	    items.insert(items.end(), bvh.items.begin() + child.offset,
+			 bvh.items.begin() + child.offset + child.count);
+	else
+	    inner.push_back(children[c]);
+    }
+
+    // n is invalid from here on
+    const int first = nodes.size();
+    nodes.resize(first + inner.size());
+    for (unsigned int i = 0; i < inner.size(); i++) {
+	if (!collapse(bvh, inner[i], first + i))
+	    return false;
+    }
+
+    return true;
+}
+
+template <class Q>
+unsigned long CompressedBVH<Q>::memoryUsage() const
+{
+    return nodes.capacity() * sizeof(Node) + items.capacity() * sizeof(int);
+}
+
+template class CompressedBVH<unsigned char>;
+template class CompressedBVH<unsigned short>;
@@ -0,0 +1,288 @@
+/*funray - yet another raytracer
+Copyright (C) 2008  Christian Zeller (chrizel@gmail.com) and
+		    Simon Goller (neosam@gmail.com).
+
+This program is free software; you can redistribute it and/or modify 
+it under the terms of the GNU General Public License as published 
+by the Free Software Foundation; either version 3 of the License, 
+or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful, but 
+WITHOUT ANY WARRANTY; without even the implied warranty of 
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License along 
+with this program; if not, see <http://www.gnu.org/licenses/>. */
+
+#ifndef COMPRESSEDBVH_H
+#define COMPRESSEDBVH_H
+
+#include <vector>
+
+#include "bvh.h"
+#include "packet.h"
+#include "simd.h"
+#include "vector.h"
+#include "widebvh.h"
+
+// 2^e as float for the exponents of CompressedBVHNode
+inline float exponentScale(int e)
+{
+    union { int i; float f; } u;
+    u.i = (e + 127) << 23;
+    return u.f;
+}
+
+// Wide node with the child boxes stored relative to the node: a bound
+// is origin + q * 2^exponent with q of the unsigned integer type Q.
+// The bounds are rounded outwards, so the boxes only grow a bit.
+//
+// Children are not addressed one by one: the inner children come
+// first and are the consecutive nodes starting at children, the items
+// of the leaves follow each other starting at items.
+template <class Q>
+struct CompressedBVHNode
+{
+    enum { width = WIDEBVH_WIDTH };
+
+    float origin[3];
+    signed char exponent[3];
+
+    // one bit per used child
+    unsigned char used;
+
+    int children;
+    int items;
+
+    // leaf size, 0 for inner children
+    unsigned char count[width];
+
+    Q minX[width], minY[width], minZ[width];
+    Q maxX[width], maxY[width], maxZ[width];
+
+    // Fills the child boxes and used of a WideBVHNode for the box tests
+    inline void decode(WideBVHNode &boxes) const {
+	const vfloat ox(origin[0]), oy(origin[1]), oz(origin[2]);
+	const vfloat sx(exponentScale(exponent[0]));
+	const vfloat sy(exponentScale(exponent[1]));
+	const vfloat sz(exponentScale(exponent[2]));
+	for (int c = 0; c < width; c += SIMD_WIDTH) {
+	    (ox + vfloat::load(minX + c) * sx).store(boxes.minX + c);
+	    (oy + vfloat::load(minY + c) * sy).store(boxes.minY + c);
+	    (oz + vfloat::load(minZ + c) * sz).store(boxes.minZ + c);
+	    (ox + vfloat::load(maxX + c) * sx).store(boxes.maxX + c);
+	    (oy + vfloat::load(maxY + c) * sy).store(boxes.maxY + c);
+	    (oz + vfloat::load(maxZ + c) * sz).store(boxes.maxZ + c);
+	}
+	boxes.used = used;
+    };
+
+    // Node index of an inner child or first item of a leaf child
+    inline int childOffset(int c) const {
+	if (!count[c])
+	    return children + c;
+	int offset = items;
+	for (int i = 0; i < c; i++)
+	    offset += count[i];
+	return offset;
+    };
+};
+
+// WideBVH with compressed nodes, Q is unsigned char or unsigned short
+// for 8 or 16 bit bounds. The leaves are the ones of the binary BVH,
+// but the build reorders the items so the leaves of a node are
+// adjacent; the caller stores its objects in the order of items.
+template <class Q>
+class CompressedBVH
+{
+public:
+    typedef CompressedBVHNode<Q> Node;
+
+    enum { width = WIDEBVH_WIDTH, maxStack = BVH::maxDepth * WIDEBVH_WIDTH };
+    // largest leaf a node can refer to
+    enum { maxLeafSize = 255 };
+
+    std::vector<Node> nodes;
+    std::vector<int> items;
+
+    // milliseconds spent in the last build()
+    int buildTime;
+
+    CompressedBVH() : buildTime(0) {};
+
+    // Returns false if bvh has a leaf larger than maxLeafSize
+    bool build(const BVH &bvh);
+
+    void clear();
+
+    // bytes used by nodes and items
+    unsigned long memoryUsage() const;
+
+    inline bool isEmpty() const {
+	return nodes.empty();
+    };
+
+    // Same interface as BVH
+    template <class Leaf>
+    void intersect(const Ray &ray, float &tmax, Leaf &leaf) const;
+    template <class Leaf>
+    bool occluded(const Ray &ray, float tmax, Leaf &leaf) const;
+    template <class Leaf>
+    void intersect(RayPacket &packet, Leaf &leaf) const;
+    template <class Leaf>
+    void occluded(RayPacket &packet, Leaf &leaf) const;
+
+private:
+    bool collapse(const BVH &bvh, int index, int node);
+};
+
+template <class Q>
+template <class Leaf>
+void CompressedBVH<Q>::intersect(const Ray &ray, float &tmax, Leaf &leaf) const
+{
+    if (nodes.empty())
+	return;
+
+    const WideBVHRay r(ray);
+    WideBVHEntry stack[maxStack];
+    int sp = 0;
+    WideBVHNode boxes;
+    float tnear[width];
+
+    stack[sp++] = WideBVHEntry(0, 0, 0);
+    while (sp) {
+	const WideBVHEntry e = stack[--sp];
+	if (e.tnear > tmax)
+	    continue;
+
+	if (e.count) {
+	    leaf.intersect(e.offset, e.offset + e.count, tmax);
+	    continue;
+	}
+
+	// push the children far to near, so the nearest is next
+	const Node &node = nodes[e.offset];
+	node.decode(boxes);
+	const int first = sp;
+	int bits = r.hits(boxes, tmax, tnear);
+	for (int c = 0; bits; c++, bits >>= 1) {
+	    if (!(bits & 1))
+		continue;
+	    WideBVHEntry child(node.childOffset(c), node.count[c], tnear[c]);
+	    int j = sp++;
+	    while (j > first && stack[j - 1].tnear < child.tnear) {
+		stack[j] = stack[j - 1];
+		j--;
+	    }
+	    stack[j] = child;
+	}
+    }
+}
+
+template <class Q>
+template <class Leaf>
+bool CompressedBVH<Q>::occluded(const Ray &ray, float tmax, Leaf &leaf) const
+{
+    if (nodes.empty())
+	return false;
+
+    const WideBVHRay r(ray);
+    WideBVHEntry stack[maxStack];
+    int sp = 0;
+    WideBVHNode boxes;
+    float tnear[width];
+
+    stack[sp++] = WideBVHEntry(0, 0, 0);
+    while (sp) {
+	const WideBVHEntry e = stack[--sp];
+	if (e.count) {
+	    if (leaf.occluded(e.offset, e.offset + e.count, tmax))
+		return true;
+	    continue;
+	}
+
+	const Node &node = nodes[e.offset];
+	node.decode(boxes);
+	int bits = r.hits(boxes, tmax, tnear);
+	for (int c = 0; bits; c++, bits >>= 1) {
+	    if (bits & 1)
+		stack[sp++] = WideBVHEntry(node.childOffset(c), node.count[c], 0);
+	}
+    }
+
+    return false;
+}
+
+template <class Q>
+template <class Leaf>
+void CompressedBVH<Q>::intersect(RayPacket &packet, Leaf &leaf) const
+{
+    if (nodes.empty() || !packet.count)
+	return;
+
+    // the rays are coherent, the first one orders the children
+    const vec dir(packet.dx[0], packet.dy[0], packet.dz[0]);
+    WideBVHEntry stack[maxStack];
+    int sp = 0;
+    WideBVHNode boxes;
+
+    stack[sp++] = WideBVHEntry(0, 0, 0);
+    while (sp) {
+	const WideBVHEntry e = stack[--sp];
+	if (e.count) {
+	    leaf.intersect(e.offset, e.offset + e.count, packet);
+	    continue;
+	}
+
+	const Node &node = nodes[e.offset];
+	node.decode(boxes);
+	const int first = sp;
+	for (int c = 0; c < width; c++) {
+	    if (!(node.used & (1 << c)))
+		continue;
+	    BBox box = boxes.box(c);
+	    if (!packet.hits(box))
+		continue;
+	    WideBVHEntry child(node.childOffset(c), node.count[c],
+			       box.center().dot(dir));
+	    int j = sp++;
+	    while (j > first && stack[j - 1].tnear < child.tnear) {
+		stack[j] = stack[j - 1];
+		j--;
+	    }
+	    stack[j] = child;
+	}
+    }
+}
+
+template <class Q>
+template <class Leaf>
+void CompressedBVH<Q>::occluded(RayPacket &packet, Leaf &leaf) const
+{
+    if (nodes.empty() || !packet.count)
+	return;
+
+    WideBVHEntry stack[maxStack];
+    int sp = 0;
+    WideBVHNode boxes;
+
+    stack[sp++] = WideBVHEntry(0, 0, 0);
+    while (sp) {
+	const WideBVHEntry e = stack[--sp];
+	if (e.count) {
+	    if (leaf.occluded(e.offset, e.offset + e.count, packet))
+		return;
+	    continue;
+	}
+
+	const Node &node = nodes[e.offset];
+	node.decode(boxes);
+	for (int c = 0; c < width; c++) {
+	    if ((node.used & (1 << c)) && packet.hits(boxes.box(c)))
+		stack[sp++] = WideBVHEntry(node.childOffset(c), node.count[c], 0);
+	}
+    }
+}
+
+#endif
@@ -19,122 +19,153 @@ with this program; if not, see <http://www.gnu.org/licenses/>. */
 #include <QDebug>
 #include <QFile>
 #include <QList>
+#include <QMutex>
+#include <QMutexLocker>
 #include <QString>
 
-#include <ctype.h>
 #include <iostream>
 
 #include "dela.h"
 #include "dela_builtins.h"
+#include "dela_parser.h"
+#include "dela_profiler.h"
+#include "dela_vm.h"
 
 namespace dela {
 
-Scriptable * Engine::recogToken(QByteArray str)
+void Arena::grow()
 {
-    bool ok = false;
-    float v = str.toDouble(&ok);
-    if (ok)
-	return autorelease(new Number(v));
-    else
-	return autorelease(new String(str));
+    current = new char[blockSize];
+    end = current + blockSize;
+    blocks.push_back(current);
 }
 
-List * Engine::parse()
+bool Arena::contains(const Scriptable *s) const
 {
-    List * result = autorelease(new List);
+    const char *p = reinterpret_cast<const char *>(s);
+    for (unsigned int i = 0; i < blocks.size(); i++) {
+	if (p >= blocks[i] && p < blocks[i] + blockSize)
+	    return true;
+    }
+    return false;
+}
 
-    QByteArray token;
-    bool is_comment = false;
-    while(pos < code.size()) {
-	char c = code.at(pos);
-	pos++;
+size_t Arena::used() const
+{
+    if (blocks.empty())
+	return 0;
+    return (blocks.size() - 1) * blockSize + (current - blocks.back());
+}
 
-	// Still inside comment?
-	// Ignore until end of line
-	if (is_comment) {
-	    if (c == '\n')
-		is_comment = false;
-	    continue;
-	}
+void Arena::release()
+{
+    for (unsigned int i = 0; i < destructibles.size(); i++)
+	destructibles[i]->~Scriptable();
+    destructibles.clear();
+
+    for (unsigned int i = 0; i < blocks.size(); i++)
+	delete[] blocks[i];
+    blocks.clear();
+    current = end = 0;
+    allocations = 0;
+}
 
-	// Token finish?
-	if ((isspace(c) || c == '(' || c == ')' || c == ';') && (token.size() > 0)) {
-	    result->append(recogToken(token));
-	    token = "";
-	}
+// The symbol table is shared by all engines and filled while parsing,
+// engines on other threads may intern names at the same time. Schemas
+// intern their names during static initialization already.
+static QMutex &symbolMutex()
+{
+    static QMutex mutex(QMutex::Recursive);
+    return mutex;
+}
 
-	if (isspace(c))	// Ignore whitespace
-	    continue;
-	else if (c == ';') { // Start of comment
-	    is_comment = true;
-	    continue;
-	} else if (c == '(') // ( starts a new list
-	    result->append(parse());
-	else if (c == ')') // ) ends the current list
-	    return result;
-	else
-	    token += c;
-    }
+static QHash<QByteArray, int> &symbolIds()
+{
+    static QHash<QByteArray, int> ids;
+    return ids;
+}
 
-    return result;
+static std::vector<String *> &symbolStrings()
+{
+    static std::vector<String *> strings;
+    return strings;
+}
+
+int intern(const QByteArray &name)
+{
+    QMutexLocker lock(&symbolMutex());
+    int id = symbolIds().value(name, -1);
+    if (id >= 0)
+	return id;
+
+    // a $name refers to the variable name, which is interned first
+    int variable = name.startsWith("$") ? intern(name.mid(1)) : -1;
+
+    // name may be raw data of the parser
+    String *string = new String(QByteArray(name.constData(), name.size()));
+    string->symbol = symbolStrings().size();
+    string->variable = variable;
+    symbolStrings().push_back(string);
+    symbolIds().insert(string->value, string->symbol);
+    return string->symbol;
+}
+
+String *symbol(int id)
+{
+    QMutexLocker lock(&symbolMutex());
+    return symbolStrings()[id];
+}
+
+int symbolCount()
+{
+    QMutexLocker lock(&symbolMutex());
+    return symbolStrings().size();
+}
+
+List::~List()
+{
+    //qDebug() << "Release List.";
+    delete compiled;
 }
 
 Engine::Engine()
-    : autoreleasePool(0), code(0), pos(0)
+    : userData(0), profiler(0)
 {
     addBuiltins(this);
 }
 
+Engine::Engine(const Engine &outer)
+    : functions(outer.functions), macros(outer.macros), blocks(outer.blocks),
+      instructions(outer.instructions), variables(outer.variables),
+      userData(outer.userData), profiler(0)
+{
+}
+
 Engine::~Engine()
 {
 }
 
-Scriptable * Engine::eval(Scriptable * code)
+Value Engine::eval(const Value &code)
 {
     List *list = asType<List>(code);
     if (list) {
-	if (list->isEmpty())
-	    return 0;
-
-	Scriptable *s = (*list)[0];
-	String *name  = asType<String>(s);
-	if (name) {
-	    if (macros.contains(name->value)) {
-		// Call macro with unevaluated parameters...
-		List::iterator it;
-		List *params = autorelease(new List);
-		for (it = list->begin() + 1; it != list->end(); it++)
-		    params->append(*it);
-
-		return eval(macros[name->value](this, params));
-	    } else if (functions.contains(name->value)) {
-		// Go through list, interpret parameters and execute function
-		List::iterator it;
-		List *params = autorelease(new List);
-		for (it = list->begin() + 1; it != list->end(); it++)
-		    params->append(eval(*it));
-
-		return functions[name->value](this, params);
-	    } else {
-		qDebug() << "dela::Engine::eval error: Unknown function: " << name->value;
-		exit(1);
-	    }
-	} else if ((list = asType<List>(s))) {
-	    return eval(list);
-	} else {
-	    qDebug() << "dela::Engine::eval error: No string at beginning of list";
-	    exit(1);
+	// Lists are compiled when they are evaluated first, loop
+	// bodies and properties evaluated again run the compiled code
+	if (!list->compiled) {
+	    ProfileScope scope(profiler, Profiler::Compile);
+	    list->compiled = Compiler(this).compile(list);
 	}
+	return run(list->compiled);
     }
 
     String *string = asType<String>(code);
     if (string) {
-	// It's a string!... Check if it begins with a $, then resolve variable
-	// and return Scriptable*
-	if (string->value.startsWith("$")) {
-	    QByteArray name = string->value.mid(1);
-	    if (variables.contains(name)) {
-		return variables[name];
+	// It's a string!... Check if it is a $name, then resolve variable
+	// and return its value
+	if (string->variable >= 0) {
+	    const Variable &v = variable(string->variable);
+	    if (v.defined) {
+		return v.value;
 	    } else {
 		qDebug() << "dela::Engine::eval error: Variable not defined: " << string->value;
 		exit(1);
@@ -145,21 +176,115 @@ Scriptable * Engine::eval(Scriptable * code)
     return code;
 }
 
+void Engine::compileAll(const Value &v)
+{
+    List *list = asType<List>(v);
+    if (!list)
+	return;
+
+    // lists which are data rather than code compile to a Fail, which
+    // is only reported if they are evaluated
+    if (!list->compiled)
+	list->compiled = Compiler(this).compile(list);
+    // macros get parameter lists of their own, which they may prepare
+    // again, like a nested parallel-for; their items are walked below
+    const std::vector<CodeCall> &calls = list->compiled->calls;
+    for (unsigned int i = 0; i < calls.size(); i++) {
+	List *params = calls[i].params;
+	if (params && !params->compiled)
+	    params->compiled = Compiler(this).compile(params);
+    }
+    for (List::iterator it = list->begin(); it != list->end(); it++)
+	compileAll(*it);
+}
 
-Scriptable * Engine::eval(const QByteArray &string, bool getResult)
+void Engine::prepare(const Value &code)
 {
-    autoreleasePool = new List;
-    code = "(begin \n" + string + "\n)";
-    pos  = 0;
+    compileAll(code);
+    for (unsigned int i = 0; i < variables.size(); i++) {
+	if (variables[i].defined)
+	    compileAll(variables[i].value);
+    }
+}
 
-    // parse and evaluate code, remove result from autorelease pool
-    Scriptable *result = undoAutorelease(eval(parse()));
+// The parser calls of evalForms, which a profiler times as parsing
+static Parser::Token next(Parser &parser, Value &value, Profiler *profiler)
+{
+    ProfileScope scope(profiler, Profiler::Parse);
+    return parser.next(value);
+}
 
-    // delete items in autorelease pool
-    List::iterator it;
-    for (it = autoreleasePool->begin(); it != autoreleasePool->end(); it++)
-	delete *it;
-    delete autoreleasePool;
+static void parseList(Parser &parser, List *list, Profiler *profiler)
+{
+    ProfileScope scope(profiler, Profiler::Parse);
+    parser.parseList(list);
+}
+
+// Evaluates the forms the parser reads up to the end or to a closing
+// parenthesis one after another and returns the result of the last.
+// Each list is parsed, evaluated and deleted before the next is read,
+// blocks are not parsed as a whole but have their parameters evaluated
+// the same way.
+Value Engine::evalForms(Parser &parser)
+{
+    Value result;
+    Value value;
+    Parser::Token token;
+    while ((token = next(parser, value, profiler)) != Parser::End && token != Parser::Close) {
+	if (token == Parser::Atom) {
+	    result = eval(value);
+	    continue;
+	}
+
+	List *list = new List;
+	token = next(parser, value, profiler);
+	if (token == Parser::Atom) {
+	    String *name = asType<String>(value);
+	    if (name && blocks.contains(name->value)) {
+		delete list;
+		Block block = blocks.value(name->value);
+		ProfileScope scope(profiler, name->symbol);
+		block.begin(this);
+		evalForms(parser);
+		result = eval(block.end(this));
+		continue;
+	    }
+	    // macros evaluated once are not worth compiling, they get
+	    // the parameters directly
+	    Function macro = name ? macros.value(name->value) : 0;
+	    if (macro) {
+		parseList(parser, list, profiler);
+		{
+		    ProfileScope scope(profiler, name->symbol);
+		    result = eval(macro(this, list));
+		}
+		Parser::deleteList(list);
+		continue;
+	    }
+	    list->append(value);
+	} else if (token == Parser::Open) {
+	    List *head = new List;
+	    parseList(parser, head, profiler);
+	    list->append(head);
+	}
+	if (token != Parser::Close && token != Parser::End)
+	    parseList(parser, list, profiler);
+
+	result = eval(list);
+	Parser::deleteList(list);
+    }
+    return result;
+}
+
+Value Engine::eval(Parser &parser, bool getResult)
+{
+    // evaluate the code, move the result out of the arena
+    Value result = promote(evalForms(parser));
+
+    // release all temporaries
+    if (profiler)
+	profiler->countArena(arena);
+    arena.release();
 
     if (getResult) {
 	// note: the caller from eval has to delete this
@@ -168,49 +293,77 @@ Scriptable * Engine::eval(const QByteArray &string, bool getResult)
 	return result;
     } else {
 	deleteScriptable(result);
-	return 0;
+	return Value();
     }
 }
 
-Scriptable * Engine::evalFile(const QString &name, bool getResult) 
+Value Engine::eval(const QByteArray &string, bool getResult)
+{
+    Parser parser(string);
+    return eval(parser, getResult);
+}
+
+Value Engine::evalFile(const QString &name, bool getResult) 
 {
     QFile file(name);
     if (!file.open(QIODevice::ReadOnly | QIODevice::Text)) {
 	qDebug() << "dela::Engine::evalFile: Cannot open file " << name;
-	return 0;
+	return Value();
     }
 
-    return eval(file.readAll(), getResult);
+    Parser parser(file);
+    return eval(parser, getResult);
 }
 
-void Engine::deleteScriptable(Scriptable *s)
+Value Engine::promote(const Value &v)
 {
-    if (s) {
-	List *list = asType<List>(s);
-	if (list) {
-	    List::iterator it;
-	    for (it = list->begin(); it != list->end(); it++)
-		deleteScriptable(*it);
+    List *list = asType<List>(v);
+    if (list) {
+	List *result = isTemporary(list) ? new List : list;
+	for (int i = 0; i < list->size(); i++) {
+	    Value item = promote(list->at(i));
+	    if (result == list)
+		(*list)[i] = item;
+	    else
+		result->append(item);
 	}
+	return result;
+    }
+
+    // strings are symbols, which must not be deleted
+    String *string = asType<String>(v);
+    if (string)
+	return new String(string->value);
+    return v;
+}
+
+void Engine::deleteScriptable(const Value &v)
+{
+    List *list = asType<List>(v);
+    if (list) {
+	List::iterator it;
+	for (it = list->begin(); it != list->end(); it++)
+	    deleteScriptable(*it);
     }
 
-    delete s;
+    delete v.toObject();
 }
 
-Scriptable* Engine::readProperty(List *params, const QByteArray &name, int index)
+Value Engine::readProperty(List *params, int name, int index)
 {
+    ProfileScope scope(profiler, Profiler::Properties);
     index++;
     List *list;
     for (List::iterator it = params->begin(); it != params->end(); it++) {
 	list = ensureType<List>(*it);
 	if (list->size() >= index + 1) {
 	    String *var = ensureType<String>(list->at(0));
-	    if (var->value == name)
+	    if (var->symbol == name)
 		return eval(list->at(index));
 	}
     }
 
-    return 0;
+    return Value();
 }
 
 }
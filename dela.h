@@ -23,32 +23,96 @@ with this program; if not, see <http://www.gnu.org/licenses/>. */
 #include <QList>
 #include <QString>
 
+#include <new>
+#include <vector>
+
 namespace dela {
 
+class Code;
 class List;
+class Profiler;
 class String;
-class Number;
 
 class Scriptable
 {
 public:
     virtual ~Scriptable() {};
+    // for asType(), which checks these types most often
+    virtual List *asList() { return 0; };
+    virtual String *asString() { return 0; };
     virtual QByteArray toString() {
 	return "{Scriptable <0x" + QByteArray::number((qulonglong)this, 16) + ">}";
     };
 };
 
+// A number, an object or nil (0). Numbers are stored in the upper half
+// of the value with the lowest bit set, which no object pointer has,
+// so they are never allocated.
+class Value
+{
+private:
+    quint64 bits;
+
+public:
+    Value() : bits(0) {};
+    Value(Scriptable *s) : bits((quintptr)s) {};
+
+    static inline Value fromNumber(float x) {
+	union { float f; quint32 i; } u;
+	u.f = x;
+	Value v;
+	v.bits = ((quint64)u.i << 32) | 1;
+	return v;
+    };
+
+    inline bool isNil() const {
+	return bits == 0;
+    };
+    inline bool isNumber() const {
+	return bits & 1;
+    };
+    inline float toNumber() const {
+	union { float f; quint32 i; } u;
+	u.i = (quint32)(bits >> 32);
+	return u.f;
+    };
+    inline Scriptable *toObject() const {
+	return isNumber() ? 0 : (Scriptable *)(quintptr)bits;
+    };
+};
+
 // Generic type checking functions...
 template<class T>
 inline T * asType(Scriptable *s) { 
     return dynamic_cast<T *>(s); 
 }
 
+// ...without a dynamic_cast for lists and strings
+template<>
+inline List * asType<List>(Scriptable *s) { 
+    return s ? s->asList() : 0; 
+}
+
+template<>
+inline String * asType<String>(Scriptable *s) { 
+    return s ? s->asString() : 0; 
+}
+
+template<class T>
+inline T * asType(const Value &v) { 
+    return asType<T>(v.toObject()); 
+}
+
 template<class T>
 inline bool isType(Scriptable *s) { 
     return asType<T>(s) != 0; 
 }
 
+template<class T>
+inline bool isType(const Value &v) { 
+    return asType<T>(v) != 0; 
+}
+
 template <class T>
 inline T* ensureType(Scriptable *s)
 {
@@ -61,6 +125,22 @@ inline T* ensureType(Scriptable *s)
     return 0;
 }
 
+template <class T>
+inline T* ensureType(const Value &v)
+{
+    return ensureType<T>(v.toObject());
+}
+
+inline float ensureNumber(const Value &v)
+{
+    if (v.isNumber())
+	return v.toNumber();
+
+    qDebug() << "dela::ensureType: Wrong type error";
+    exit(1);
+    return 0;
+}
+
 // Generic toString function with 0-check
 inline QByteArray toString(Scriptable *s) 
 {
@@ -70,48 +150,56 @@ inline QByteArray toString(Scriptable *s)
 	return "nil";
 }
 
+inline QByteArray toString(const Value &v) 
+{
+    if (v.isNumber())
+	return QByteArray::number(v.toNumber());
+    else
+	return toString(v.toObject());
+}
+
 class String : public Scriptable
 {
 public:
-    String(QByteArray value) : value(value) {
+    String(QByteArray value) : value(value), symbol(-1), variable(-1) {
 	//qDebug() << "New string: " << value;
     };
     virtual ~String() {
 	//qDebug() << "Release string: " << value;
     };
 
+    virtual String *asString() {
+	return this;
+    };
+
     virtual QByteArray toString() {
 	return value;
     };
 
     QByteArray value;
+    // for interned strings the symbol of value and, if value is a
+    // $name, the symbol of the variable name, otherwise -1
+    int symbol;
+    int variable;
 };
 
-class Number : public Scriptable
-{
-public:
-    Number(float value) : value(value) {
-	//qDebug() << "New number: " << value;
-    };
-    virtual ~Number() {
-	//qDebug() << "Release number: " << value;
-    };
-
-    virtual QByteArray toString() {
-	return QByteArray::number(value);
-    };
-
-    float value;
-};
+// Names are interned to small integer symbols when they are parsed,
+// the same for all engines. Each symbol has one String, which lives as
+// long as the program.
+int intern(const QByteArray &name);
+String *symbol(int id);
+int symbolCount();
 
-class List : public QList<Scriptable *>, public Scriptable
+class List : public QList<Value>, public Scriptable
 {
 public:
-    List() {
+    List() : compiled(0) {
 	//qDebug() << "New List.";
     };
-    virtual ~List() {
-	//qDebug() << "Release List.";
+    virtual ~List();
+
+    virtual List *asList() {
+	return this;
     };
 
     virtual QByteArray toString() {
@@ -119,78 +207,210 @@ public:
 	for (List::iterator it = begin(); it != end(); it++) {
 	    if (!result.isEmpty())
 		result += " ";
-	    result += (*it)->toString();
+	    result += dela::toString(*it);
 	}
 	return "(" + result + ")";
     };
+
+    // the code Engine::eval compiled this list to, or 0
+    Code *compiled;
 };
 
 class Engine;
+class Parser;
+
+typedef Value (*Function)(Engine *, List *);
+
+// Blocks are macros like scene which evaluate each parameter once, in
+// order: begin runs before the first parameter and the result of end
+// is the result of the block. In files, blocks at the top level or in
+// other blocks have their parameters evaluated while they are parsed.
+typedef void (*BlockBegin)(Engine *);
+typedef Value (*BlockEnd)(Engine *);
+
+struct Block
+{
+    BlockBegin begin;
+    BlockEnd end;
+};
+
+// Memory for the temporaries of one Engine::eval. Objects are placed
+// into large blocks by bumping a pointer and are all released at once;
+// only those which own memory themselves are remembered for their
+// destructors.
+class Arena
+{
+private:
+    enum { blockSize = 1 << 20 };
+
+    std::vector<char *> blocks;
+    char *current;
+    char *end;
+    std::vector<Scriptable *> destructibles;
 
-typedef Scriptable * (*Function)(Engine *, List *);
+    Arena(const Arena &);
+    Arena &operator=(const Arena &);
+
+public:
+    // allocate() calls since the last release()
+    quint64 allocations;
+
+    Arena() : current(0), end(0), allocations(0) {};
+    ~Arena() { release(); };
+
+    inline void *allocate(size_t size) {
+	allocations++;
+	size = (size + 7) & ~7;
+	if ((size_t)(end - current) < size)
+	    grow();
+	void *p = current;
+	current += size;
+	return p;
+    };
+    template <class T>
+    inline T *destroyLater(T *s) {
+	destructibles.push_back(s);
+	return s;
+    };
+
+    void grow();
+    bool contains(const Scriptable *s) const;
+    // bytes of the blocks up to the current position
+    size_t used() const;
+    inline int objectCount() const {
+	return destructibles.size();
+    };
+    // destroys all objects and frees the blocks
+    void release();
+};
 
 class Engine
 {
 private:
+    struct Variable {
+	Value value;
+	bool defined;
+    };
+
     QHash<QByteArray, Function> functions;
     QHash<QByteArray, Function> macros;
-    QHash<QByteArray, Scriptable*> variables;
-
-    List * autoreleasePool;
-    QByteArray code;
-    int pos;
+    QHash<QByteArray, Block> blocks;
+    // names the compiler turns into instructions, see dela_vm.h
+    QHash<QByteArray, int> instructions;
+    // indexed by the symbol of the variable name
+    std::vector<Variable> variables;
+
+    Arena arena;
+    void *userData;
+    Profiler *profiler;
+
+    Value eval(Parser &parser, bool getResult);
+    Value evalForms(Parser &parser);
+    Value run(const Code *code);
+    void compileAll(const Value &v);
+
+    inline Variable &variable(int symbol) {
+	if (symbol >= (int)variables.size()) {
+	    Variable v = { Value(), false };
+	    variables.resize(symbolCount(), v);
+	}
+	return variables[symbol];
+    };
 
-    // Parsing functions
-    Scriptable * recogToken(QByteArray str);
-    List * parse();
+    friend class Compiler;
 
 public:
     Engine();
+    // An engine with the functions, macros, blocks and variables of
+    // outer, e.g. to evaluate code on another thread. It shares the
+    // compiled code of outer, which must have been prepared.
+    Engine(const Engine &outer);
     virtual ~Engine();
 
-    Scriptable * eval(Scriptable * code);
-    Scriptable * eval(const QByteArray &string, bool getResult = false);
-    Scriptable * evalFile(const QString &name, bool getResult = false);
-
-    void addFunction(QByteArray name, Function f) { functions[name] = f; };
-    void addMacro(QByteArray name, Function f) { macros[name] = f; };
-    void setVariable(QByteArray name, Scriptable *s) { variables[name] = s; };
-    void unsetVariable(QByteArray name) { variables.remove(name); };
+    Value eval(const Value &code);
+    Value eval(const QByteArray &string, bool getResult = false);
+    Value evalFile(const QString &name, bool getResult = false);
+
+    // Compiles the lists in code and in the variables ahead. Engines
+    // forked from this one may then evaluate them on several threads,
+    // none of which compiles a shared list anymore.
+    void prepare(const Value &code);
+
+    // Times the evaluation from now on, see Profiler; 0 turns it off.
+    // Set it before evaluating code, compiled code only times its for
+    // loops if it was compiled with a profiler.
+    void setProfiler(Profiler *p) { profiler = p; };
+    Profiler *getProfiler() const { return profiler; };
+
+    // Data of the program the functions belong to, 0 by default
+    void setUserData(void *data) { userData = data; };
+    void *getUserData() const { return userData; };
+
+    void addFunction(QByteArray name, Function f) {
+	functions[name] = f;
+	instructions.remove(name);
+	blocks.remove(name);
+    };
+    void addMacro(QByteArray name, Function f) {
+	macros[name] = f;
+	instructions.remove(name);
+	blocks.remove(name);
+    };
+    void addBlock(QByteArray name, BlockBegin begin, BlockEnd end) {
+	Block block = { begin, end };
+	blocks[name] = block;
+	functions.remove(name);
+	macros.remove(name);
+	instructions.remove(name);
+    };
+    // Lets the compiler emit op for calls of name, which must behave
+    // like the function of that name or be a special form (set, for)
+    void addInstruction(QByteArray name, int op) { instructions[name] = op; };
+
+    void setVariable(int symbol, const Value &v) {
+	Variable &var = variable(symbol);
+	var.value = v;
+	var.defined = true;
+    };
+    void setVariable(const QByteArray &name, const Value &v) {
+	setVariable(intern(name), v);
+    };
+    void unsetVariable(const QByteArray &name) {
+	variable(intern(name)).defined = false;
+    };
 
-    Scriptable* readProperty(List *params, const QByteArray &name, int index);
-    inline float readNumberProp(List *params, const QByteArray &name, int index) {
-	return ensureType<Number>(readProperty(params, name, index))->value;
+    // Evaluates item index of the first parameter list (name ...)
+    // with enough items, or returns nil. Macros with several
+    // properties bind them in one pass with a Schema instead.
+    Value readProperty(List *params, int name, int index);
+    inline Value readProperty(List *params, const QByteArray &name, int index) {
+	return readProperty(params, intern(name), index);
+    };
+    template <class Name>
+    inline float readNumberProp(List *params, const Name &name, int index) {
+	return ensureNumber(readProperty(params, name, index));
     };
-    inline float readNumberPropDef(List *params, const QByteArray &name, 
+    template <class Name>
+    inline float readNumberPropDef(List *params, const Name &name, 
 				    int index, float def) {
-	Number *n = asType<Number>(readProperty(params, name, index));
-	return n ? n->value : def;
+	Value v = readProperty(params, name, index);
+	return v.isNumber() ? v.toNumber() : def;
     };
 
-    template <class T>
-    T autorelease(T s) {
-        if (s && !autoreleasePool->contains(s)) {
-            autoreleasePool->append(s);
-        }
-        return s;
-    }
+    // Temporaries live in the arena until the current eval() returns
+    inline List *newList() {
+	return arena.destroyLater(new (arena.allocate(sizeof(List))) List);
+    };
+    inline bool isTemporary(const Scriptable *s) const {
+	return arena.contains(s);
+    };
 
-    template <class T>
-    T undoAutorelease(T s) {
-        if (autoreleasePool->contains(s)) {
-            List *list = asType<List>(s);
-            if (list) {
-                List::iterator it;
-                for (it = list->begin(); it != list->end(); it++)
-                    undoAutorelease(*it);
-            }
-
-            autoreleasePool->removeAll(s);
-        }
-        return s;
-    }
-
-    static void deleteScriptable(Scriptable *s);
+    // Copies temporaries and strings in v to the heap, so v survives
+    // the arena; lists are promoted with their items. Other objects
+    // are returned unchanged.
+    Value promote(const Value &v);
+
+    static void deleteScriptable(const Value &v);
 };
 
 }
@@ -15,136 +15,634 @@ General Public License for more details.
 You should have received a copy of the GNU General Public License along 
 with this program; if not, see <http://www.gnu.org/licenses/>. */
 
-#include <algorithm>
+#include <iostream>
+#include <vector>
 
 #include <QByteArray>
 #include <QDebug>
+#include <QFile>
+#include <QFileInfo>
+#include <QTime>
 
 #include "dela.h"
 #include "dela_builtins.h"
 #include "dela_glue.h"
+#include "dela_profiler.h"
+#include "dela_schema.h"
 
 #include "camera.h"
 #include "light.h"
+#include "meshloader.h"
 #include "primitives.h"
 #include "scene.h"
+#include "scenefile.h"
+#include "threadpool.h"
 
-static Scene *curScene = 0;
+// What the glue functions of one engine build. The engines which
+// parallel-for forks have their own, so that they never share a scene.
+struct GlueState
+{
+    Scene *curScene;
+    // scenes whose blocks enclose the current one
+    std::vector<Scene *> outerScenes;
+    // groups being evaluated, instances cannot be nested
+    int groupDepth;
+    // directory of the file loadScene() reads, mesh files are relative to it
+    QString curSceneDir;
+    // mesh files the scene loaded, a compiled scene depends on them
+    QStringList curDependencies;
+
+    GlueState() : curScene(0), groupDepth(0), curSceneDir(".") {};
+};
+
+// for engines which were not given a state by loadScene()
+static GlueState defaultState;
+static bool compiledScenes = false;
+static bool profiledScenes = false;
+// folded call stacks of the profile are written there, if not empty
+static QString foldedFile;
+
+static GlueState &glue(dela::Engine *e)
+{
+    GlueState *state = (GlueState *)e->getUserData();
+    return state ? *state : defaultState;
+}
+
+static Scene *currentScene(dela::Engine *e)
+{
+    Scene *scene = glue(e).curScene;
+    if (!scene) {
+	qDebug() << "dela_glue error: No curScene set";
+	exit(1);
+    }
+    return scene;
+}
 
-static dela::Scriptable* scene(dela::Engine *e, dela::List *params)
+static void beginScene(dela::Engine *e)
 {
-    Scene *lastScene = curScene;
-    curScene = new Scene();
-    for (dela::List::iterator it = params->begin(); it != params->end(); it++)
-	e->eval(*it);
+    GlueState &g = glue(e);
+    g.outerScenes.push_back(g.curScene);
+    g.curScene = new Scene();
+}
 
-    std::swap(curScene, lastScene);
-    return lastScene;
+static dela::Value endScene(dela::Engine *e)
+{
+    GlueState &g = glue(e);
+    Scene *scene = g.curScene;
+    scene->build();
+
+    g.curScene = g.outerScenes.back();
+    g.outerScenes.pop_back();
+    return scene;
 }
 
-static dela::Scriptable* sphere(dela::Engine *e, dela::List *params)
+// A sub-scene with its own acceleration structure, placed into the
+// current scene by instances:
+// (set tree (group (sphere ...) (mesh ...)))
+// (instance (of $tree) (position 4 0 0) (rotation 0 90 0) (scale 2))
+static void beginGroup(dela::Engine *e)
 {
-    if (!curScene) {
-	qDebug() << "dela_glue error: No curScene set";
+    GlueState &g = glue(e);
+    g.outerScenes.push_back(currentScene(e));
+    g.curScene = new Scene();
+    g.groupDepth++;
+}
+
+static dela::Value endGroup(dela::Engine *e)
+{
+    GlueState &g = glue(e);
+    g.groupDepth--;
+    Scene *group = g.curScene;
+    group->build();
+
+    g.curScene = g.outerScenes.back();
+    g.outerScenes.pop_back();
+    g.curScene->addGroup(group);
+    return group;
+}
+
+struct InstanceProps
+{
+    dela::Value of;
+    vec position;
+    // in degrees around the x, y and z axis
+    vec rotation;
+    // one factor or one per axis, unset axes are nan
+    vec scale;
+
+    InstanceProps() : scale(1, NAN, NAN) {};
+};
+
+static const dela::Schema<InstanceProps> instanceSchema =
+    dela::Schema<InstanceProps>("instance")
+    .value("of", &InstanceProps::of)
+    .numbers("position", &InstanceProps::position)
+    .numbers("rotation", &InstanceProps::rotation)
+    .numbers("scale", &InstanceProps::scale);
+
+static dela::Value instance(dela::Engine *e, dela::List *params)
+{
+    Scene *curScene = currentScene(e);
+    if (glue(e).groupDepth) {
+	qDebug() << "dela_glue error: Instances cannot be placed into groups";
 	exit(1);
     }
 
-    vec pos = vec(e->readNumberProp(params, "position", 0),
-		  e->readNumberProp(params, "position", 1),
-		  e->readNumberProp(params, "position", 2));
+    InstanceProps p = instanceSchema.bind(e, params);
+    Scene *group = dela::asType<Scene>(p.of);
+    if (!group) {
+	qDebug() << "dela_glue error: instance needs a (of $group)";
+	exit(1);
+    }
+
+    vec scale = p.scale;
+    if (scale.y != scale.y)
+	scale.y = scale.x;
+    if (scale.z != scale.z)
+	scale.z = scale.x;
+    if (scale.x == 0 || scale.y == 0 || scale.z == 0) {
+	qDebug() << "dela_glue error: instance scale must not be 0";
+	exit(1);
+    }
+
+    Instance *instance = new Instance(group, Transform::translation(p.position)
+				      * Transform::rotation(p.rotation)
+				      * Transform::scaling(scale));
+    curScene->addPrimitive(instance);
+    return instance;
+}
+
+struct SphereProps
+{
+    vec position;
+    float radius;
+    vec color;
+
+    SphereProps() : radius(1), color(1, 1, 1) {};
+};
 
-    float radius = e->readNumberPropDef(params, "radius", 0, 1);
+static const dela::Schema<SphereProps> sphereSchema =
+    dela::Schema<SphereProps>("sphere")
+    .numbers("position", &SphereProps::position, true)
+    .numbers("radius", &SphereProps::radius)
+    .numbers("color", &SphereProps::color);
 
-    vec color = vec(e->readNumberPropDef(params, "color", 0, 1),
-		    e->readNumberPropDef(params, "color", 1, 1),
-		    e->readNumberPropDef(params, "color", 2, 1));
+static dela::Value sphere(dela::Engine *e, dela::List *params)
+{
+    Scene *curScene = currentScene(e);
 
-    Sphere *sphere = new Sphere(pos, radius, color);
+    SphereProps p = sphereSchema.bind(e, params);
+    Sphere *sphere = new Sphere(p.position, p.radius, p.color);
     curScene->addPrimitive(sphere);
     return sphere;
 }
 
-static dela::Scriptable* plane(dela::Engine *e, dela::List *params)
+struct PlaneProps
 {
-    if (!curScene) {
-	qDebug() << "dela_glue error: No curScene set";
-	exit(1);
-    }
+    vec position;
+    vec normal;
+    vec color;
 
-    vec pos = vec(e->readNumberPropDef(params, "position", 0, 0),
-		  e->readNumberPropDef(params, "position", 1, -1),
-		  e->readNumberPropDef(params, "position", 2, 0));
+    PlaneProps() : position(0, -1, 0), normal(0, 1, 0), color(1, 1, 1) {};
+};
 
-    vec normal = vec(e->readNumberPropDef(params, "normal", 0, 0),
-		     e->readNumberPropDef(params, "normal", 1, 1),
-		     e->readNumberPropDef(params, "normal", 2, 0));
+static const dela::Schema<PlaneProps> planeSchema =
+    dela::Schema<PlaneProps>("plane")
+    .numbers("position", &PlaneProps::position)
+    .numbers("normal", &PlaneProps::normal)
+    .numbers("color", &PlaneProps::color);
 
-    vec color = vec(e->readNumberPropDef(params, "color", 0, 1),
-		    e->readNumberPropDef(params, "color", 1, 1),
-		    e->readNumberPropDef(params, "color", 2, 1));
+static dela::Value plane(dela::Engine *e, dela::List *params)
+{
+    Scene *curScene = currentScene(e);
 
-    Plane *plane = new Plane(pos, normal, color);
+    PlaneProps p = planeSchema.bind(e, params);
+    Plane *plane = new Plane(p.position, p.normal, p.color);
     curScene->addPrimitive(plane);
     return plane;
 }
 
-static dela::Scriptable* camera(dela::Engine *e, dela::List *params)
+struct MeshProps
 {
-    if (!curScene) {
-	qDebug() << "dela_glue error: No curScene set";
+    dela::Value file;
+    vec position;
+    float scale;
+    vec color;
+
+    MeshProps() : scale(1), color(1, 1, 1) {};
+};
+
+static const dela::Schema<MeshProps> meshSchema =
+    dela::Schema<MeshProps>("mesh")
+    .value("file", &MeshProps::file)
+    .numbers("position", &MeshProps::position)
+    .numbers("scale", &MeshProps::scale)
+    .numbers("color", &MeshProps::color);
+
+static dela::Value mesh(dela::Engine *e, dela::List *params)
+{
+    Scene *curScene = currentScene(e);
+
+    MeshProps p = meshSchema.bind(e, params);
+    dela::String *file = dela::asType<dela::String>(p.file);
+    if (!file) {
+	qDebug() << "dela_glue error: mesh needs a (file \"name\")";
 	exit(1);
     }
+    QByteArray name = file->value;
+    if (name.startsWith("\"") && name.endsWith("\"") && name.size() >= 2)
+	name = name.mid(1, name.size() - 2);
+    QString fileName = name;
+    if (!name.startsWith("/"))
+	fileName = glue(e).curSceneDir + "/" + fileName;
+
+    QTime time;
+    time.start();
+    TriangleMesh *mesh = new TriangleMesh(p.color);
+    if (!loadMesh(fileName, *mesh)) {
+	qDebug() << "dela_glue error: Cannot load mesh" << fileName;
+	exit(1);
+    }
+    glue(e).curDependencies << fileName;
+    for (unsigned int i = 0; i < mesh->vertices.size(); i++)
+	mesh->vertices[i] = mesh->vertices[i] * p.scale + p.position;
+    std::cout << "Mesh " << name.constData() << ": " << mesh->vertices.size()
+	      << " vertices, " << mesh->triangleCount() << " triangles, loaded in "
+	      << time.elapsed() << " ms." << std::endl;
+
+    curScene->addPrimitive(mesh);
+    return mesh;
+}
 
-    vec pos = vec(e->readNumberPropDef(params, "position", 0, 0),
-		  e->readNumberPropDef(params, "position", 1, 0),
-		  e->readNumberPropDef(params, "position", 2, -10));
+struct CameraProps
+{
+    vec position;
+    vec direction;
+    vec up;
+    float hlen;
+    float vlen;
+    float aperture;
+    float focus;
+
+    CameraProps()
+	: position(0, 0, -10), direction(0, 0, 1), up(0, 1, 0),
+	  hlen(1.333), vlen(1.0), aperture(0), focus(10) {};
+};
+
+static const dela::Schema<CameraProps> cameraSchema =
+    dela::Schema<CameraProps>("camera")
+    .numbers("position", &CameraProps::position)
+    .numbers("direction", &CameraProps::direction)
+    .numbers("up", &CameraProps::up)
+    .numbers("hlen", &CameraProps::hlen)
+    .numbers("vlen", &CameraProps::vlen)
+    .numbers("aperture", &CameraProps::aperture)
+    .numbers("focus", &CameraProps::focus);
+
+static dela::Value camera(dela::Engine *e, dela::List *params)
+{
+    Scene *curScene = currentScene(e);
 
-    vec dir = vec(e->readNumberPropDef(params, "direction", 0, 0),
-		  e->readNumberPropDef(params, "direction", 1, 0),
-		  e->readNumberPropDef(params, "direction", 2, 1));
+    CameraProps p = cameraSchema.bind(e, params);
+    Camera *camera = new Camera(p.position, p.direction, p.up, p.hlen, p.vlen,
+				p.aperture, p.focus);
+    curScene->setCamera(camera);
+    return camera;
+}
 
-    vec up = vec(e->readNumberPropDef(params, "up", 0, 0),
-		 e->readNumberPropDef(params, "up", 1, 1),
-		 e->readNumberPropDef(params, "up", 2, 0));
 
+struct LightProps
+{
+    vec position;
+    vec color;
+    float power;
 
-    float hlen = e->readNumberPropDef(params, "hlen", 0, 1.333);
-    float vlen = e->readNumberPropDef(params, "vlen", 0, 1.0);
+    LightProps() : position(0, 8, -1), color(.2, .2, .2), power(30.0) {};
+};
 
-    Camera *camera = new Camera(pos, dir, up, hlen, vlen);
-    curScene->setCamera(camera);
-    return camera;
+static const dela::Schema<LightProps> lightSchema =
+    dela::Schema<LightProps>("light")
+    .numbers("position", &LightProps::position)
+    .numbers("color", &LightProps::color)
+    .numbers("power", &LightProps::power);
+
+static dela::Value light(dela::Engine *e, dela::List *params)
+{
+    Scene *curScene = currentScene(e);
+
+    LightProps p = lightSchema.bind(e, params);
+    Light *light = new Light(p.position, p.color, p.power);
+    curScene->setLight(light);
+    return light;
 }
 
 
-static dela::Scriptable* light(dela::Engine *e, dela::List *params)
+// Generators of many spheres, which are added to the scene in bulk
+// without a primitive or a macro call each. They result in the number
+// of spheres.
+
+// (sphere-grid (count nx ny nz) (position x y z) (spacing dx dy dz) ...)
+// places nx * ny * nz spheres in a grid starting at position
+struct SphereGridProps
 {
-    if (!curScene) {
-	qDebug() << "dela_glue error: No curScene set";
+    float count[3];
+    vec position;
+    vec spacing;
+    float radius;
+    vec color;
+
+    SphereGridProps() : spacing(2, 2, 2), radius(1), color(1, 1, 1) {
+	count[0] = count[1] = count[2] = 1;
+    };
+};
+
+static const dela::Schema<SphereGridProps> sphereGridSchema =
+    dela::Schema<SphereGridProps>("sphere-grid")
+    .numbers("count", &SphereGridProps::count)
+    .numbers("position", &SphereGridProps::position)
+    .numbers("spacing", &SphereGridProps::spacing)
+    .numbers("radius", &SphereGridProps::radius)
+    .numbers("color", &SphereGridProps::color);
+
+// Checks the number of spheres a generator is asked for
+static int sphereCount(const char *generator, double count)
+{
+    if (!(count >= 0 && count <= 1 << 30)) {
+	qDebug() << "dela_glue error:" << generator << "cannot create" << count
+		 << "spheres";
 	exit(1);
     }
+    return (int)count;
+}
+
+static dela::Value sphereGrid(dela::Engine *e, dela::List *params)
+{
+    Scene *curScene = currentScene(e);
+
+    SphereGridProps p = sphereGridSchema.bind(e, params);
+    int nx = sphereCount("sphere-grid", p.count[0]);
+    int ny = sphereCount("sphere-grid", p.count[1]);
+    int nz = sphereCount("sphere-grid", p.count[2]);
+    int count = sphereCount("sphere-grid", (double)nx * ny * nz);
+
+    curScene->reserveSpheres(count);
+    for (int z = 0; z < nz; z++)
+	for (int y = 0; y < ny; y++)
+	    for (int x = 0; x < nx; x++)
+		curScene->addSphere(p.position + vec(x * p.spacing.x, y * p.spacing.y,
+						     z * p.spacing.z),
+				    p.radius, p.color);
+    return dela::Value::fromNumber(count);
+}
 
-    vec pos = vec(e->readNumberPropDef(params, "position", 0, 0),
-		  e->readNumberPropDef(params, "position", 1, 8),
-		  e->readNumberPropDef(params, "position", 2, -1));
+// (sphere-ring (count n) (ring-radius r) (position x y z) ...) places
+// n spheres evenly on a circle around position, parallel to the
+// ground plane
+struct SphereRingProps
+{
+    float count;
+    float ringRadius;
+    vec position;
+    float radius;
+    vec color;
+
+    SphereRingProps() : count(0), ringRadius(0), radius(1), color(1, 1, 1) {};
+};
+
+static const dela::Schema<SphereRingProps> sphereRingSchema =
+    dela::Schema<SphereRingProps>("sphere-ring")
+    .numbers("count", &SphereRingProps::count, true)
+    .numbers("ring-radius", &SphereRingProps::ringRadius, true)
+    .numbers("position", &SphereRingProps::position)
+    .numbers("radius", &SphereRingProps::radius)
+    .numbers("color", &SphereRingProps::color);
+
+static dela::Value sphereRing(dela::Engine *e, dela::List *params)
+{
+    Scene *curScene = currentScene(e);
 
-    vec color = vec(e->readNumberPropDef(params, "color", 0, .2),
-		    e->readNumberPropDef(params, "color", 1, .2),
-		    e->readNumberPropDef(params, "color", 2, .2));
+    SphereRingProps p = sphereRingSchema.bind(e, params);
+    int count = sphereCount("sphere-ring", p.count);
 
-    float power = e->readNumberPropDef(params, "power", 0, 30.0);
+    curScene->reserveSpheres(count);
+    for (int i = 0; i < count; i++) {
+	float a = 2 * M_PI * i / count;
+	curScene->addSphere(p.position + vec(sin(a), 0, cos(a)) * p.ringRadius,
+			    p.radius, p.color);
+    }
+    return dela::Value::fromNumber(count);
+}
 
-    Light *light = new Light(pos, color, power);
-    curScene->setLight(light);
-    return light;
+// (sphere-array (positions x y z ...) (radii r ...) (colors r g b ...))
+// places one sphere at every position. The lists may be given as
+// items or as lists of numbers, e.g. (positions $list). Without radii
+// or colors, all spheres have (radius r) and (color r g b).
+struct SphereArrayProps
+{
+    std::vector<float> positions;
+    std::vector<float> radii;
+    std::vector<float> colors;
+    float radius;
+    vec color;
+
+    SphereArrayProps() : radius(1), color(1, 1, 1) {};
+};
+
+static const dela::Schema<SphereArrayProps> sphereArraySchema =
+    dela::Schema<SphereArrayProps>("sphere-array")
+    .numberList("positions", &SphereArrayProps::positions)
+    .numberList("radii", &SphereArrayProps::radii)
+    .numberList("colors", &SphereArrayProps::colors)
+    .numbers("radius", &SphereArrayProps::radius)
+    .numbers("color", &SphereArrayProps::color);
+
+static dela::Value sphereArray(dela::Engine *e, dela::List *params)
+{
+    Scene *curScene = currentScene(e);
+
+    SphereArrayProps p = sphereArraySchema.bind(e, params);
+    int count = p.positions.size() / 3;
+    if (p.positions.size() % 3) {
+	qDebug() << "dela_glue error: sphere-array needs 3 numbers per position";
+	exit(1);
+    }
+    if (!p.radii.empty() && (int)p.radii.size() != count) {
+	qDebug() << "dela_glue error: sphere-array needs one radius per position";
+	exit(1);
+    }
+    if (!p.colors.empty() && (int)p.colors.size() != 3 * count) {
+	qDebug() << "dela_glue error: sphere-array needs one color per position";
+	exit(1);
+    }
+
+    curScene->reserveSpheres(count);
+    for (int i = 0; i < count; i++) {
+	const float *pos = &p.positions[3 * i];
+	vec color = p.color;
+	if (!p.colors.empty())
+	    color = vec(p.colors[3 * i], p.colors[3 * i + 1], p.colors[3 * i + 2]);
+	curScene->addSphere(vec(pos[0], pos[1], pos[2]),
+			    p.radii.empty() ? p.radius : p.radii[i], color);
+    }
+    return dela::Value::fromNumber(count);
+}
+
+// (parallel-for (i from to [step]) code-lines ...) runs the iterations
+// of a for loop on the thread pool. The chunks of iterations are
+// evaluated by engines forked from e, each with its own scene, which
+// are merged into the current scene in the order of the iterations.
+// The values of i are those of for, which adds up step while the sum
+// is <= to. Variables set by the iterations are not seen outside of
+// them.
+class ParallelForJob : public RangeJob
+{
+private:
+    const dela::Engine &engine;
+    const GlueState &outer;
+    dela::List *params;
+    int symbol;
+    const std::vector<float> &values;
+
+public:
+    std::vector<GlueState> states;
+
+    ParallelForJob(const dela::Engine &engine, const GlueState &outer,
+		   dela::List *params, int symbol, const std::vector<float> &values)
+	: RangeJob(0, values.size()), engine(engine), outer(outer), params(params),
+	  symbol(symbol), values(values), states(chunkCount()) {};
+
+    virtual void range(int begin, int end, int chunk, int /* thread */) {
+	GlueState &state = states[chunk];
+	state.curScene = new Scene();
+	state.groupDepth = outer.groupDepth;
+	state.curSceneDir = outer.curSceneDir;
+
+	dela::Engine worker(engine);
+	worker.setUserData(&state);
+	for (int i = begin; i < end; i++) {
+	    worker.setVariable(symbol, dela::Value::fromNumber(values[i]));
+	    for (int j = 1; j < params->size(); j++)
+		worker.eval(params->at(j));
+	}
+    };
+};
+
+static dela::Value parallelFor(dela::Engine *e, dela::List *params)
+{
+    Scene *curScene = currentScene(e);
+    if (params->isEmpty()) {
+	qDebug() << "dela_glue error: parallel-for is empty";
+	exit(1);
+    }
+    dela::List *loop = dela::ensureType<dela::List>(params->at(0));
+    if (loop->size() < 3) {
+	qDebug() << "dela_glue error: parallel-for parameters are wrong, give me 3";
+	exit(1);
+    }
+
+    dela::Value name = e->eval(loop->at(0));
+    int symbol = dela::intern(dela::ensureType<dela::String>(name)->value);
+    float from = dela::ensureNumber(e->eval(loop->at(1)));
+    float to = dela::ensureNumber(e->eval(loop->at(2)));
+    float step = loop->size() > 3 ? dela::ensureNumber(e->eval(loop->at(3))) : 1;
+    if (!(step > 0)) {
+	qDebug() << "dela_glue error: parallel-for needs a positive step";
+	exit(1);
+    }
+    std::vector<float> values;
+    for (float i = from; i <= to; i += step) {
+	if (values.size() == 1u << 30 || i + step == i) {
+	    qDebug() << "dela_glue error: parallel-for has too many iterations";
+	    exit(1);
+	}
+	values.push_back(i);
+    }
+
+    // the forked engines must not compile the shared code themselves
+    e->prepare(params);
+
+    GlueState &g = glue(e);
+    ParallelForJob job(*e, g, params, symbol, values);
+    ThreadPool::instance().run(job);
+
+    for (unsigned int c = 0; c < job.states.size(); c++) {
+	GlueState &state = job.states[c];
+	if (!state.curScene)
+	    continue;
+	curScene->merge(*state.curScene);
+	delete state.curScene;
+	g.curDependencies << state.curDependencies;
+    }
+    return dela::Value();
 }
 
 
 void addDelaGlue(dela::Engine *e)
 {
-    e->addMacro("scene",  &scene);
+    e->addBlock("scene",  &beginScene, &endScene);
+    e->addBlock("group",  &beginGroup, &endGroup);
     e->addMacro("sphere", &sphere);
     e->addMacro("plane",  &plane);
+    e->addMacro("mesh",   &mesh);
+    e->addMacro("instance", &instance);
     e->addMacro("camera", &camera);
     e->addMacro("light",  &light);
+    e->addMacro("sphere-grid",  &sphereGrid);
+    e->addMacro("sphere-ring",  &sphereRing);
+    e->addMacro("sphere-array", &sphereArray);
+    e->addMacro("parallel-for", &parallelFor);
+}
+
+Scene *loadScene(const QString &fileName)
+{
+    if (!QFile::exists(fileName)) {
+	qDebug() << "loadScene error: file not found: " << fileName;
+	return 0;
+    }
+
+    QString compiledName = fileName + ".frc";
+    QByteArray hash;
+    if (compiledScenes) {
+	QTime time;
+	time.start();
+	hash = SceneFile::hash(fileName);
+	if (Scene *scene = SceneFile::load(compiledName, hash)) {
+	    std::cout << "Compiled scene " << qPrintable(compiledName)
+		      << " loaded in " << time.elapsed() << " ms." << std::endl;
+	    return scene;
+	}
+    }
+
+    GlueState state;
+    state.curSceneDir = QFileInfo(fileName).path();
+
+    dela::Engine e;
+    addDelaGlue(&e);
+    e.setUserData(&state);
+    dela::Profiler profiler;
+    if (profiledScenes)
+	e.setProfiler(&profiler);
+
+    Scene *scene = dela::ensureType<Scene>(e.evalFile(fileName, true));
+    if (profiledScenes) {
+	profiler.report(std::cout);
+	if (!foldedFile.isEmpty() && !profiler.writeFolded(foldedFile))
+	    qDebug() << "loadScene error: cannot write" << foldedFile;
+    }
+    if (compiledScenes && SceneFile::save(*scene, compiledName, hash,
+					  state.curDependencies))
+	std::cout << "Compiled scene written to " << qPrintable(compiledName)
+		  << "." << std::endl;
+    return scene;
+}
+
+void setCompiledScenes(bool on)
+{
+    compiledScenes = on;
+}
+
+void setSceneProfiling(bool on, const QString &fileName)
+{
+    profiledScenes = on;
+    foldedFile = fileName;
 }
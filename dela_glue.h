@@ -18,8 +18,27 @@ with this program; if not, see <http://www.gnu.org/licenses/>. */
 #ifndef DELA_GLUE_H
 #define DELA_GLUE_H
 
+#include <QString>
+
 #include "dela.h"
 
+class Scene;
+
 extern void addDelaGlue(dela::Engine *e);
 
+// Evaluate a scene file and return the resulting scene, or 0 if the
+// file could not be read. The caller owns the returned scene.
+extern Scene *loadScene(const QString &fileName);
+
+// With compiled scenes on, loadScene() keeps a compiled copy of every
+// scene next to the file as fileName + ".frc" and loads that instead
+// of running the script while it is up to date, see SceneFile.
+extern void setCompiledScenes(bool on);
+
+// With profiling on, loadScene() prints where evaluating the scene
+// file took its time, see dela::Profiler, and writes the call stacks
+// to foldedFile for flamegraph.pl unless it is empty. Compiled scenes
+// which are up to date are not evaluated and not profiled.
+extern void setSceneProfiling(bool on, const QString &foldedFile = QString());
+
 #endif
@@ -0,0 +1,225 @@
+/*funray - yet another raytracer
+opyright (C) 2008  Christian Zeller (chrizel@gmail.com) and
+                    Simon Goller (neosam@gmail.com).
+
+This program is free software; you can redistribute it and/or modify 
+it under the terms of the GNU General Public License as published 
+by the Free Software Foundation; either version 3 of the License, 
+or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful, but 
+WITHOUT ANY WARRANTY; without even the implied warranty of 
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License along 
+with this program; if not, see <http://www.gnu.org/licenses/>. */
+
+#include <QByteArray>
+#include <QFile>
+
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "dela.h"
+#include "dela_parser.h"
+
+namespace dela {
+
+Parser::Parser(const QByteArray &code)
+    : code(code), file(0), mapping(0), data(this->code.constData()),
+      pos(0), end(this->code.size()), eof(true)
+{
+}
+
+Parser::Parser(QFile &file)
+    : file(&file), mapping(0), data(0), pos(0), end(0), eof(false)
+{
+    qint64 size = file.size();
+    mapping = size > 0 ? file.map(0, size) : 0;
+    if (mapping) {
+	data = (const char *)mapping;
+	end = size;
+	eof = true;
+    } else {
+	buffer.resize(chunkSize);
+	data = &buffer[0];
+    }
+}
+
+Parser::~Parser()
+{
+    if (mapping)
+	file->unmap(mapping);
+}
+
+// Reads the next chunk behind the unfinished token starting at token,
+// or -1, which is moved to the start of the buffer. Returns false at
+// the end of the code.
+bool Parser::fill(int &token)
+{
+    if (eof)
+	return false;
+
+    int kept = token >= 0 ? end - token : 0;
+    memmove(&buffer[0], &buffer[end - kept], kept);
+    if (kept + chunkSize / 2 > (int)buffer.size())
+	buffer.resize(buffer.size() * 2);
+    if (token >= 0)
+	token = 0;
+
+    qint64 n = file->read(&buffer[kept], buffer.size() - kept);
+    data = &buffer[0];
+    pos = end = kept;
+    if (n <= 0) {
+	eof = true;
+	return false;
+    }
+    end += n;
+    return true;
+}
+
+// Decimals with at most 15 digits and no exponent, the common case.
+// The digits and the power of ten are exact doubles, so the quotient
+// is rounded once and the same as what strtod returns.
+static bool decimal(const char *p, int size, double &v)
+{
+    static const double powers[] = { 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8,
+				     1e9, 1e10, 1e11, 1e12, 1e13, 1e14, 1e15 };
+    int i = 0;
+    if (size > 0 && (p[0] == '-' || p[0] == '+'))
+	i++;
+
+    qint64 digits = 0;
+    int count = 0;
+    int scale = -1;
+    for (; i < size; i++) {
+	if (p[i] == '.' && scale < 0) {
+	    scale = 0;
+	} else if (isdigit(p[i]) && count < 15) {
+	    digits = digits * 10 + (p[i] - '0');
+	    count++;
+	    if (scale >= 0)
+		scale++;
+	} else {
+	    return false;
+	}
+    }
+    if (!count)
+	return false;
+
+    v = digits / powers[scale > 0 ? scale : 0];
+    if (p[0] == '-')
+	v = -v;
+    return true;
+}
+
+// Numbers are recognized like QByteArray::toDouble did, everything else
+// is interned without copying the token first
+Value Parser::atom(const char *p, int size)
+{
+    double v;
+    if (decimal(p, size, v))
+	return Value::fromNumber(v);
+
+    char token[64];
+    if ((unsigned int)size < sizeof(token)) {
+	memcpy(token, p, size);
+	token[size] = 0;
+
+	bool number = true;
+	for (int i = 0; number && i < size; i++)
+	    number = isdigit(p[i]) || p[i] == '.' || p[i] == '-' || p[i] == '+'
+		|| p[i] == 'e' || p[i] == 'E';
+	if (number) {
+	    char *end;
+	    double v = strtod(token, &end);
+	    if (end == token + size)
+		return Value::fromNumber(v);
+	} else if (!strcmp(token, "nan") || !strcmp(token, "inf")
+		   || !strcmp(token, "+inf") || !strcmp(token, "-inf")) {
+	    return Value::fromNumber(strtod(token, 0));
+	}
+    }
+
+    return symbol(intern(QByteArray::fromRawData(p, size)));
+}
+
+Parser::Token Parser::next(Value &value)
+{
+    bool comment = false;
+    int token = -1;
+    for (;;) {
+	if (pos == end) {
+	    if (!fill(token)) {
+		if (token < 0)
+		    return End;
+		value = atom(data + token, pos - token);
+		return Atom;
+	    }
+	    continue;
+	}
+
+	char c = data[pos];
+
+	// Still inside comment?
+	// Ignore until end of line
+	if (comment) {
+	    pos++;
+	    if (c == '\n')
+		comment = false;
+	    continue;
+	}
+
+	// Token finish?
+	if (token >= 0) {
+	    if (isspace(c) || c == '(' || c == ')' || c == ';') {
+		value = atom(data + token, pos - token);
+		return Atom;
+	    }
+	    pos++;
+	    continue;
+	}
+
+	pos++;
+	if (isspace(c))	// Ignore whitespace
+	    continue;
+	else if (c == ';') // Start of comment
+	    comment = true;
+	else if (c == '(')
+	    return Open;
+	else if (c == ')')
+	    return Close;
+	else
+	    token = pos - 1;
+    }
+}
+
+void Parser::parseList(List *list)
+{
+    Value value;
+    for (;;) {
+	Token token = next(value);
+	if (token == End || token == Close) {
+	    return;
+	} else if (token == Open) {
+	    List *sub = new List;
+	    parseList(sub);
+	    list->append(sub);
+	} else {
+	    list->append(value);
+	}
+    }
+}
+
+void Parser::deleteList(List *list)
+{
+    for (List::iterator it = list->begin(); it != list->end(); it++) {
+	if (List *sub = asType<List>(*it))
+	    deleteList(sub);
+    }
+    delete list;
+}
+
+}
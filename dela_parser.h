@@ -0,0 +1,71 @@
+/*funray - yet another raytracer
+opyright (C) 2008  Christian Zeller (chrizel@gmail.com) and
+                    Simon Goller (neosam@gmail.com).
+
+This program is free software; you can redistribute it and/or modify 
+it under the terms of the GNU General Public License as published 
+by the Free Software Foundation; either version 3 of the License, 
+or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful, but 
+WITHOUT ANY WARRANTY; without even the implied warranty of 
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License along 
+with this program; if not, see <http://www.gnu.org/licenses/>. */
+
+#ifndef DELA_PARSER_H
+#define DELA_PARSER_H
+
+#include <QByteArray>
+#include <QFile>
+
+#include <vector>
+
+#include "dela.h"
+
+namespace dela {
+
+// Reads dela code token by token from a byte array, a memory mapped
+// file or, if the file cannot be mapped, from chunks of it, so that the
+// text is never copied as a whole. Chunks are read into a buffer which
+// only grows for tokens longer than itself.
+class Parser
+{
+private:
+    QByteArray code;
+    QFile *file;
+    uchar *mapping;
+    std::vector<char> buffer;
+    const char *data;
+    int pos, end;
+    bool eof;
+
+    bool fill(int &token);
+    Value atom(const char *p, int size);
+
+public:
+    enum Token { End, Open, Close, Atom };
+    enum { chunkSize = 1 << 20 };
+
+    Parser(const QByteArray &code);
+    // file must be open
+    Parser(QFile &file);
+    ~Parser();
+
+    // Reads the next parenthesis or atom, a number or an interned
+    // string, which is stored in value
+    Token next(Value &value);
+
+    // Reads the items of a list up to its closing parenthesis into
+    // list, the opening one has been read already
+    void parseList(List *list);
+
+    // Deletes a list created by parseList() with its sub-lists
+    static void deleteList(List *list);
+};
+
+}
+
+#endif
@@ -0,0 +1,177 @@
+/*funray - yet another raytracer
+opyright (C) 2008  Christian Zeller (chrizel@gmail.com) and
+                    Simon Goller (neosam@gmail.com).
+
+This program is free software; you can redistribute it and/or modify 
+it under the terms of the GNU General Public License as published 
+by the Free Software Foundation; either version 3 of the License, 
+or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful, but 
+WITHOUT ANY WARRANTY; without even the implied warranty of 
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License along 
+with this program; if not, see <http://www.gnu.org/licenses/>. */
+
+#include <QByteArray>
+#include <QFile>
+#include <QString>
+
+#include <algorithm>
+#include <iomanip>
+
+#include "dela.h"
+#include "dela_profiler.h"
+
+namespace dela {
+
+Profiler::Profiler()
+    : allocations(0), objects(0), peakBytes(0), peakObjects(0)
+{
+    names[0] = intern("(parse)");
+    names[1] = intern("(compile)");
+    names[2] = intern("(properties)");
+    names[3] = intern("for");
+
+    Node root;
+    Entry entry = { -1, 0, 0, 0 };
+    root.entry = entry;
+    root.parent = -1;
+    nodes.push_back(root);
+    timer.start();
+}
+
+void Profiler::enter(int name)
+{
+    if (name < 0)
+	name = names[-name - 1];
+
+    int parent = frames.empty() ? 0 : frames.back().node;
+    int node = nodes[parent].children.value(name, -1);
+    if (node < 0) {
+	Node child;
+	Entry entry = { name, 0, 0, 0 };
+	child.entry = entry;
+	child.parent = parent;
+	node = nodes.size();
+	nodes.push_back(child);
+	nodes[parent].children.insert(name, node);
+    }
+
+    if (name >= (int)depth.size()) {
+	depth.resize(name + 1, 0);
+	Entry entry = { -1, 0, 0, 0 };
+	entries.resize(name + 1, entry);
+    }
+    depth[name]++;
+
+    Frame frame = { node, timer.nsecsElapsed(), 0 };
+    frames.push_back(frame);
+}
+
+void Profiler::leave()
+{
+    Frame frame = frames.back();
+    frames.pop_back();
+    qint64 time = timer.nsecsElapsed() - frame.start;
+    if (!frames.empty())
+	frames.back().children += time;
+
+    Entry &call = nodes[frame.node].entry;
+    call.calls++;
+    call.inclusive += time;
+    call.exclusive += time - frame.children;
+
+    Entry &entry = entries[call.name];
+    entry.name = call.name;
+    entry.calls++;
+    entry.exclusive += time - frame.children;
+    if (--depth[call.name] == 0)
+	entry.inclusive += time;
+}
+
+void Profiler::countArena(const Arena &arena)
+{
+    allocations += arena.allocations;
+    objects += arena.objectCount();
+    peakBytes = std::max(peakBytes, arena.used());
+    peakObjects = std::max(peakObjects, arena.objectCount());
+}
+
+static bool byExclusive(const Profiler::Entry &a, const Profiler::Entry &b)
+{
+    return a.exclusive > b.exclusive;
+}
+
+std::vector<Profiler::Entry> Profiler::sortedEntries() const
+{
+    std::vector<Entry> result;
+    for (unsigned int i = 0; i < entries.size(); i++) {
+	if (entries[i].calls)
+	    result.push_back(entries[i]);
+    }
+    std::sort(result.begin(), result.end(), byExclusive);
+    return result;
+}
+
+void Profiler::report(std::ostream &out) const
+{
+    std::vector<Entry> sorted = sortedEntries();
+    qint64 total = 0;
+    for (unsigned int i = 0; i < sorted.size(); i++)
+	total += sorted[i].exclusive;
+
+    out << "Script profile: " << total / 1000000.0 << " ms profiled, "
+	<< timer.elapsed() << " ms in total" << std::endl
+	<< "         calls   inclusive ms   exclusive ms       %  name" << std::endl;
+    std::ios::fmtflags flags = out.flags();
+    std::streamsize precision = out.precision();
+    out << std::fixed << std::setprecision(3);
+    for (unsigned int i = 0; i < sorted.size(); i++) {
+	const Entry &e = sorted[i];
+	out << std::setw(14) << e.calls
+	    << std::setw(15) << e.inclusive / 1000000.0
+	    << std::setw(15) << e.exclusive / 1000000.0
+	    << std::setprecision(1) << std::setw(8)
+	    << 100.0 * e.exclusive / std::max(total, (qint64)1)
+	    << std::setprecision(3) << "  " << symbol(e.name)->value.constData()
+	    << std::endl;
+    }
+    out.flags(flags);
+    out.precision(precision);
+
+    out << "Temporaries: " << allocations << " allocations, " << objects
+	<< " objects with destructors, peak " << peakBytes / 1024 << " KB and "
+	<< peakObjects << " such objects in the arena" << std::endl;
+}
+
+QByteArray Profiler::stack(int node) const
+{
+    QByteArray result;
+    for (; node > 0; node = nodes[node].parent) {
+	QByteArray name = symbol(nodes[node].entry.name)->value;
+	// flamegraph.pl separates the names by semicolons and the count
+	// by the last space
+	name.replace(';', ':').replace(' ', '_');
+	result = result.isEmpty() ? name : name + ";" + result;
+    }
+    return result;
+}
+
+bool Profiler::writeFolded(const QString &fileName) const
+{
+    QFile file(fileName);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Text))
+	return false;
+
+    for (unsigned int i = 1; i < nodes.size(); i++) {
+	if (nodes[i].entry.exclusive > 0)
+	    file.write(stack(i) + " " + QByteArray::number(nodes[i].entry.exclusive)
+		       + "\n");
+    }
+    return file.error() == QFile::NoError;
+}
+
+}
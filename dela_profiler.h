@@ -0,0 +1,128 @@
+/*funray - yet another raytracer
+opyright (C) 2008  Christian Zeller (chrizel@gmail.com) and
+                    Simon Goller (neosam@gmail.com).
+
+This program is free software; you can redistribute it and/or modify 
+it under the terms of the GNU General Public License as published 
+by the Free Software Foundation; either version 3 of the License, 
+or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful, but 
+WITHOUT ANY WARRANTY; without even the implied warranty of 
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License along 
+with this program; if not, see <http://www.gnu.org/licenses/>. */
+
+
+#ifndef DELA_PROFILER_H
+#define DELA_PROFILER_H
+
+#include <QByteArray>
+#include <QElapsedTimer>
+#include <QHash>
+#include <QString>
+
+#include <iostream>
+#include <vector>
+
+namespace dela {
+
+class Arena;
+
+// Opt-in profile of what an Engine evaluates, set with
+// Engine::setProfiler(). Functions, macros, blocks and for loops are
+// timed by the engine under their symbols, parsing, compiling and the
+// reading of properties under the names below.
+// The calls are kept as a tree of call stacks, from which report()
+// sums up the time per name and writeFolded() writes the stacks for
+// flamegraph.pl. A profiler is not shared between threads: engines
+// forked from a profiled one are not profiled themselves.
+class Profiler
+{
+public:
+    // names which are no symbols: (parse), (compile), (properties), for
+    enum { Parse = -1, Compile = -2, Properties = -3, For = -4 };
+
+    struct Entry
+    {
+	int name;
+	quint64 calls;
+	// nanoseconds with and without the calls made from it
+	qint64 inclusive;
+	qint64 exclusive;
+    };
+
+private:
+    // a call stack, node 0 is the root
+    struct Node
+    {
+	Entry entry;
+	int parent;
+	QHash<int, int> children;
+    };
+
+    struct Frame
+    {
+	int node;
+	qint64 start;
+	qint64 children;
+    };
+
+    QElapsedTimer timer;
+    std::vector<Node> nodes;
+    std::vector<Frame> frames;
+    // per symbol; the depth of its calls on the stack, so that the
+    // inclusive time of recursive calls is counted once
+    std::vector<Entry> entries;
+    std::vector<int> depth;
+    // symbols of Parse ... For
+    int names[4];
+
+    quint64 allocations;
+    quint64 objects;
+    size_t peakBytes;
+    int peakObjects;
+
+    QByteArray stack(int node) const;
+
+public:
+    Profiler();
+
+    // name is a symbol or one of Parse ... For
+    void enter(int name);
+    void leave();
+
+    // Counts the temporaries of an arena before it is released
+    void countArena(const Arena &arena);
+
+    // Entries with calls, by exclusive time
+    std::vector<Entry> sortedEntries() const;
+    // Human readable summary, by exclusive time
+    void report(std::ostream &out) const;
+    // One line "name;name;... nanoseconds" per call stack with the
+    // exclusive time of its innermost call, as flamegraph.pl reads it
+    bool writeFolded(const QString &fileName) const;
+};
+
+// Times the scope it lives in as a call of name, if profiler is set
+class ProfileScope
+{
+private:
+    Profiler *profiler;
+
+public:
+    inline ProfileScope(Profiler *profiler, int name) : profiler(profiler) {
+	if (profiler)
+	    profiler->enter(name);
+    };
+    inline ~ProfileScope() {
+	if (profiler)
+	    profiler->leave();
+    };
+};
+
+}
+
+#endif
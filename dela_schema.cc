@@ -0,0 +1,111 @@
+/*funray - yet another raytracer
+opyright (C) 2008  Christian Zeller (chrizel@gmail.com) and
+                    Simon Goller (neosam@gmail.com).
+
+This program is free software; you can redistribute it and/or modify 
+it under the terms of the GNU General Public License as published 
+by the Free Software Foundation; either version 3 of the License, 
+or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful, but 
+WITHOUT ANY WARRANTY; without even the implied warranty of 
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License along 
+with this program; if not, see <http://www.gnu.org/licenses/>. */
+
+
+#include <QByteArray>
+#include <QDebug>
+
+#include <algorithm>
+
+#include "dela.h"
+#include "dela_profiler.h"
+#include "dela_schema.h"
+
+namespace dela {
+
+void SchemaBase::add(const char *name, int count, bool required, size_t offset)
+{
+    if (properties.size() == maxProperties) {
+	qDebug() << "dela::Schema error: Too many properties for" << macro;
+	exit(1);
+    }
+
+    Property p = { intern(name), count, required, offset };
+    properties.push_back(p);
+}
+
+// Appends v, a number or a list of numbers and such lists
+static void appendNumbers(const Value &v, std::vector<float> &numbers)
+{
+    if (List *list = asType<List>(v)) {
+	numbers.reserve(numbers.size() + list->size());
+	for (List::iterator it = list->begin(); it != list->end(); it++)
+	    appendNumbers(*it, numbers);
+    } else {
+	numbers.push_back(ensureNumber(v));
+    }
+}
+
+void SchemaBase::bind(Engine *e, List *params, char *out) const
+{
+    ProfileScope scope(e->getProfiler(), Profiler::Properties);
+    int n = properties.size();
+    // items read of each property so far
+    int done[maxProperties];
+    for (int i = 0; i < n; i++)
+	done[i] = 0;
+
+    for (List::iterator it = params->begin(); it != params->end(); it++) {
+	List *list = ensureType<List>(*it);
+	if (list->size() < 2)
+	    continue;
+
+	int name = ensureType<String>(list->at(0))->symbol;
+	int i = 0;
+	while (i < n && properties[i].symbol != name)
+	    i++;
+	if (i == n)
+	    continue;
+
+	const Property &p = properties[i];
+	if (p.count == allItems) {
+	    std::vector<float> &numbers = *(std::vector<float> *)(out + p.offset);
+	    for (int j = 1; j < list->size() && !done[i]; j++) {
+		Value v = list->at(j);
+		appendNumbers(v.isNumber() ? v : e->eval(v), numbers);
+	    }
+	    done[i] = 1;
+	    continue;
+	}
+
+	int last = std::min(p.count ? p.count : 1, list->size() - 1);
+	for (int j = done[i]; j < last; j++) {
+	    Value v = list->at(j + 1);
+	    if (!v.isNumber())
+		v = e->eval(v);
+	    if (!p.count)
+		*(Value *)(out + p.offset) = v;
+	    else if (v.isNumber())
+		((float *)(out + p.offset))[j] = v.toNumber();
+	    else if (p.required)
+		ensureNumber(v);
+	}
+	if (last > done[i])
+	    done[i] = last;
+    }
+
+    for (int i = 0; i < n; i++) {
+	const Property &p = properties[i];
+	if (p.required && done[i] < p.count) {
+	    qDebug() << "dela::Schema error:" << macro << "needs" << p.count
+		     << "numbers in" << symbol(p.symbol)->value;
+	    exit(1);
+	}
+    }
+}
+
+}
@@ -0,0 +1,109 @@
+/*funray - yet another raytracer
+opyright (C) 2008  Christian Zeller (chrizel@gmail.com) and
+                    Simon Goller (neosam@gmail.com).
+
+This program is free software; you can redistribute it and/or modify 
+it under the terms of the GNU General Public License as published 
+by the Free Software Foundation; either version 3 of the License, 
+or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful, but 
+WITHOUT ANY WARRANTY; without even the implied warranty of 
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License along 
+with this program; if not, see <http://www.gnu.org/licenses/>. */
+
+
+#ifndef DELA_SCHEMA_H
+#define DELA_SCHEMA_H
+
+#include <QByteArray>
+
+#include <vector>
+
+#include "dela.h"
+
+namespace dela {
+
+// The properties (name item ...) a macro accepts, declared once. bind()
+// goes over the parameter lists once and evaluates every item it uses
+// once, unlike a readProperty() call per item. Like readProperty(),
+// item i is taken from the first list with that many items, and other
+// names are ignored.
+class SchemaBase
+{
+protected:
+    enum { maxProperties = 16 };
+
+    struct Property {
+	int symbol;
+	// numbers stored at offset, 0 for one value of any type or
+	// numbers for all items
+	int count;
+	bool required;
+	size_t offset;
+    };
+
+    QByteArray macro;
+    std::vector<Property> properties;
+
+    enum { allItems = -1 };
+
+    SchemaBase(const QByteArray &macro) : macro(macro) {};
+
+    void add(const char *name, int count, bool required, size_t offset);
+    void bind(Engine *e, List *params, char *out) const;
+};
+
+// Binds the properties to the fields of a struct T, whose default
+// constructor sets the defaults:
+// static const Schema<SphereProps> schema = Schema<SphereProps>("sphere")
+//     .numbers("position", &SphereProps::position, true)
+//     .numbers("radius", &SphereProps::radius);
+template <class T>
+class Schema : public SchemaBase
+{
+private:
+    template <class F>
+    static size_t offset(F T::*field) {
+	T t;
+	return (char *)&(t.*field) - (char *)&t;
+    };
+
+public:
+    Schema(const QByteArray &macro) : SchemaBase(macro) {};
+
+    // (name x ...) sets field, a float or a struct of floats like vec,
+    // one item per float. Items which are no numbers keep the default,
+    // required numbers must all be given.
+    template <class F>
+    Schema &numbers(const char *name, F T::*field, bool required = false) {
+	add(name, sizeof(F) / sizeof(float), required, offset(field));
+	return *this;
+    };
+
+    // (name x) sets field to x
+    Schema &value(const char *name, Value T::*field) {
+	add(name, 0, false, offset(field));
+	return *this;
+    };
+
+    // (name x ...) appends all items of the first such list to field,
+    // the numbers of items which are lists as well
+    Schema &numberList(const char *name, std::vector<float> T::*field) {
+	add(name, allItems, false, offset(field));
+	return *this;
+    };
+
+    T bind(Engine *e, List *params) const {
+	T t;
+	SchemaBase::bind(e, params, (char *)&t);
+	return t;
+    };
+};
+
+}
+
+#endif
@@ -0,0 +1,454 @@
+/*funray - yet another raytracer
+opyright (C) 2008  Christian Zeller (chrizel@gmail.com) and
+                    Simon Goller (neosam@gmail.com).
+
+This program is free software; you can redistribute it and/or modify 
+it under the terms of the GNU General Public License as published 
+by the Free Software Foundation; either version 3 of the License, 
+or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful, but 
+WITHOUT ANY WARRANTY; without even the implied warranty of 
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License along 
+with this program; if not, see <http://www.gnu.org/licenses/>. */
+
+#include <QByteArray>
+#include <QDebug>
+
+#include <cmath>
+
+#include "dela.h"
+#include "dela_profiler.h"
+#include "dela_vm.h"
+
+namespace dela {
+
+Code::~Code()
+{
+    for (unsigned int i = 0; i < calls.size(); i++)
+	delete calls[i].params;
+}
+
+int Compiler::allocate()
+{
+    if (top == Code::maxRegisters) {
+	qDebug() << "dela::Compiler error: Expression nested too deeply";
+	exit(1);
+    }
+    return top++;
+}
+
+int Compiler::emit(int op, int a, int b, int c)
+{
+    Instruction i = { op, a, b, c };
+    code->instructions.push_back(i);
+    return code->instructions.size() - 1;
+}
+
+int Compiler::number(float value)
+{
+    code->numbers.push_back(value);
+    return code->numbers.size() - 1;
+}
+
+int Compiler::value(const Value &v)
+{
+    code->values.push_back(v);
+    return code->values.size() - 1;
+}
+
+// Errors are reported when the code runs, like the interpreter did
+void Compiler::fail(const QByteArray &message)
+{
+    code->messages.push_back(message);
+    emit(Fail, code->messages.size() - 1);
+}
+
+static float apply(int op, float x, float y)
+{
+    if (op == Add)
+	return x + y;
+    else if (op == Subtract)
+	return x - y;
+    else if (op == Multiply)
+	return x * y;
+    else
+	return x / y;
+}
+
+// Whether list calls an arithmetic instruction with a number of
+// parameters it handles, the builtin functions report the others
+bool Compiler::arithmetic(List *list, int &op)
+{
+    String *name = list->isEmpty() ? 0 : asType<String>(list->at(0));
+    if (!name)
+	return false;
+
+    op = engine->instructions.value(name->value, -1);
+    int count = list->size() - 1;
+    if (op == Add)
+	return true;
+    else if (op == Subtract || op == Multiply || op == Divide)
+	return count > 0;
+    else if (op == Sin || op == Cos)
+	return count == 1;
+    return false;
+}
+
+// Value of number literals and of arithmetic on them
+bool Compiler::constant(const Value &v, float &number)
+{
+    if (v.isNumber()) {
+	number = v.toNumber();
+	return true;
+    }
+
+    List *list = asType<List>(v);
+    int op;
+    if (!list || !arithmetic(list, op))
+	return false;
+
+    if (list->size() == 1) {
+	number = 0;
+	return true;
+    }
+    if (!constant(list->at(1), number))
+	return false;
+    if (list->size() == 2) {
+	if (op == Subtract)
+	    number = -number;
+	else if (op == Sin)
+	    number = sin(number);
+	else if (op == Cos)
+	    number = cos(number);
+	return true;
+    }
+
+    for (int i = 2; i < list->size(); i++) {
+	float x;
+	if (!constant(list->at(i), x))
+	    return false;
+	number = apply(op, number, x);
+    }
+    return true;
+}
+
+void Compiler::compileNumber(const Value &v, int target)
+{
+    float number;
+    if (constant(v, number)) {
+	emit(LoadNumber, target, this->number(number));
+	return;
+    }
+
+    List *list = asType<List>(v);
+    int op;
+    if (list && arithmetic(list, op)) {
+	compileNumber(list->at(1), target);
+	if (list->size() == 2) {
+	    if (op == Subtract)
+		emit(Negate, target, target);
+	    else if (op == Sin || op == Cos)
+		emit(op, target, target);
+	    return;
+	}
+
+	int mark = top;
+	int x = allocate();
+	for (int i = 2; i < list->size(); i++) {
+	    compileNumber(list->at(i), x);
+	    emit(op, target, target, x);
+	}
+	top = mark;
+	return;
+    }
+
+    compileValue(v, target);
+    emit(Unbox, target, target);
+}
+
+void Compiler::compileValue(const Value &v, int target)
+{
+    List *list = asType<List>(v);
+    if (!list) {
+	String *string = asType<String>(v);
+	if (string && string->variable >= 0) {
+	    code->messages.push_back("dela::Engine::eval error: Variable not defined:  \""
+				     + string->value + "\"");
+	    emit(LoadVariable, target, string->variable, code->messages.size() - 1);
+	} else {
+	    emit(LoadValue, target, value(v));
+	}
+	return;
+    }
+
+    if (list->isEmpty()) {
+	emit(LoadValue, target, value(Value()));
+	return;
+    }
+
+    Value head = list->at(0);
+    if (isType<List>(head)) {
+	compileValue(head, target);
+	return;
+    }
+    String *name = asType<String>(head);
+    if (!name) {
+	fail("dela::Engine::eval error: No string at beginning of list");
+	return;
+    }
+
+    int op;
+    if (arithmetic(list, op)) {
+	compileNumber(list, target);
+	emit(Box, target, target);
+	return;
+    }
+
+    // names of strings made at runtime are not interned yet
+    int symbol = name->symbol >= 0 ? name->symbol : intern(name->value);
+    op = engine->instructions.value(name->value, -1);
+    if (op == SetVariable) {
+	compileSet(list, target);
+    } else if (op == ForBegin) {
+	compileFor(list, target);
+    } else if (engine->macros.contains(name->value) || engine->blocks.contains(name->value)) {
+	// Call macro with unevaluated parameters...
+	CodeCall call = { engine->macros.value(name->value), list->size() - 1, new List,
+			  engine->blocks.value(name->value), symbol };
+	for (List::iterator it = list->begin() + 1; it != list->end(); it++)
+	    call.params->append(*it);
+	code->calls.push_back(call);
+	emit(call.function ? CallMacro : CallBlock, target, code->calls.size() - 1);
+	emit(Evaluate, target);
+    } else if (engine->functions.contains(name->value)) {
+	// parameters go to consecutive registers
+	int mark = top;
+	int first = top;
+	for (List::iterator it = list->begin() + 1; it != list->end(); it++)
+	    compileValue(*it, allocate());
+	top = mark;
+
+	CodeCall call = { engine->functions.value(name->value), list->size() - 1, 0,
+			  Block(), symbol };
+	code->calls.push_back(call);
+	emit(Call, target, code->calls.size() - 1, first);
+    } else {
+	fail("dela::Engine::eval error: Unknown function:  \"" + name->value + "\"");
+    }
+}
+
+// (set name value ...), names which are no variable references are
+// resolved now
+void Compiler::compileSet(List *list, int target)
+{
+    int count = list->size() - 1;
+    if (count == 0 || (count % 2 == 1)) {
+	fail("dela::builtins::set error: set parameter count zero or not even");
+	return;
+    }
+
+    for (int i = 1; i < list->size(); i += 2) {
+	String *name = asType<String>(list->at(i));
+	if (name && name->variable < 0) {
+	    compileValue(list->at(i + 1), target);
+	    emit(SetVariable, name->symbol, target);
+	} else {
+	    int mark = top;
+	    int r = allocate();
+	    compileValue(list->at(i), r);
+	    compileValue(list->at(i + 1), target);
+	    emit(SetNamedVariable, r, target);
+	    top = mark;
+	}
+    }
+
+    // set is a macro, its result is evaluated once more
+    emit(Evaluate, target);
+}
+
+// (for (name from to [step]) body ...) keeps the counter, to and step
+// in the numbers of registers loop .. loop + 2. The variable is symbol
+// b of ForBegin a b c and ForNext a b c, or the symbol of the name in
+// the value of loop + 3 if b is -1. ForBegin sets it to the counter and
+// jumps to c if the loop is empty, ForNext steps it and jumps back to
+// the body at c. With a profiler, the loop is put between Enter and
+// Leave.
+void Compiler::compileFor(List *list, int target)
+{
+    if (list->size() < 2) {
+	fail("dela::builtins:for error: for-loop is empty :-(");
+	return;
+    }
+    List *params = asType<List>(list->at(1));
+    if (!params) {
+	fail("dela::ensureType: Wrong type error");
+	return;
+    } else if (params->size() < 3) {
+	fail("dela::builtins:for error: for-loop parameters are wrong, give me 3");
+	return;
+    }
+
+    if (engine->profiler)
+	emit(Enter, Profiler::For);
+    int mark = top;
+    int loop = allocate();
+    allocate();
+    allocate();
+    allocate();
+
+    int variable = -1;
+    String *name = asType<String>(params->at(0));
+    if (name && name->variable < 0)
+	variable = name->symbol;
+    else
+	compileValue(params->at(0), loop + 3);
+    compileNumber(params->at(1), loop);
+    compileNumber(params->at(2), loop + 1);
+    if (params->size() > 3)
+	compileNumber(params->at(3), loop + 2);
+    else
+	emit(LoadNumber, loop + 2, number(1.0));
+
+    emit(LoadValue, target, value(Value()));
+    int begin = emit(ForBegin, loop, variable);
+    for (List::iterator it = list->begin() + 2; it != list->end(); it++)
+	compileValue(*it, target);
+    emit(ForNext, loop, variable, begin + 1);
+    code->instructions[begin].c = code->instructions.size();
+    top = mark;
+    if (engine->profiler)
+	emit(Leave, 0);
+
+    // for is a macro, its result is evaluated once more
+    emit(Evaluate, target);
+}
+
+Code *Compiler::compile(List *list)
+{
+    code = new Code;
+    top = 1;
+    compileValue(list, 0);
+    return code;
+}
+
+Value Engine::run(const Code *code)
+{
+    Register r[Code::maxRegisters];
+    const Instruction *instructions = &code->instructions[0];
+    int count = code->instructions.size();
+
+    for (int pc = 0; pc < count; pc++) {
+	const Instruction &i = instructions[pc];
+	switch (i.op) {
+	case LoadNumber:
+	    r[i.a].number = code->numbers[i.b];
+	    break;
+	case LoadValue:
+	    r[i.a].value = code->values[i.b];
+	    break;
+	case LoadVariable: {
+	    const Variable &v = variable(i.b);
+	    if (!v.defined) {
+		qDebug() << code->messages[i.c].constData();
+		exit(1);
+	    }
+	    r[i.a].value = v.value;
+	    break;
+	}
+	case Unbox:
+	    r[i.a].number = ensureNumber(r[i.b].value);
+	    break;
+	case Box:
+	    r[i.a].value = Value::fromNumber(r[i.b].number);
+	    break;
+	case Add:
+	    r[i.a].number = r[i.b].number + r[i.c].number;
+	    break;
+	case Subtract:
+	    r[i.a].number = r[i.b].number - r[i.c].number;
+	    break;
+	case Multiply:
+	    r[i.a].number = r[i.b].number * r[i.c].number;
+	    break;
+	case Divide:
+	    r[i.a].number = r[i.b].number / r[i.c].number;
+	    break;
+	case Negate:
+	    r[i.a].number = -r[i.b].number;
+	    break;
+	case Sin:
+	    r[i.a].number = sin(r[i.b].number);
+	    break;
+	case Cos:
+	    r[i.a].number = cos(r[i.b].number);
+	    break;
+	case Call: {
+	    const CodeCall &call = code->calls[i.b];
+	    ProfileScope scope(profiler, call.name);
+	    List *params = newList();
+	    for (int j = 0; j < call.count; j++)
+		params->append(r[i.c + j].value);
+	    r[i.a].value = call.function(this, params);
+	    break;
+	}
+	case CallMacro: {
+	    const CodeCall &call = code->calls[i.b];
+	    ProfileScope scope(profiler, call.name);
+	    r[i.a].value = call.function(this, call.params);
+	    break;
+	}
+	case CallBlock: {
+	    const CodeCall &call = code->calls[i.b];
+	    ProfileScope scope(profiler, call.name);
+	    call.block.begin(this);
+	    for (List::iterator it = call.params->begin(); it != call.params->end(); it++)
+		eval(*it);
+	    r[i.a].value = call.block.end(this);
+	    break;
+	}
+	case SetVariable:
+	    setVariable(i.a, r[i.b].value);
+	    break;
+	case SetNamedVariable:
+	    setVariable(ensureType<String>(r[i.a].value)->value, r[i.b].value);
+	    break;
+	case Evaluate:
+	    r[i.a].value = eval(r[i.a].value);
+	    break;
+	case ForBegin: {
+	    int symbol = i.b >= 0 ? i.b : intern(ensureType<String>(r[i.a + 3].value)->value);
+	    setVariable(symbol, Value::fromNumber(r[i.a].number));
+	    if (!(r[i.a].number <= r[i.a + 1].number))
+		pc = i.c - 1;
+	    break;
+	}
+	case ForNext: {
+	    int symbol = i.b >= 0 ? i.b : intern(ensureType<String>(r[i.a + 3].value)->value);
+	    r[i.a].number += r[i.a + 2].number;
+	    setVariable(symbol, Value::fromNumber(r[i.a].number));
+	    if (r[i.a].number <= r[i.a + 1].number)
+		pc = i.c - 1;
+	    break;
+	}
+	case Enter:
+	    if (profiler)
+		profiler->enter(i.a);
+	    break;
+	case Leave:
+	    if (profiler)
+		profiler->leave();
+	    break;
+	case Fail:
+	    qDebug() << code->messages[i.a].constData();
+	    exit(1);
+	}
+    }
+
+    return r[0].value;
+}
+
+}
@@ -0,0 +1,133 @@
+/*funray - yet another raytracer
+opyright (C) 2008  Christian Zeller (chrizel@gmail.com) and
+                    Simon Goller (neosam@gmail.com).
+
+This program is free software; you can redistribute it and/or modify 
+it under the terms of the GNU General Public License as published 
+by the Free Software Foundation; either version 3 of the License, 
+or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful, but 
+WITHOUT ANY WARRANTY; without even the implied warranty of 
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License along 
+with this program; if not, see <http://www.gnu.org/licenses/>. */
+
+#ifndef DELA_VM_H
+#define DELA_VM_H
+
+#include <QByteArray>
+
+#include <vector>
+
+#include "dela.h"
+
+namespace dela {
+
+// Instructions of compiled code. Every register holds a number for
+// arithmetic and a value for everything else; a, b and c are register
+// numbers, indexes into the tables of Code, symbols or jump targets.
+enum Op {
+    LoadNumber,		// number a = numbers[b]
+    LoadValue,		// value a = values[b]
+    LoadVariable,	// value a = variable b, messages[c] if it is not set
+    Unbox,		// number a = value b, which must be a number
+    Box,		// value a = number b
+    Add,		// number a = number b + number c
+    Subtract,		// number a = number b - number c
+    Multiply,		// number a = number b * number c
+    Divide,		// number a = number b / number c
+    Negate,		// number a = -number b
+    Sin,		// number a = sin(number b)
+    Cos,		// number a = cos(number b)
+    Call,		// value a = calls[b] with the values c ... as parameters
+    CallMacro,		// value a = calls[b] with its unevaluated parameters
+    CallBlock,		// value a = block of calls[b] over its parameters
+    SetVariable,	// variable a = value b
+    SetNamedVariable,	// variable named by value a = value b
+    Evaluate,		// value a = eval(value a), used for results of macros
+    ForBegin,		// for loop over registers a .. a + 2, see Compiler::compileFor
+    ForNext,
+    Enter,		// profiler enters a, see Engine::setProfiler
+    Leave,		// profiler leaves the last entered
+    Fail		// print messages[a] and exit
+};
+
+struct Instruction
+{
+    int op;
+    int a;
+    int b;
+    int c;
+};
+
+struct Register
+{
+    float number;
+    Value value;
+};
+
+// A function, macro or block called by compiled code. Macros and
+// blocks get the same list of unevaluated parameters on every call.
+struct CodeCall
+{
+    Function function;
+    int count;
+    List *params;
+    Block block;
+    // symbol of the name, for the profiler
+    int name;
+};
+
+// Compiled form of one list, attached to the list by Engine::eval and
+// run instead of walking the list again. Results are left in register 0.
+class Code
+{
+public:
+    enum { maxRegisters = 256 };
+
+    std::vector<Instruction> instructions;
+    std::vector<float> numbers;
+    std::vector<Value> values;
+    std::vector<CodeCall> calls;
+    std::vector<QByteArray> messages;
+
+    ~Code();
+};
+
+// Turns parsed code into Code. Variable names are resolved to slots of
+// the engine, functions and macros to their pointers and arithmetic
+// on constants is folded. Macro parameters are left alone, macros
+// evaluate them when and if they want to.
+class Compiler
+{
+private:
+    Engine *engine;
+    Code *code;
+    int top;
+
+    int allocate();
+    int emit(int op, int a, int b = 0, int c = 0);
+    int number(float value);
+    int value(const Value &v);
+    void fail(const QByteArray &message);
+
+    bool constant(const Value &v, float &number);
+    bool arithmetic(List *list, int &op);
+
+    void compileNumber(const Value &v, int target);
+    void compileValue(const Value &v, int target);
+    void compileSet(List *list, int target);
+    void compileFor(List *list, int target);
+
+public:
+    Compiler(Engine *engine) : engine(engine), code(0), top(0) {};
+
+    Code *compile(List *list);
+};
+
+}
+
+#endif
@@ -0,0 +1,224 @@
+/*funray - yet another raytracer
+Copyright (C) 2008  Christian Zeller (chrizel@gmail.com) and
+		    Simon Goller (neosam@gmail.com).
+
+This program is free software; you can redistribute it and/or modify 
+it under the terms of the GNU General Public License as published 
+by the Free Software Foundation; either version 3 of the License, 
+or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful, but 
+WITHOUT ANY WARRANTY; without even the implied warranty of 
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License along 
+with this program; if not, see <http://www.gnu.org/licenses/>. */
+
+#include <QTime>
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include "grid.h"
+#include "vector.h"
+
+// Cells per object
+static const float density = 2.0;
+
+// Grid::suits: fewest objects, below them a BVH is built quickly and
+// traverses faster; largest ratio between the biggest and the average
+// box; smallest fraction of cells holding a box center
+static const unsigned int minCount = 10000;
+static const float maxSizeRatio = 4.0;
+static const float minOccupancy = 0.2;
+
+// Objects overlapping a cell border by less than this fraction of a
+// cell are still put into the cell behind it, so that rounding in the
+// walk never misses them
+static const float cellMargin = 1e-3;
+
+static inline float axisOf(const vec &v, int axis)
+{
+    return axis == 0 ? v.x : (axis == 1 ? v.y : v.z);
+}
+
+static BBox boundsOf(const std::vector<BBox> &boxes)
+{
+    BBox bounds;
+    for (unsigned int i = 0; i < boxes.size(); i++)
+	bounds.extend(boxes[i]);
+    return bounds;
+}
+
+// About density * count cubic cells over bounds
+void Grid::resolution(const BBox &bounds, int count, int *size)
+{
+    vec extent = bounds.max - bounds.min;
+    float largest = std::max(extent.x, std::max(extent.y, extent.z));
+    float volume = 1;
+    for (int a = 0; a < 3; a++)
+	volume *= std::max(axisOf(extent, a), largest * 1e-3f);
+
+    float perUnit = cbrtf(density * count / volume);
+    for (int a = 0; a < 3; a++) {
+	int n = (int)(axisOf(extent, a) * perUnit + 0.5f);
+	size[a] = std::min(std::max(n, 1), (int)maxResolution);
+    }
+}
+
+inline int Grid::cellOf(float p, int axis) const
+{
+    // clamped before the conversion, which is undefined out of range
+    float c = floorf((p - axisOf(box.min, axis)) / cellSize[axis]);
+    return (int)std::min((float)(size[axis] - 1), std::max(0.0f, c));
+}
+
+void Grid::clear()
+{
+    size[0] = size[1] = size[2] = 0;
+    std::vector<int>().swap(cells);
+    std::vector<GridRun>().swap(runs);
+    std::vector<int>().swap(items);
+}
+
+void Grid::build(const std::vector<BBox> &boxes)
+{
+    QTime t;
+    t.start();
+
+    clear();
+    if (boxes.empty()) {
+	buildTime = t.elapsed();
+	return;
+    }
+
+    box = boundsOf(boxes);
+    resolution(box, boxes.size(), size);
+    // a flat axis has a single cell, whose size does not matter
+    for (int a = 0; a < 3; a++) {
+	float extent = axisOf(box.max - box.min, a);
+	if (extent > 0) {
+	    cellSize[a] = extent / size[a];
+	} else {
+	    size[a] = 1;
+	    cellSize[a] = 1;
+	}
+    }
+    const int cellTotal = cellCount();
+
+    // counting sort of the objects by the cell of their center
+    std::vector<int> centerCell(boxes.size());
+    std::vector<int> start(cellTotal + 1, 0);
+    for (unsigned int i = 0; i < boxes.size(); i++) {
+	vec c = boxes[i].center();
+	centerCell[i] = cellOf(c.x, 0) + size[0] * (cellOf(c.y, 1) + size[1] * cellOf(c.z, 2));
+	start[centerCell[i] + 1]++;
+    }
+    for (int c = 0; c < cellTotal; c++)
+	start[c + 1] += start[c];
+    items.resize(boxes.size());
+    for (unsigned int i = 0; i < boxes.size(); i++)
+	items[start[centerCell[i]]++] = i;
+
+    // references from the cells to the objects overlapping them, in
+    // increasing order as the objects are visited in the new order
+    std::vector<int> refStart(cellTotal + 1, 0);
+    int lo[3], hi[3];
+    for (unsigned int k = 0; k < boxes.size(); k++) {
+	cellRange(boxes[items[k]], lo, hi);
+	for (int z = lo[2]; z <= hi[2]; z++)
+	    for (int y = lo[1]; y <= hi[1]; y++)
+		for (int x = lo[0]; x <= hi[0]; x++)
+		    refStart[x + size[0] * (y + size[1] * z) + 1]++;
+    }
+    for (int c = 0; c < cellTotal; c++)
+	refStart[c + 1] += refStart[c];
+
+    std::vector<int> refs(refStart[cellTotal]);
+    std::vector<int> fill(refStart.begin(), refStart.end() - 1);
+    for (unsigned int k = 0; k < boxes.size(); k++) {
+	cellRange(boxes[items[k]], lo, hi);
+	for (int z = lo[2]; z <= hi[2]; z++)
+	    for (int y = lo[1]; y <= hi[1]; y++)
+		for (int x = lo[0]; x <= hi[0]; x++)
+		    refs[fill[x + size[0] * (y + size[1] * z)]++] = k;
+    }
+
+    // consecutive references become one run
+    cells.resize(cellTotal + 1);
+    for (int c = 0; c < cellTotal; c++) {
+	cells[c] = runs.size();
+	for (int r = refStart[c]; r < refStart[c + 1]; r++) {
+	    if (r > refStart[c] && refs[r] == runs.back().end) {
+		runs.back().end++;
+	    } else {
+		GridRun run = { refs[r], refs[r] + 1 };
+		runs.push_back(run);
+	    }
+	}
+    }
+    cells[cellTotal] = runs.size();
+
+    buildTime = t.elapsed();
+}
+
+// Cells overlapped by b, from lo to hi including
+void Grid::cellRange(const BBox &b, int *lo, int *hi) const
+{
+    for (int a = 0; a < 3; a++) {
+	float margin = cellSize[a] * cellMargin;
+	lo[a] = cellOf(axisOf(b.min, a) - margin, a);
+	hi[a] = cellOf(axisOf(b.max, a) + margin, a);
+    }
+}
+
+bool Grid::suits(const std::vector<BBox> &boxes)
+{
+    if (boxes.size() < minCount)
+	return false;
+
+    BBox bounds = boundsOf(boxes);
+    float average = 0, largest = 0;
+    for (unsigned int i = 0; i < boxes.size(); i++) {
+	vec d = boxes[i].max - boxes[i].min;
+	float extent = std::max(d.x, std::max(d.y, d.z));
+	average += extent;
+	largest = std::max(largest, extent);
+    }
+    average /= boxes.size();
+    if (largest > maxSizeRatio * average)
+	return false;
+
+    // fraction of the cells of a grid built for them which hold a
+    // center: high for arrays, low for clustered or hollow scenes
+    int size[3];
+    resolution(bounds, boxes.size(), size);
+    const int total = size[0] * size[1] * size[2];
+    vec extent = bounds.max - bounds.min;
+    std::vector<bool> used(total, false);
+    int occupied = 0;
+    for (unsigned int i = 0; i < boxes.size(); i++) {
+	vec c = boxes[i].center();
+	int cell = 0;
+	for (int a = 2; a >= 0; a--) {
+	    float f = axisOf(extent, a) > 0
+		? (axisOf(c, a) - axisOf(bounds.min, a)) / axisOf(extent, a) : 0;
+	    int x = std::min(std::max((int)(f * size[a]), 0), size[a] - 1);
+	    cell = cell * size[a] + x;
+	}
+	if (!used[cell]) {
+	    used[cell] = true;
+	    occupied++;
+	}
+    }
+
+    return occupied >= minOccupancy * total;
+}
+
+unsigned long Grid::memoryUsage() const
+{
+    return cells.capacity() * sizeof(int) + runs.capacity() * sizeof(GridRun)
+	+ items.capacity() * sizeof(int);
+}
@@ -0,0 +1,236 @@
+/*funray - yet another raytracer
+Copyright (C) 2008  Christian Zeller (chrizel@gmail.com) and
+		    Simon Goller (neosam@gmail.com).
+
+This program is free software; you can redistribute it and/or modify 
+it under the terms of the GNU General Public License as published 
+by the Free Software Foundation; either version 3 of the License, 
+or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful, but 
+WITHOUT ANY WARRANTY; without even the implied warranty of 
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License along 
+with this program; if not, see <http://www.gnu.org/licenses/>. */
+
+#ifndef GRID_H
+#define GRID_H
+
+#include <cmath>
+#include <vector>
+
+#include "packet.h"
+#include "vector.h"
+
+// Consecutive objects [begin, end) overlapping a grid cell
+struct GridRun
+{
+    int begin;
+    int end;
+};
+
+// Uniform grid over boxes. Like BVH it only knows about boxes; after
+// build() the caller stores its objects in the order given by items.
+// The objects are sorted by the cell of their center, so the objects
+// overlapping a cell mostly are a few runs of consecutive ones.
+class Grid
+{
+public:
+    enum { maxResolution = 1024 };
+
+    // cells per axis
+    int size[3];
+    BBox box;
+    float cellSize[3];
+
+    // the runs of cell i are runs[cells[i]] to runs[cells[i + 1]],
+    // cell (x, y, z) is i = x + size[0] * (y + size[1] * z)
+    std::vector<int> cells;
+    std::vector<GridRun> runs;
+    std::vector<int> items;
+
+    // milliseconds spent in the last build()
+    int buildTime;
+
+    Grid() : buildTime(0) {
+	size[0] = size[1] = size[2] = 0;
+    };
+
+    void build(const std::vector<BBox> &boxes);
+
+    void clear();
+
+    // True for many boxes of about the same size which fill their
+    // bounds evenly, like large versions of the regular sphere arrays
+    // of scene1.lisp. For them the grid builds and traverses faster
+    // than a BVH.
+    static bool suits(const std::vector<BBox> &boxes);
+
+    // bytes used by cells, runs and items
+    unsigned long memoryUsage() const;
+
+    inline bool isEmpty() const {
+	return cells.empty();
+    };
+
+    inline int cellCount() const {
+	return size[0] * size[1] * size[2];
+    };
+
+    // Same interface as BVH. The packet versions walk the cells of
+    // each ray alone, the leaf is switched to that ray by
+    // leaf.setRay(ray, skip) and back to the packet by leaf.setRay().
+    template <class Leaf>
+    void intersect(const Ray &ray, float &tmax, Leaf &leaf) const;
+    template <class Leaf>
+    bool occluded(const Ray &ray, float tmax, Leaf &leaf) const;
+    template <class Leaf>
+    void intersect(RayPacket &packet, Leaf &leaf) const;
+    template <class Leaf>
+    void occluded(RayPacket &packet, Leaf &leaf) const;
+
+private:
+    static void resolution(const BBox &bounds, int count, int *size);
+    int cellOf(float p, int axis) const;
+    void cellRange(const BBox &b, int *lo, int *hi) const;
+};
+
+// 3D-DDA: steps through the cells a ray passes, in order
+class GridWalk
+{
+private:
+    int pos[3];
+    int step[3];
+    int stride[3];
+    int end[3];
+    float next[3];
+    float delta[3];
+
+public:
+    int cell;
+
+    // Enters the grid, false if the ray misses it before tmax
+    inline bool start(const Grid &grid, const Ray &ray, float tmax) {
+	const vec inv = safeInverse(ray.dir);
+	float tnear;
+	if (grid.isEmpty() || !grid.box.intersect(ray, inv, tmax, tnear))
+	    return false;
+
+	const float o[3] = { ray.pos.x, ray.pos.y, ray.pos.z };
+	const float d[3] = { ray.dir.x, ray.dir.y, ray.dir.z };
+	const float i[3] = { inv.x, inv.y, inv.z };
+	const float min[3] = { grid.box.min.x, grid.box.min.y, grid.box.min.z };
+
+	cell = 0;
+	for (int a = 0, s = 1; a < 3; s *= grid.size[a], a++) {
+	    float p = (o[a] + d[a] * tnear - min[a]) / grid.cellSize[a];
+	    pos[a] = (int)std::min((float)(grid.size[a] - 1), std::max(0.0f, p));
+	    stride[a] = s;
+	    cell += pos[a] * s;
+
+	    if (d[a] > 0) {
+		step[a] = 1;
+		end[a] = grid.size[a];
+		next[a] = (min[a] + (pos[a] + 1) * grid.cellSize[a] - o[a]) * i[a];
+		delta[a] = grid.cellSize[a] * i[a];
+	    } else if (d[a] < 0) {
+		step[a] = -1;
+		end[a] = -1;
+		next[a] = (min[a] + pos[a] * grid.cellSize[a] - o[a]) * i[a];
+		delta[a] = -grid.cellSize[a] * i[a];
+	    } else {
+		step[a] = 0;
+		end[a] = -1;
+		next[a] = HUGE_VALF;
+		delta[a] = 0;
+	    }
+	}
+	return true;
+    };
+
+    // Distance at which the ray leaves the current cell
+    inline float exit() const {
+	return std::min(next[0], std::min(next[1], next[2]));
+    };
+
+    // Moves to the next cell, false if there is none before tmax
+    inline bool advance(float tmax) {
+	int a = next[0] < next[1] ? (next[0] < next[2] ? 0 : 2)
+	    : (next[1] < next[2] ? 1 : 2);
+	if (next[a] >= tmax)
+	    return false;
+	pos[a] += step[a];
+	if (pos[a] == end[a])
+	    return false;
+	cell += step[a] * stride[a];
+	next[a] += delta[a];
+	return true;
+    };
+};
+
+template <class Leaf>
+void Grid::intersect(const Ray &ray, float &tmax, Leaf &leaf) const
+{
+    GridWalk walk;
+    if (!walk.start(*this, ray, tmax))
+	return;
+
+    do {
+	for (int r = cells[walk.cell]; r < cells[walk.cell + 1]; r++)
+	    leaf.intersect(runs[r].begin, runs[r].end, tmax);
+
+	// a hit inside this cell is closer than anything behind it
+	if (tmax <= walk.exit())
+	    return;
+    } while (walk.advance(tmax));
+}
+
+template <class Leaf>
+bool Grid::occluded(const Ray &ray, float tmax, Leaf &leaf) const
+{
+    GridWalk walk;
+    if (!walk.start(*this, ray, tmax))
+	return false;
+
+    do {
+	for (int r = cells[walk.cell]; r < cells[walk.cell + 1]; r++) {
+	    if (leaf.occluded(runs[r].begin, runs[r].end, tmax))
+		return true;
+	}
+    } while (walk.advance(tmax));
+
+    return false;
+}
+
+template <class Leaf>
+void Grid::intersect(RayPacket &packet, Leaf &leaf) const
+{
+    for (int i = 0; i < packet.count; i++) {
+	const Ray ray = packet.ray(i);
+	leaf.setRay(ray, -1);
+	intersect(ray, packet.tmax[i], leaf);
+	if (leaf.hit >= 0)
+	    packet.hit[i] = leaf.hit;
+    }
+    leaf.setRay();
+}
+
+template <class Leaf>
+void Grid::occluded(RayPacket &packet, Leaf &leaf) const
+{
+    for (int i = 0; i < packet.count; i++) {
+	if (packet.tmax[i] < 0)
+	    continue;
+	const Ray ray = packet.ray(i);
+	leaf.setRay(ray, packet.skip[i]);
+	if (occluded(ray, packet.tmax[i], leaf)) {
+	    packet.tmax[i] = -1;
+	    packet.hit[i] = leaf.hit;
+	}
+    }
+    leaf.setRay();
+}
+
+#endif
@@ -15,32 +15,169 @@ General Public License for more details.
 You should have received a copy of the GNU General Public License along 
 with this program; if not, see <http://www.gnu.org/licenses/>. */
 
+#include <cstdio>
+#include <cstdlib>
 #include <iostream>
 
 #include <QApplication>
+#include <QCoreApplication>
 #include <QDebug>
+#include <QImage>
+#include <QTime>
 #include <QWidget>
 #include <QVBoxLayout>
 
 #include "canvas.h"
 #include "dela.h"
 #include "dela_builtins.h"
+#include "dela_glue.h"
+#include "renderer.h"
+#include "scene.h"
+#include "threadpool.h"
+
+static void usage(const char *name)
+{
+    std::cout << "Usage: " << name << " scene-file [--autorefresh] [options]" << std::endl
+	      << "       " << name << " --headless scene-file [-o image-file] [options]" << std::endl
+	      << std::endl
+	      << "Options:" << std::endl
+	      << "  --size WxH     image size, default 640x480" << std::endl
+	      << "  --threads n    number of render threads, default one per core" << std::endl
+	      << "  --samples n    jittered samples per pixel, default 1" << std::endl
+	      << "  --stats        print ray statistics after rendering" << std::endl
+	      << "  --accel name   sphere acceleration structure: auto, bvh2, wide," << std::endl
+	      << "                 compressed8, compressed16 or grid, default auto" << std::endl
+	      << "  --memory       print the memory used by the scene" << std::endl
+	      << "  --compile      keep a compiled copy of the scene as scene-file.frc" << std::endl
+	      << "                 and load it while the scene is unchanged" << std::endl
+	      << "  --profile      print where the scene script spends its time" << std::endl
+	      << "  --profile-folded file" << std::endl
+	      << "                 the same, and write its call stacks to file for" << std::endl
+	      << "                 flamegraph.pl" << std::endl;
+}
+
+// Render without any widgets or GL context, e.g. on machines without
+// a display...
+static int renderHeadless(const QString &sceneFile, const QString &imageFile,
+			  int width, int height, int samples, bool showStats,
+			  bool showMemory)
+{
+    Scene *scene = loadScene(sceneFile);
+    if (!scene)
+	return 1;
+    if (showMemory)
+	scene->memory().report(std::cout);
+
+    Renderer *renderer = new Renderer(*scene, width, height);
+    renderer->setSamples(samples);
+
+    std::cout << "Start..." << std::endl;
+    QTime t;
+    t.start();
+    renderer->render();
+    std::cout << "Finished in " << t.elapsed() << " ms." << std::endl;
+    if (showStats)
+	renderer->getStats().report(std::cout);
+
+    bool saved = renderer->toImage().save(imageFile);
+    if (!saved)
+	qDebug() << "funray error: cannot write image " << imageFile;
+
+    delete renderer;
+    delete scene;
+    return saved ? 0 : 1;
+}
 
 int main(int argc, char ** argv)
 {
+    QString sceneFile;
+    QString imageFile = "last_render.png";
+    bool autoRefresh = false;
+    bool headless = false;
+    int width = 640;
+    int height = 480;
+    int samples = 1;
+    bool showStats = false;
+    bool showMemory = false;
+
+    for (int i = 1; i < argc; i++) {
+	QString arg(argv[i]);
+	if (arg == "--autorefresh")
+	    autoRefresh = true;
+	else if (arg == "--headless")
+	    headless = true;
+	else if (arg == "-o" && i + 1 < argc)
+	    imageFile = argv[++i];
+	else if (arg == "--threads" && i + 1 < argc)
+	    ThreadPool::instance().setThreadCount(atoi(argv[++i]));
+	else if (arg == "--accel" && i + 1 < argc) {
+	    QString name(argv[++i]);
+	    if (name == "auto")
+		Scene::setDefaultAccelerator(Scene::Automatic);
+	    else if (name == "bvh2")
+		Scene::setDefaultAccelerator(Scene::BinaryTree);
+	    else if (name == "wide")
+		Scene::setDefaultAccelerator(Scene::WideTree);
+	    else if (name == "compressed8")
+		Scene::setDefaultAccelerator(Scene::CompressedTree8);
+	    else if (name == "compressed16")
+		Scene::setDefaultAccelerator(Scene::CompressedTree16);
+	    else if (name == "grid")
+		Scene::setDefaultAccelerator(Scene::UniformGrid);
+	    else {
+		usage(argv[0]);
+		return 1;
+	    }
+	} else if (arg == "--stats")
+	    showStats = true;
+	else if (arg == "--memory")
+	    showMemory = true;
+	else if (arg == "--compile")
+	    setCompiledScenes(true);
+	else if (arg == "--profile")
+	    setSceneProfiling(true);
+	else if (arg == "--profile-folded" && i + 1 < argc)
+	    setSceneProfiling(true, argv[++i]);
+	else if (arg == "--samples" && i + 1 < argc)
+	    samples = atoi(argv[++i]);
+	else if (arg == "--size" && i + 1 < argc) {
+	    if (sscanf(argv[++i], "%dx%d", &width, &height) != 2
+		|| width <= 0 || height <= 0) {
+		usage(argv[0]);
+		return 1;
+	    }
+	} else if (sceneFile.isEmpty() && !arg.startsWith("-"))
+	    sceneFile = arg;
+	else {
+	    usage(argv[0]);
+	    return 1;
+	}
+    }
+
+    if (sceneFile.isEmpty()) {
+	usage(argv[0]);
+	return 0;
+    }
+
+    if (headless) {
+	QCoreApplication app(argc, argv);
+	return renderHeadless(sceneFile, imageFile, width, height, samples,
+			      showStats, showMemory);
+    }
+
     QApplication app(argc, argv);
     Canvas canvas;
+    canvas.setRenderSize(width, height);
+    canvas.setSamples(samples);
+    canvas.setShowStats(showStats);
+    canvas.setShowMemory(showMemory);
 
-    if (argc > 1) {
-	if (canvas.loadScene(argv[1])) {
-	    if ((argc > 2) && QString(argv[2]) == "--autorefresh")
-		canvas.setAutoRefresh(true);
-	    canvas.show();
-	    canvas.render();
-	    return app.exec();
-	}
-    } else {
-	std::cout << "Usage: " << argv[0] << " scene-file [--autorefresh]" << std::endl;
+    if (canvas.loadScene(sceneFile)) {
+	if (autoRefresh)
+	    canvas.setAutoRefresh(true);
+	canvas.show();
+	canvas.render();
+	return app.exec();
     }
 
     return 0;
@@ -0,0 +1,596 @@
+/*funray - yet another raytracer
+Copyright (C) 2008  Christian Zeller (chrizel@gmail.com) and
+		    Simon Goller (neosam@gmail.com).
+
+This program is free software; you can redistribute it and/or modify 
+it under the terms of the GNU General Public License as published 
+by the Free Software Foundation; either version 3 of the License, 
+or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful, but 
+WITHOUT ANY WARRANTY; without even the implied warranty of 
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License along 
+with this program; if not, see <http://www.gnu.org/licenses/>. */
+
+
+#include <QByteArray>
+#include <QDebug>
+#include <QFile>
+#include <QFileInfo>
+#include <QList>
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include "meshloader.h"
+#include "primitives.h"
+#include "vector.h"
+
+// Gives the lines of a file one after another without reading all of
+// it: chunks are read into a buffer which only grows for lines longer
+// than itself.
+class LineReader
+{
+private:
+    QFile &file;
+    std::vector<char> buffer;
+    int begin, end;
+    bool eof;
+
+public:
+    enum { chunkSize = 1 << 20 };
+
+    LineReader(QFile &file)
+	: file(file), buffer(chunkSize + 1), begin(0), end(0), eof(false) {};
+
+    // The next line, null terminated and without the line break, or 0
+    // at the end of the file. Valid until the next call.
+    char *next();
+};
+
+char *LineReader::next()
+{
+    for (;;) {
+	char *data = &buffer[0];
+	char *newline = (char *)memchr(data + begin, '\n', end - begin);
+	if (newline || (eof && begin < end)) {
+	    char *line = data + begin;
+	    if (!newline)
+		newline = data + end;
+	    *newline = 0;
+	    begin = newline - data + 1;
+	    return line;
+	}
+	if (eof)
+	    return 0;
+
+	// keep the unfinished line and read behind it
+	memmove(data, data + begin, end - begin);
+	end -= begin;
+	begin = 0;
+	if (end + chunkSize / 2 > (int)buffer.size() - 1)
+	    buffer.resize(buffer.size() * 2);
+	qint64 n = file.read(&buffer[end], buffer.size() - 1 - end);
+	if (n <= 0)
+	    eof = true;
+	else
+	    end += n;
+    }
+}
+
+static inline bool isBlank(char c)
+{
+    return c == ' ' || c == '\t' || c == '\r';
+}
+
+static inline char *skipBlanks(char *p)
+{
+    while (isBlank(*p))
+	p++;
+    return p;
+}
+
+// Converts a 1 based or negative relative OBJ index, -1 if invalid
+static inline int objIndex(long index, int vertexCount)
+{
+    if (index < 0)
+	index += vertexCount;
+    else
+	index--;
+    return index >= 0 && index < vertexCount ? index : -1;
+}
+
+// Vertex positions and polygons, everything else is ignored
+static bool loadObj(QFile &file, TriangleMesh &mesh)
+{
+    LineReader reader(file);
+    std::vector<int> polygon;
+    int lineNumber = 0;
+
+    while (char *line = reader.next()) {
+	lineNumber++;
+	line = skipBlanks(line);
+
+	if (line[0] == 'v' && isBlank(line[1])) {
+	    char *p = line + 2;
+	    float x = strtod(p, &p);
+	    float y = strtod(p, &p);
+	    float z = strtod(p, &p);
+	    mesh.vertices.push_back(vec(x, y, z));
+	} else if (line[0] == 'f' && isBlank(line[1])) {
+	    // vertex, vertex/texture, vertex//normal or all three
+	    polygon.clear();
+	    char *p = skipBlanks(line + 1);
+	    while (*p) {
+		char *token = p;
+		int index = objIndex(strtol(token, &p, 10), mesh.vertices.size());
+		if (p == token || index < 0) {
+		    qDebug() << "loadMesh error: Bad face in line" << lineNumber;
+		    return false;
+		}
+		polygon.push_back(index);
+		while (*p && !isBlank(*p))
+		    p++;
+		p = skipBlanks(p);
+	    }
+
+	    for (unsigned int i = 2; i < polygon.size(); i++) {
+		mesh.indices.push_back(polygon[0]);
+		mesh.indices.push_back(polygon[i - 1]);
+		mesh.indices.push_back(polygon[i]);
+	    }
+	}
+    }
+
+    return true;
+}
+
+// Scalar types of PLY properties
+enum PlyType { PlyInt8, PlyUInt8, PlyInt16, PlyUInt16, PlyInt32, PlyUInt32,
+	       PlyFloat32, PlyFloat64, PlyInvalid };
+
+static const int plyTypeSize[] = { 1, 1, 2, 2, 4, 4, 4, 8 };
+
+static PlyType plyType(const QByteArray &name)
+{
+    if (name == "char" || name == "int8")
+	return PlyInt8;
+    else if (name == "uchar" || name == "uint8")
+	return PlyUInt8;
+    else if (name == "short" || name == "int16")
+	return PlyInt16;
+    else if (name == "ushort" || name == "uint16")
+	return PlyUInt16;
+    else if (name == "int" || name == "int32")
+	return PlyInt32;
+    else if (name == "uint" || name == "uint32")
+	return PlyUInt32;
+    else if (name == "float" || name == "float32")
+	return PlyFloat32;
+    else if (name == "double" || name == "float64")
+	return PlyFloat64;
+    return PlyInvalid;
+}
+
+struct PlyProperty
+{
+    QByteArray name;
+    PlyType type;
+    // lists have the type of their length in countType
+    bool list;
+    PlyType countType;
+};
+
+struct PlyElement
+{
+    QByteArray name;
+    int count;
+    QList<PlyProperty> properties;
+
+    // bytes per entry of a binary file, -1 with lists
+    int stride() const;
+    int indexOf(const QByteArray &name) const;
+};
+
+int PlyElement::stride() const
+{
+    int size = 0;
+    for (int i = 0; i < properties.size(); i++) {
+	if (properties[i].list)
+	    return -1;
+	size += plyTypeSize[properties[i].type];
+    }
+    return size;
+}
+
+int PlyElement::indexOf(const QByteArray &name) const
+{
+    for (int i = 0; i < properties.size(); i++) {
+	if (properties[i].name == name)
+	    return i;
+    }
+    return -1;
+}
+
+enum PlyFormat { PlyAscii, PlyLittleEndian, PlyBigEndian };
+
+// One binary value in the byte order of the file
+static inline double plyValue(const uchar *p, PlyType type, bool swap)
+{
+    uchar bytes[8];
+    int size = plyTypeSize[type];
+    if (swap) {
+	for (int i = 0; i < size; i++)
+	    bytes[i] = p[size - 1 - i];
+	p = bytes;
+    }
+
+    if (type == PlyFloat32) {
+	float f;
+	memcpy(&f, p, 4);
+	return f;
+    } else if (type == PlyInt32) {
+	qint32 i;
+	memcpy(&i, p, 4);
+	return i;
+    } else if (type == PlyUInt32) {
+	quint32 i;
+	memcpy(&i, p, 4);
+	return i;
+    } else if (type == PlyUInt8) {
+	return *p;
+    } else if (type == PlyInt8) {
+	return (signed char)*p;
+    } else if (type == PlyInt16) {
+	qint16 i;
+	memcpy(&i, p, 2);
+	return i;
+    } else if (type == PlyUInt16) {
+	quint16 i;
+	memcpy(&i, p, 2);
+	return i;
+    }
+    double d;
+    memcpy(&d, p, 8);
+    return d;
+}
+
+// Adds the polygon of a face as triangle fan, false on bad indices
+static inline bool addFace(TriangleMesh &mesh, const int *polygon, int count)
+{
+    const int vertexCount = mesh.vertices.size();
+    for (int i = 0; i < count; i++) {
+	if (polygon[i] < 0 || polygon[i] >= vertexCount)
+	    return false;
+    }
+    for (int i = 2; i < count; i++) {
+	mesh.indices.push_back(polygon[0]);
+	mesh.indices.push_back(polygon[i - 1]);
+	mesh.indices.push_back(polygon[i]);
+    }
+    return true;
+}
+
+// Reads the elements from the mapped data behind the header
+static bool loadPlyBinary(const uchar *data, const uchar *end, bool swap,
+			  const QList<PlyElement> &elements, TriangleMesh &mesh)
+{
+    std::vector<int> polygon;
+
+    for (int e = 0; e < elements.size(); e++) {
+	const PlyElement &element = elements[e];
+	const int stride = element.stride();
+
+	if (element.name == "vertex") {
+	    int x = element.indexOf("x");
+	    int y = element.indexOf("y");
+	    int z = element.indexOf("z");
+	    if (x < 0 || y < 0 || z < 0 || stride < 0) {
+		qDebug() << "loadMesh error: Unsupported PLY vertex properties";
+		return false;
+	    }
+	    if ((end - data) / stride < element.count) {
+		qDebug() << "loadMesh error: PLY file is truncated";
+		return false;
+	    }
+
+	    // byte offsets of x, y and z within a vertex
+	    int offset[3] = { 0, 0, 0 };
+	    int index[3] = { x, y, z };
+	    for (int a = 0; a < 3; a++) {
+		for (int i = 0; i < index[a]; i++)
+		    offset[a] += plyTypeSize[element.properties[i].type];
+	    }
+	    const PlyType tx = element.properties[x].type;
+	    const PlyType ty = element.properties[y].type;
+	    const PlyType tz = element.properties[z].type;
+
+	    mesh.vertices.resize(element.count);
+	    for (int i = 0; i < element.count; i++, data += stride) {
+		mesh.vertices[i] = vec(plyValue(data + offset[0], tx, swap),
+				       plyValue(data + offset[1], ty, swap),
+				       plyValue(data + offset[2], tz, swap));
+	    }
+	} else if (stride >= 0) {
+	    if ((end - data) / std::max(stride, 1) < element.count) {
+		qDebug() << "loadMesh error: PLY file is truncated";
+		return false;
+	    }
+	    data += (long)stride * element.count;
+	} else {
+	    // entries with lists have to be walked one after another
+	    const bool face = element.name == "face";
+	    int indices = element.indexOf("vertex_indices");
+	    if (indices < 0)
+		indices = element.indexOf("vertex_index");
+
+	    // an entry has at least its other properties and the list
+	    // counts, a face which is kept three indices more
+	    long minimum = 0;
+	    long triangle = 0;
+	    for (int k = 0; k < element.properties.size(); k++) {
+		const PlyProperty &property = element.properties[k];
+		if (!property.list)
+		    minimum += plyTypeSize[property.type];
+		else {
+		    minimum += plyTypeSize[property.countType];
+		    if (k == indices)
+			triangle = 3 * plyTypeSize[property.type];
+		}
+	    }
+	    if ((end - data) / minimum < element.count) {
+		qDebug() << "loadMesh error: PLY file is truncated";
+		return false;
+	    }
+	    if (face && indices >= 0)
+		mesh.indices.reserve(mesh.indices.size() + 3 * std::min(
+					 (long)element.count, (end - data) / (minimum + triangle)));
+
+	    for (int i = 0; i < element.count; i++) {
+		for (int k = 0; k < element.properties.size(); k++) {
+		    const PlyProperty &property = element.properties[k];
+		    if (!property.list) {
+			data += plyTypeSize[property.type];
+			continue;
+		    }
+
+		    int countSize = plyTypeSize[property.countType];
+		    if (end - data < countSize) {
+			qDebug() << "loadMesh error: PLY file is truncated";
+			return false;
+		    }
+		    int count = (int)plyValue(data, property.countType, swap);
+		    data += countSize;
+		    int size = plyTypeSize[property.type];
+		    if (count < 0 || (end - data) / size < count) {
+			qDebug() << "loadMesh error: PLY file is truncated";
+			return false;
+		    }
+
+		    if (face && k == indices && count >= 3) {
+			polygon.resize(count);
+			for (int v = 0; v < count; v++)
+			    polygon[v] = (int)plyValue(data + v * size, property.type, swap);
+			if (!addFace(mesh, &polygon[0], count)) {
+			    qDebug() << "loadMesh error: Bad vertex index in face" << i;
+			    return false;
+			}
+		    }
+		    data += count * size;
+		}
+	    }
+	}
+
+	if (data > end) {
+	    qDebug() << "loadMesh error: PLY file is truncated";
+	    return false;
+	}
+    }
+
+    return true;
+}
+
+// Reads the elements line by line, one entry per line
+static bool loadPlyAscii(LineReader &reader, const QList<PlyElement> &elements,
+			 TriangleMesh &mesh)
+{
+    std::vector<double> values;
+    std::vector<int> polygon;
+
+    for (int e = 0; e < elements.size(); e++) {
+	const PlyElement &element = elements[e];
+	const bool vertex = element.name == "vertex";
+	const bool face = element.name == "face";
+	int x = element.indexOf("x");
+	int y = element.indexOf("y");
+	int z = element.indexOf("z");
+	int indices = element.indexOf("vertex_indices");
+	if (indices < 0)
+	    indices = element.indexOf("vertex_index");
+	if (vertex && (x < 0 || y < 0 || z < 0 || element.stride() < 0)) {
+	    qDebug() << "loadMesh error: Unsupported PLY vertex properties";
+	    return false;
+	}
+
+	for (int i = 0; i < element.count; i++) {
+	    char *p = reader.next();
+	    if (!p) {
+		qDebug() << "loadMesh error: PLY file is truncated";
+		return false;
+	    }
+	    if (!vertex && !face)
+		continue;
+
+	    // the properties of the vertex, or the face indices
+	    values.clear();
+	    for (int k = 0; k < element.properties.size(); k++) {
+		const PlyProperty &property = element.properties[k];
+		char *token = p;
+		if (!property.list) {
+		    values.push_back(strtod(token, &p));
+		} else {
+		    // every index takes two characters at least
+		    int count = strtol(token, &p, 10);
+		    if (count < 0 || count > (int)strlen(p) / 2)
+			p = token;
+		    polygon.resize(p == token ? 0 : count);
+		    for (int v = 0; v < count && p != token; v++) {
+			char *index = p;
+			polygon[v] = strtol(index, &p, 10);
+			if (p == index)
+			    p = token;
+		    }
+		    if (p == token) {
+			qDebug() << "loadMesh error: Bad PLY" << element.name << i;
+			return false;
+		    }
+		    if (face && k == indices && count >= 3
+			&& !addFace(mesh, &polygon[0], count)) {
+			qDebug() << "loadMesh error: Bad vertex index in face" << i;
+			return false;
+		    }
+		    values.push_back(0);
+		}
+		if (p == token) {
+		    qDebug() << "loadMesh error: Bad PLY" << element.name << i;
+		    return false;
+		}
+	    }
+
+	    if (vertex)
+		mesh.vertices.push_back(vec(values[x], values[y], values[z]));
+	}
+    }
+
+    return true;
+}
+
+// The header is text up to "end_header", followed by the elements in
+// the order they are declared.
+static bool loadPly(QFile &file, TriangleMesh &mesh)
+{
+    qint64 size = file.size();
+    uchar *data = size > 0 ? file.map(0, size) : 0;
+    if (!data) {
+	qDebug() << "loadMesh error: Cannot map" << file.fileName();
+	return false;
+    }
+    const uchar *end = data + size;
+
+    QList<PlyElement> elements;
+    PlyFormat format = PlyAscii;
+    const uchar *p = data;
+    bool header = true;
+    for (int line = 0; header; line++) {
+	const uchar *newline = (const uchar *)memchr(p, '\n', end - p);
+	if (!newline) {
+	    qDebug() << "loadMesh error: PLY header has no end";
+	    return false;
+	}
+	QList<QByteArray> words = QByteArray((const char *)p, newline - p)
+	    .trimmed().split(' ');
+	p = newline + 1;
+	words.removeAll(QByteArray());
+
+	if (line == 0) {
+	    if (words.size() != 1 || words[0] != "ply") {
+		qDebug() << "loadMesh error: Not a PLY file:" << file.fileName();
+		return false;
+	    }
+	} else if (words.isEmpty() || words[0] == "comment" || words[0] == "obj_info") {
+	    continue;
+	} else if (words[0] == "end_header") {
+	    header = false;
+	} else if (words[0] == "format" && words.size() == 3) {
+	    if (words[1] == "ascii")
+		format = PlyAscii;
+	    else if (words[1] == "binary_little_endian")
+		format = PlyLittleEndian;
+	    else if (words[1] == "binary_big_endian")
+		format = PlyBigEndian;
+	    else {
+		qDebug() << "loadMesh error: Unknown PLY format" << words[1];
+		return false;
+	    }
+	} else if (words[0] == "element" && words.size() == 3) {
+	    PlyElement element;
+	    element.name = words[1];
+	    bool ok;
+	    element.count = words[2].toInt(&ok);
+	    if (!ok || element.count < 0) {
+		qDebug() << "loadMesh error: Bad PLY element count in header line" << line + 1;
+		return false;
+	    }
+	    elements.append(element);
+	} else if (words[0] == "property" && !elements.isEmpty()) {
+	    PlyProperty property;
+	    property.list = words.size() == 5 && words[1] == "list";
+	    if (property.list) {
+		property.countType = plyType(words[2]);
+		property.type = plyType(words[3]);
+	    } else if (words.size() == 3) {
+		property.countType = PlyInt8;
+		property.type = plyType(words[1]);
+	    } else {
+		property.type = PlyInvalid;
+	    }
+	    property.name = words.last();
+	    if (property.type == PlyInvalid || property.countType == PlyInvalid) {
+		qDebug() << "loadMesh error: Bad PLY property in header line" << line + 1;
+		return false;
+	    }
+	    elements.last().properties.append(property);
+	} else {
+	    qDebug() << "loadMesh error: Bad PLY header line" << line + 1;
+	    return false;
+	}
+    }
+
+    if (format == PlyAscii) {
+	// ascii is read like an OBJ file instead of parsing the mapping
+	qint64 offset = p - data;
+	file.unmap(data);
+	file.seek(offset);
+	LineReader reader(file);
+	return loadPlyAscii(reader, elements, mesh);
+    }
+
+    bool swap = (format == PlyBigEndian) != (Q_BYTE_ORDER == Q_BIG_ENDIAN);
+    bool ok = loadPlyBinary(p, end, swap, elements, mesh);
+    file.unmap(data);
+    return ok;
+}
+
+bool loadMesh(const QString &fileName, TriangleMesh &mesh)
+{
+    QFile file(fileName);
+    if (!file.open(QIODevice::ReadOnly)) {
+	qDebug() << "loadMesh error: Cannot open" << fileName;
+	return false;
+    }
+
+    mesh.vertices.clear();
+    mesh.indices.clear();
+
+    QByteArray suffix = QFileInfo(fileName).suffix().toLower().toAscii();
+    bool ok;
+    if (suffix == "ply") {
+	ok = loadPly(file, mesh);
+    } else if (suffix == "obj") {
+	ok = loadObj(file, mesh);
+    } else {
+	qDebug() << "loadMesh error: Unknown mesh format:" << fileName;
+	return false;
+    }
+
+    if (ok && mesh.indices.empty()) {
+	qDebug() << "loadMesh error: No triangles in" << fileName;
+	return false;
+    }
+    return ok;
+}
@@ -0,0 +1,32 @@
+/*funray - yet another raytracer
+Copyright (C) 2008  Christian Zeller (chrizel@gmail.com) and
+		    Simon Goller (neosam@gmail.com).
+
+This program is free software; you can redistribute it and/or modify 
+it under the terms of the GNU General Public License as published 
+by the Free Software Foundation; either version 3 of the License, 
+or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful, but 
+WITHOUT ANY WARRANTY; without even the implied warranty of 
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License along 
+with this program; if not, see <http://www.gnu.org/licenses/>. */
+
+
+#ifndef MESHLOADER_H
+#define MESHLOADER_H
+
+#include <QString>
+
+class TriangleMesh;
+
+// Reads the triangles of a PLY or OBJ file, chosen by the file
+// extension, into mesh. Binary PLY files are memory mapped, ascii PLY
+// and OBJ files are read in chunks of lines; polygons are split into
+// triangle fans. Returns false with a message on errors.
+bool loadMesh(const QString &fileName, TriangleMesh &mesh);
+
+#endif
@@ -0,0 +1,132 @@
+/*funray - yet another raytracer
+Copyright (C) 2008  Christian Zeller (chrizel@gmail.com) and
+		    Simon Goller (neosam@gmail.com).
+
+This program is free software; you can redistribute it and/or modify 
+it under the terms of the GNU General Public License as published 
+by the Free Software Foundation; either version 3 of the License, 
+or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful, but 
+WITHOUT ANY WARRANTY; without even the implied warranty of 
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License along 
+with this program; if not, see <http://www.gnu.org/licenses/>. */
+
+#ifndef PACKET_H
+#define PACKET_H
+
+#include "simd.h"
+#include "vector.h"
+
+// Up to maxSize rays as structure of arrays, traced together through
+// the bvh. Unused lanes at the end have a negative tmax and never hit
+// anything, so kernels can always work on whole SIMD registers.
+struct RayPacket
+{
+    enum { maxSize = 64 };
+
+    int count;
+
+    float ox[maxSize], oy[maxSize], oz[maxSize];
+    float dx[maxSize], dy[maxSize], dz[maxSize];
+    // safeInverse of the directions
+    float ix[maxSize], iy[maxSize], iz[maxSize];
+
+    float tmax[maxSize];
+    // index to ignore in occlusion tests, or -1; integers, a float
+    // would not tell large neighboring indices apart
+    int skip[maxSize];
+    // index of the nearest hit in the traced set, or -1
+    int hit[maxSize];
+
+    RayPacket() : count(0) {};
+
+    inline void add(const Ray &ray, float tmax, int skip = -1) {
+	vec inv = safeInverse(ray.dir);
+	ox[count] = ray.pos.x;
+	oy[count] = ray.pos.y;
+	oz[count] = ray.pos.z;
+	dx[count] = ray.dir.x;
+	dy[count] = ray.dir.y;
+	dz[count] = ray.dir.z;
+	ix[count] = inv.x;
+	iy[count] = inv.y;
+	iz[count] = inv.z;
+	this->tmax[count] = tmax;
+	this->skip[count] = skip;
+	hit[count] = -1;
+	count++;
+    };
+
+    // Fills the lanes up to size() with rays which hit nothing
+    inline void finish() {
+	for (int i = count; i < size(); i++) {
+	    ox[i] = oy[i] = oz[i] = 0;
+	    dx[i] = dy[i] = dz[i] = 0;
+	    ix[i] = iy[i] = iz[i] = 0;
+	    tmax[i] = -1;
+	    skip[i] = -1;
+	    hit[i] = -1;
+	}
+    };
+
+    // count rounded up to whole SIMD registers
+    inline int size() const {
+	return (count + SIMD_WIDTH - 1) / SIMD_WIDTH * SIMD_WIDTH;
+    };
+
+    // Ray i with the direction exactly as stored
+    inline Ray ray(int i) const {
+	Ray r(vec(ox[i], oy[i], oz[i]), vec(dx[i], dy[i], dz[i]));
+	r.dir = vec(dx[i], dy[i], dz[i]);
+	return r;
+    };
+
+    // Is any ray still looking for a hit?
+    inline bool active() const {
+	for (int i = 0; i < size(); i += SIMD_WIDTH) {
+	    if ((vfloat::load(tmax + i) >= vfloat(0.0f)).any())
+		return true;
+	}
+	return false;
+    };
+
+    // Slab test of BBox::intersect for all rays, true if any of them
+    // enters the box before its tmax.
+    inline bool hits(const BBox &box) const {
+	const vfloat minX(box.min.x), minY(box.min.y), minZ(box.min.z);
+	const vfloat maxX(box.max.x), maxY(box.max.y), maxZ(box.max.z);
+
+	for (int i = 0; i < size(); i += SIMD_WIDTH) {
+	    vfloat o = vfloat::load(ox + i);
+	    vfloat inv = vfloat::load(ix + i);
+	    vfloat t0 = (minX - o) * inv;
+	    vfloat t1 = (maxX - o) * inv;
+	    vfloat tnear = vmax(vfloat(0.0f), vmin(t0, t1));
+	    vfloat tfar = vmin(vfloat::load(tmax + i), vmax(t0, t1));
+
+	    o = vfloat::load(oy + i);
+	    inv = vfloat::load(iy + i);
+	    t0 = (minY - o) * inv;
+	    t1 = (maxY - o) * inv;
+	    tnear = vmax(tnear, vmin(t0, t1));
+	    tfar = vmin(tfar, vmax(t0, t1));
+
+	    o = vfloat::load(oz + i);
+	    inv = vfloat::load(iz + i);
+	    t0 = (minZ - o) * inv;
+	    t1 = (maxZ - o) * inv;
+	    tnear = vmax(tnear, vmin(t0, t1));
+	    tfar = vmin(tfar, vmax(t0, t1));
+
+	    if ((tnear <= tfar).any())
+		return true;
+	}
+	return false;
+    };
+};
+
+#endif
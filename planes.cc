@@ -0,0 +1,74 @@
+/*funray - yet another raytracer
+Copyright (C) 2008  Christian Zeller (chrizel@gmail.com) and
+		    Simon Goller (neosam@gmail.com).
+
+This program is free software; you can redistribute it and/or modify 
+it under the terms of the GNU General Public License as published 
+by the Free Software Foundation; either version 3 of the License, 
+or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful, but 
+WITHOUT ANY WARRANTY; without even the implied warranty of 
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License along 
+with this program; if not, see <http://www.gnu.org/licenses/>. */
+
+#include "planes.h"
+#include "simd.h"
+#include "vector.h"
+
+int PlaneSet::intersect(const Ray &ray, int begin, int end, float &tmax) const
+{
+    int hit = -1;
+    for (int i = begin; i < end; i++) {
+	float t = distance(i, ray);
+	if (t > 0.0001f && t < tmax) {
+	    tmax = t;
+	    hit = i;
+	}
+    }
+    return hit;
+}
+
+int PlaneSet::occluder(const Ray &ray, int begin, int end, float tmax, int skip) const
+{
+    for (int i = begin; i < end; i++) {
+	if (i == skip)
+	    continue;
+	float t = distance(i, ray);
+	if (t > 0 && t < tmax)
+	    return i;
+    }
+    return -1;
+}
+
+void PlaneSet::intersect(RayPacket &packet, int begin, int end) const
+{
+    const vfloat tmin(0.0001f);
+    const int size = packet.size();
+
+    for (int s = begin; s < end; s++) {
+	const vfloat nx(normals[s].x), ny(normals[s].y), nz(normals[s].z), ds(d[s]);
+	for (int i = 0; i < size; i += SIMD_WIDTH) {
+	    vfloat a = ds - (vfloat::load(packet.ox + i) * nx
+			     + vfloat::load(packet.oy + i) * ny
+			     + vfloat::load(packet.oz + i) * nz);
+	    vfloat b = vfloat::load(packet.dx + i) * nx
+		+ vfloat::load(packet.dy + i) * ny
+		+ vfloat::load(packet.dz + i) * nz;
+	    vfloat t = a / b;
+	    vfloat tmax = vfloat::load(packet.tmax + i);
+	    vmask m = (t > tmin) & (t < tmax);
+	    int bits = m.bits();
+	    if (bits) {
+		select(m, t, tmax).store(packet.tmax + i);
+		for (int k = 0; bits; k++, bits >>= 1) {
+		    if (bits & 1)
+			packet.hit[i + k] = s;
+		}
+	    }
+	}
+    }
+}
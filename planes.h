@@ -0,0 +1,91 @@
+/*funray - yet another raytracer
+Copyright (C) 2008  Christian Zeller (chrizel@gmail.com) and
+		    Simon Goller (neosam@gmail.com).
+
+This program is free software; you can redistribute it and/or modify 
+it under the terms of the GNU General Public License as published 
+by the Free Software Foundation; either version 3 of the License, 
+or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful, but 
+WITHOUT ANY WARRANTY; without even the implied warranty of 
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License along 
+with this program; if not, see <http://www.gnu.org/licenses/>. */
+
+#ifndef PLANES_H
+#define PLANES_H
+
+#include <cmath>
+#include <vector>
+
+#include "packet.h"
+#include "vector.h"
+
+// Planes as flat arrays with the distance d = pos . normal from the
+// origin precomputed. There are only a few of them and they have no
+// bounds, so they are simply tested one after another.
+class PlaneSet
+{
+public:
+    // shading uses the side the normal points to
+    enum { twoSided = 0 };
+
+    std::vector<vec> pos;
+    std::vector<vec> normals;
+    std::vector<float> d;
+    std::vector<float> mirrors;
+
+    inline void clear() {
+	pos.clear();
+	normals.clear();
+	d.clear();
+	mirrors.clear();
+    };
+
+    inline void add(const vec &pos, const vec &normal, float mirror) {
+	this->pos.push_back(pos);
+	normals.push_back(normal);
+	d.push_back(pos.dot(normal));
+	mirrors.push_back(mirror);
+    };
+
+    inline int size() const {
+	return d.size();
+    };
+
+    inline float distance(int i, const Ray &ray) const {
+	float a = d[i] - ray.pos.dot(normals[i]);
+	float b = ray.dir.dot(normals[i]);
+	return a / b;
+    };
+
+    inline const vec normalAt(int i, const vec & /* point */) const {
+	return normals[i];
+    };
+
+    // checkerboard
+    inline const vec colorAt(int i, const vec &point) const {
+	vec p = point + pos[i];
+	int a = (int(fabs(p.z < 0 ? p.z - 1 : p.z)) % 2);
+	int b = (int(fabs(p.x < 0 ? p.x - 1 : p.x)) % 2);
+	return a == b ? vec(0.6, 0.6, 0.6) : vec(1, 1, 1);
+    };
+
+    inline float mirrorAt(int i) const {
+	return mirrors[i];
+    };
+
+    // Same interface as SphereSet
+    int intersect(const Ray &ray, int begin, int end, float &tmax) const;
+    int occluder(const Ray &ray, int begin, int end, float tmax, int skip = -1) const;
+    inline bool occluded(const Ray &ray, int begin, int end, float tmax,
+			 int skip = -1) const {
+	return occluder(ray, begin, end, tmax, skip) >= 0;
+    };
+    void intersect(RayPacket &packet, int begin, int end) const;
+};
+
+#endif
@@ -22,8 +22,14 @@ with this program; if not, see <http://www.gnu.org/licenses/>. */
 #include <vector>
 
 #include "dela.h"
+#include "transform.h"
 #include "vector.h"
 
+class Scene;
+
+// The primitives are the authoring layer for scripts only.
+// Scene::build() copies them into the flat arrays of SphereSet,
+// PlaneSet and TriangleSet, which do the intersection and shading.
 class Primitive : public dela::Scriptable
 {
 public:
@@ -34,13 +40,6 @@ public:
 	: color(color), mirror(mirror) {};
     virtual ~Primitive() {};
 
-    virtual float intercept(const Ray &ray) = 0;
-    virtual const vec normalAt(vec &point) = 0;
-
-    virtual const vec colorAt(vec & /* point */) {
-        return color;
-    };
-
     virtual float getMirror() { return mirror; };
     virtual void setMirror(float mirror) { this->mirror = mirror; };
 };
@@ -53,26 +52,6 @@ public:
 
     vec pos;
     float radius;
-
-    virtual float intercept(const Ray &ray) {
-      vec e = pos - ray.pos;
-      float a = e.dot(ray.dir);
-      float f = sqrt(radius * radius - (e.dot(e)) + (a * a));
-      return a - f;
-    };
-
-
-    virtual const vec normalAt(vec &point) {
-	/*
-	vec v = (point - pos).normal(); 
-	float r1 = 0.1 * (rand() % 100) / 100.0; 
-	float r2 = 0.1 * (rand() % 100) / 100.0;
-	float r3 = 0.1 * (rand() % 100) / 100.0;
-	return (v + vec(r1, r2, r3)).normal();
-	*/
-
-	return (point - pos).normal();
-    }
 };
 
 class Plane : public Primitive
@@ -83,25 +62,34 @@ public:
 
     vec pos;
     vec normal;
+};
 
-    virtual float intercept(const Ray &ray) {
-        float d = pos.dot(normal);
-        float a = d - ray.pos.dot(normal);
-        float b = ray.dir.dot(normal);
-        return a / b;
-    };
-
+// Indexed triangles: the vertices are shared between the triangles,
+// each of which has three indices into them.
+class TriangleMesh : public Primitive
+{
+public:
+    TriangleMesh(const vec &color)
+	: Primitive(color) {};
 
-    virtual const vec normalAt(vec & /* point */) {
-        return this->normal;
-    }
+    std::vector<vec> vertices;
+    std::vector<int> indices;
 
-    virtual const vec colorAt(vec &point) {
-        vec p = point + pos;
-        int a = (int(fabs(p.z < 0 ? p.z - 1 : p.z)) % 2);
-        int b = (int(fabs(p.x < 0 ? p.x - 1 : p.x)) % 2);
-        return a == b ? vec(0.6, 0.6, 0.6) : vec(1, 1, 1);
+    inline int triangleCount() const {
+	return indices.size() / 3;
     };
 };
 
+// Places a group, a Scene built on its own, into the scene. The group
+// is shared by all of its instances.
+class Instance : public Primitive
+{
+public:
+    Instance(const Scene *group, const Transform &toWorld)
+	: Primitive(vec(1, 1, 1)), group(group), toWorld(toWorld) {};
+
+    const Scene *group;
+    Transform toWorld;
+};
+
 #endif
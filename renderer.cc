@@ -16,24 +16,43 @@
   with this program; if not, see <http://www.gnu.org/licenses/>. */
 
 #include <QDebug>
-#include <QThread>
+#include <QImage>
 
 #include <iostream>
 #include <vector>
-#include <unistd.h>
 
 #include "renderer.h"
+#include "stats.h"
+#include "threadpool.h"
 #include "vector.h"
 
-Worker::Worker(Renderer &renderer, int from, int step) 
-    : renderer(renderer),
-      from(from),
-      step(step)
+class RenderJob : public Job
 {
-}
+private:
+    Renderer &renderer;
+
+public:
+    RenderJob(Renderer &renderer) : renderer(renderer) {};
+
+    virtual void execute(int index, int thread) {
+	renderer.renderTile(index, thread);
+    };
+
+    virtual void completed(int index) {
+	// called on the thread which started the rendering, so it
+	// is safe for listeners to update widgets from here
+	RendererListener *listener = renderer.getListener();
+	if (listener) {
+	    int x0, y0, x1, y1;
+	    renderer.tileRect(index, x0, y0, x1, y1);
+	    listener->renderTile(renderer, x0, y0, x1 - x0, y1 - y0);
+	}
+    };
+};
 
 Renderer::Renderer(const Scene &scene, int width, int height)
-    : scene(scene), width(width), height(height), listener(0)
+    : scene(scene), width(width), height(height), samples(1), listener(0),
+      threadStats(1)
 {
     pixels = new vec[width * height];
     resetPixels();
@@ -54,22 +73,75 @@ void Renderer::resetPixels()
     }
 }
 
-void Worker::run()
+void Renderer::tileRect(int tile, int &x0, int &y0, int &x1, int &y1) const
 {
-    //std::cout << "Thread " << from << " started." << std::endl;
+    int tilesX = (width + tileSize - 1) / tileSize;
+    x0 = (tile % tilesX) * tileSize;
+    y0 = (tile / tilesX) * tileSize;
+    x1 = std::min(x0 + tileSize, width);
+    y1 = std::min(y0 + tileSize, height);
+}
 
-    const Scene &scene = renderer.getScene();
-    int width = renderer.getWidth();
-    int height = renderer.getHeight();
+void Renderer::renderTile(int tile, int thread)
+{
+    int x0, y0, x1, y1;
+    tileRect(tile, x0, y0, x1, y1);
+
+    // counted on the stack, the threads would share cache lines in
+    // threadStats otherwise
+    TraceContext context;
+
+    // primary rays of neighboring pixels are traced as one packet
+    std::vector<Ray> rays;
+    rays.reserve(packetSize * packetSize);
+    vec colors[packetSize * packetSize];
+    vec sum[packetSize * packetSize];
+
+    for (int by = y0; by < y1; by += packetSize) {
+	for (int bx = x0; bx < x1; bx += packetSize) {
+	    int ex = std::min(bx + packetSize, x1);
+	    int ey = std::min(by + packetSize, y1);
+	    int count = (ex - bx) * (ey - by);
+
+	    if (samples == 1) {
+		basis.rays(bx, by, ex, ey, rays);
+		scene.sendPacket(&rays[0], count, colors, context);
+	    } else {
+		for (int i = 0; i < count; i++)
+		    sum[i] = vec(0, 0, 0);
+		for (int s = 0; s < samples; s++) {
+		    basis.rays(bx, by, ex, ey, rays, s);
+		    scene.sendPacket(&rays[0], count, colors, context);
+		    for (int i = 0; i < count; i++)
+			sum[i] = sum[i] + colors[i].clamp();
+		}
+		for (int i = 0; i < count; i++)
+		    colors[i] = sum[i] / samples;
+	    }
 
-    for (int y = from; y < height; y += step) {
-	for (int x = 0; x < width; x++) {
-	    Ray ray(scene.camera->pos, scene.camera->dirVecFor(x, y, width, height));
-	    renderer.setPixel(x, y, scene.sendRay(ray));
+	    int i = 0;
+	    for (int y = by; y < ey; y++) {
+		for (int x = bx; x < ex; x++)
+		    setPixel(x, y, colors[i++]);
+	    }
 	}
     }
 
-    //std::cout << "Thread " << from << " finished." << std::endl;
+    threadStats[thread].add(context.stats);
+}
+
+QImage Renderer::toImage() const
+{
+    QImage image(width, height, QImage::Format_RGB32);
+    for (int y = 0; y < height; y++) {
+	for (int x = 0; x < width; x++) {
+	    const vec &pixel = pixels[width * y + x];
+	    image.setPixel(x, y, qRgb((int)(pixel.x * 255),
+				      (int)(pixel.y * 255),
+				      (int)(pixel.z * 255)));
+	}
+    }
+    return image;
 }
 
 void Renderer::render()
@@ -79,39 +151,19 @@ void Renderer::render()
 	exit(1);
     }
 
-    if (listener) listener->renderStart(*this);
-
-    const int thread_count = 4;
+    basis.setup(*scene.camera, width, height);
 
-    Worker **workers = new Worker*[thread_count];
-
-    for (int t = 0; t < thread_count; t++) {
-	Worker *worker = new Worker(*this, t + 1, thread_count + 1);
-	worker->start();
-	workers[t] = worker;
-    }
-
-    for (int y = 0; y < height; y += thread_count + 1) {
-	for (int x = 0; x < width; x++) {
-	    Ray ray(scene.camera->pos, scene.camera->dirVecFor(x, y, width, height));
-	    setPixel(x, y, scene.sendRay(ray));
-	}
-	if (listener) listener->renderLine(*this, y);
-    }
+    threadStats.assign(std::max(ThreadPool::instance().threadCount(), 1), RayStats());
 
+    if (listener) listener->renderStart(*this);
 
-    int count = thread_count;
-    while (count) {
-	for (int t = 0; t < thread_count; t++) {
-	    if (workers[t] && workers[t]->isFinished()) {
-		delete workers[t];
-		workers[t] = 0;
-		count--;
-	    }
-	}
+    RenderJob job(*this);
+    ThreadPool::instance().run(job, getTileCount());
 
-	usleep(200);
-    }
+    stats.clear();
+    for (unsigned int i = 0; i < threadStats.size(); i++)
+	stats.add(threadStats[i]);
+    if (listener) listener->renderStats(*this, stats);
 
     if (listener) listener->renderEnd(*this);
 }
@@ -18,12 +18,14 @@ with this program; if not, see <http://www.gnu.org/licenses/>. */
 #ifndef RENDERER_H
 #define RENDERER_H
 
-#include <QList>
-#include <QThread>
+#include <QImage>
 
 #include <cmath>
+#include <vector>
 
+#include "camera.h"
 #include "scene.h"
+#include "stats.h"
 
 class Renderer;
 
@@ -33,19 +35,11 @@ public:
     virtual ~RendererListener() {};
     virtual void renderStart(Renderer & /* renderer */) {};
     virtual void renderEnd(Renderer & /* renderer */) {};
-    virtual void renderLine(Renderer & /* renderer */, int /* line */) {};
-};
-
-class Worker : public QThread 
-{
-  private:
-    Renderer &renderer;
-    int from;
-    int step;
-
-  public:
-    Worker(Renderer &renderer, int from, int step);
-    void run();
+    virtual void renderTile(Renderer & /* renderer */, int /* x */, int /* y */,
+			    int /* width */, int /* height */) {};
+    // ray statistics of the finished rendering, before renderEnd
+    virtual void renderStats(Renderer & /* renderer */,
+			     const RayStats & /* stats */) {};
 };
 
 class Renderer
@@ -54,18 +48,39 @@ private:
     const Scene &scene;
     int width;
     int height;
+    int samples;
     RendererListener *listener;
+    CameraBasis basis;
+
+    std::vector<RayStats> threadStats;
+    RayStats stats;
 
     void resetPixels();
 
 public:
 
+    // the image is rendered in square tiles of this size
+    static const int tileSize = 32;
+
+    // primary rays are traced in packets of packetSize x packetSize
+    // pixels, see Scene::sendPacket
+    static const int packetSize = 8;
+
     vec *pixels;
 
     Renderer(const Scene &scene, int width, int height);
     virtual ~Renderer();
 
     void render();
+    // thread selects the statistics slot, see ThreadPool
+    void renderTile(int tile, int thread = 0);
+    QImage toImage() const;
+    void tileRect(int tile, int &x0, int &y0, int &x1, int &y1) const;
+
+    inline int getTileCount() const {
+	return ((width + tileSize - 1) / tileSize)
+	    * ((height + tileSize - 1) / tileSize);
+    };
 
     inline const vec getPixel(int x, int y) const {
         return pixels[width * y + x];
@@ -74,6 +89,16 @@ public:
         pixels[width * y + x] = d.clamp();
     };
 
+    // Samples per pixel. With more than one sample the rays are
+    // jittered inside the pixel and over the camera lens and the
+    // results are averaged.
+    inline void setSamples(int samples) {
+	this->samples = std::max(samples, 1);
+    };
+    inline int getSamples() const {
+	return samples;
+    };
+
     void setListener(RendererListener *listener) { 
 	this->listener = listener; 
     };
@@ -84,6 +109,13 @@ public:
     inline int getHeight() { 
 	return height; 
     };
+    // counters of the last render()
+    inline const RayStats &getStats() const {
+	return stats;
+    };
+    inline RendererListener *getListener() {
+	return listener;
+    };
     inline const Scene & getScene() {
 	return scene;
     }
@@ -17,16 +17,209 @@
 
 #include <QDebug>
 
+#include <algorithm>
+#include <cmath>
+#include <iostream>
 #include <vector>
 
+#include "bvh.h"
 #include "camera.h"
+#include "compressedbvh.h"
+#include "grid.h"
 #include "light.h"
+#include "packet.h"
+#include "planes.h"
 #include "primitives.h"
 #include "scene.h"
+#include "spheres.h"
+#include "stats.h"
+#include "triangles.h"
 #include "vector.h"
+#include "widebvh.h"
+
+// Tests the part of a SphereSet or TriangleSet a bvh leaf covers,
+// one ray at a time or a whole packet, and counts the tests.
+template <class Set>
+class SetLeaf
+{
+private:
+    const Ray *ray;
+    const Set &set;
+    RayStats &stats;
+
+public:
+    int hit;
+    int skip;
+
+    SetLeaf(const Set &set, RayStats &stats)
+	: ray(0), set(set), stats(stats), hit(-1), skip(-1) {};
+    SetLeaf(const Ray &ray, const Set &set, RayStats &stats, int skip = -1)
+	: ray(&ray), set(set), stats(stats), hit(-1), skip(skip) {};
+
+    // Switches a packet leaf to single rays and back
+    inline void setRay(const Ray &ray, int skip) {
+	this->ray = &ray;
+	this->skip = skip;
+	hit = -1;
+    };
+    inline void setRay() {
+	ray = 0;
+	skip = -1;
+	hit = -1;
+    };
+
+    inline void intersect(int begin, int end, float &tmax) {
+	STATS(stats.tests += end - begin);
+	int i = set.intersect(*ray, begin, end, tmax);
+	if (i >= 0)
+	    hit = i;
+    };
+
+    inline bool occluded(int begin, int end, float tmax) {
+	STATS(stats.tests += end - begin);
+	hit = set.occluder(*ray, begin, end, tmax, skip);
+	return hit >= 0;
+    };
+
+    inline void intersect(int begin, int end, RayPacket &packet) {
+	STATS(stats.tests += (end - begin) * packet.count);
+	set.intersect(packet, begin, end);
+    };
+
+    inline bool occluded(int begin, int end, RayPacket &packet) {
+	STATS(stats.tests += (end - begin) * packet.count);
+	return set.occluded(packet, begin, end);
+    };
+};
+
+// Tests the instances a bvh leaf covers by tracing the ray or the
+// packet through their groups in object space. A hit keeps the index
+// into the group's sets and gets the instance added.
+class InstanceLeaf
+{
+private:
+    const Ray *ray;
+    const std::vector<SceneInstance> &instances;
+    TraceContext &context;
+
+    // Rays of packet in the object space of instance, with tmax and
+    // scale[r] converting distances from world into object space
+    inline void objectRays(const SceneInstance &instance, const RayPacket &packet,
+			   RayPacket &local, float *scale) const {
+	for (int r = 0; r < packet.count; r++) {
+	    Ray ray = packet.ray(r);
+	    vec dir = instance.toObject.vector(ray.dir);
+	    scale[r] = dir.mag();
+	    local.add(Ray(instance.toObject.point(ray.pos), dir),
+		      packet.tmax[r] < 0 ? -1 : packet.tmax[r] * scale[r]);
+	}
+	local.finish();
+    };
+
+    // skip in the space of instance i
+    static inline Hit groupSkip(const Hit &skip, int i) {
+	Hit h;
+	if (skip.instance == i) {
+	    h = skip;
+	    h.instance = -1;
+	}
+	return h;
+    };
+
+public:
+    // single rays
+    Hit hit;
+    Hit skip;
+    // packets, one per ray
+    Hit *hits;
+    const Hit *skips;
+
+    InstanceLeaf(const Ray &ray, const std::vector<SceneInstance> &instances,
+		 TraceContext &context, const Hit &skip = Hit())
+	: ray(&ray), instances(instances), context(context), skip(skip),
+	  hits(0), skips(0) {};
+    InstanceLeaf(const std::vector<SceneInstance> &instances, Hit *hits,
+		 const Hit *skips, TraceContext &context)
+	: ray(0), instances(instances), context(context), hits(hits),
+	  skips(skips) {};
+
+    inline void intersect(int begin, int end, float &tmax) {
+	for (int i = begin; i < end; i++) {
+	    const SceneInstance &instance = instances[i];
+	    vec dir = instance.toObject.vector(ray->dir);
+	    float scale = dir.mag();
+	    Hit h;
+	    h.length = tmax * scale;
+	    if (instance.group->intersect(Ray(instance.toObject.point(ray->pos), dir),
+					  h, context)) {
+		tmax = h.length / scale;
+		hit = h;
+		hit.instance = i;
+		hit.length = tmax;
+	    }
+	}
+    };
+
+    inline bool occluded(int begin, int end, float tmax) {
+	// the last occluder is a sphere of the scene, not of the groups
+	int last = context.lastOccluder;
+	context.lastOccluder = -1;
+	bool blocked = false;
+	for (int i = begin; i < end && !blocked; i++) {
+	    const SceneInstance &instance = instances[i];
+	    vec dir = instance.toObject.vector(ray->dir);
+	    blocked = instance.group->occluded(Ray(instance.toObject.point(ray->pos), dir),
+					       tmax * dir.mag(), groupSkip(skip, i), context);
+	}
+	context.lastOccluder = last;
+	return blocked;
+    };
+
+    inline void intersect(int begin, int end, RayPacket &packet) {
+	for (int i = begin; i < end; i++) {
+	    RayPacket local;
+	    float scale[RayPacket::maxSize];
+	    Hit localHits[RayPacket::maxSize];
+	    objectRays(instances[i], packet, local, scale);
+	    instances[i].group->intersect(local, localHits, context);
+	    for (int r = 0; r < packet.count; r++) {
+		if (localHits[r].type != Hit::None) {
+		    packet.tmax[r] = local.tmax[r] / scale[r];
+		    hits[r] = localHits[r];
+		    hits[r].instance = i;
+		    hits[r].length = packet.tmax[r];
+		}
+	    }
+	}
+    };
+
+    inline bool occluded(int begin, int end, RayPacket &packet) {
+	int last = context.lastOccluder;
+	context.lastOccluder = -1;
+	for (int i = begin; i < end && packet.active(); i++) {
+	    RayPacket local;
+	    float scale[RayPacket::maxSize];
+	    Hit localSkips[RayPacket::maxSize];
+	    int blockers[RayPacket::maxSize];
+	    objectRays(instances[i], packet, local, scale);
+	    for (int r = 0; r < packet.count; r++)
+		localSkips[r] = groupSkip(skips[r], i);
+	    instances[i].group->occluded(local, localSkips, blockers, context);
+	    for (int r = 0; r < packet.count; r++) {
+		if (local.tmax[r] < 0)
+		    packet.tmax[r] = -1;
+	    }
+	}
+	context.lastOccluder = last;
+	return !packet.active();
+    };
+};
+
+Scene::Accelerator Scene::defaultAccelerator = Scene::Automatic;
 
 Scene::Scene()
-    : light(0), camera(0)
+    : accelerator(defaultAccelerator), built(WideTree), sphereBuildTime(0),
+      triangleBuildTime(0), instanceBuildTime(0), light(0), camera(0)
 {
 }
 
@@ -36,9 +229,620 @@ Scene::~Scene()
 	delete camera;
     for (PrimsIterator it = prims.begin(); it != prims.end(); it++)
 	delete *it;
+    for (unsigned int i = 0; i < groups.size(); i++)
+	delete groups[i];
+}
+
+void Scene::merge(Scene &other)
+{
+    prims.insert(prims.end(), other.prims.begin(), other.prims.end());
+    other.prims.clear();
+    bulkSpheres.insert(bulkSpheres.end(), other.bulkSpheres.begin(),
+		       other.bulkSpheres.end());
+    std::vector<SceneSphere>().swap(other.bulkSpheres);
+    groups.insert(groups.end(), other.groups.begin(), other.groups.end());
+    other.groups.clear();
+
+    if (other.camera) {
+	setCamera(other.camera);
+	other.camera = 0;
+    }
+    if (other.light) {
+	setLight(other.light);
+	other.light = 0;
+    }
+}
+
+void Scene::build()
+{
+    std::vector<Sphere *> sphereList;
+    std::vector<TriangleMesh *> meshList;
+    std::vector<Instance *> instanceList;
+    std::vector<BBox> boxes;
+
+    boxes.reserve(prims.size() + bulkSpheres.size());
+    planes.clear();
+    bounds = BBox();
+    for (PrimsIterator it = prims.begin(); it != prims.end(); it++) {
+	if (Sphere *sphere = dela::asType<Sphere>(*it)) {
+	    vec r(sphere->radius, sphere->radius, sphere->radius);
+	    sphereList.push_back(sphere);
+	    boxes.push_back(BBox(sphere->pos - r, sphere->pos + r));
+	    bounds.extend(boxes.back());
+	} else if (Plane *plane = dela::asType<Plane>(*it)) {
+	    planes.add(plane->pos, plane->normal, plane->getMirror());
+	} else if (TriangleMesh *mesh = dela::asType<TriangleMesh>(*it)) {
+	    meshList.push_back(mesh);
+	} else if (Instance *instance = dela::asType<Instance>(*it)) {
+	    instanceList.push_back(instance);
+	} else {
+	    qDebug() << "Scene::build error: Unknown primitive type";
+	    exit(1);
+	}
+    }
+
+    for (unsigned int i = 0; i < bulkSpheres.size(); i++) {
+	const SceneSphere &sphere = bulkSpheres[i];
+	vec r(sphere.radius, sphere.radius, sphere.radius);
+	boxes.push_back(BBox(sphere.pos - r, sphere.pos + r));
+	bounds.extend(boxes.back());
+    }
+
+    built = accelerator;
+    if (built == Automatic)
+	built = Grid::suits(boxes) ? UniformGrid : WideTree;
+
+    std::vector<BVHNode>().swap(sphereTree.nodes);
+    wideTree.nodes.clear();
+    compressedTree8.clear();
+    compressedTree16.clear();
+    grid.clear();
+
+    int buildTime = 0;
+    if (built == UniformGrid) {
+	grid.build(boxes);
+	buildTime = grid.buildTime;
+    } else {
+	sphereTree.build(boxes);
+	buildTime = sphereTree.buildTime;
+    }
+
+    if (built == CompressedTree8 || built == CompressedTree16) {
+	bool ok;
+	if (built == CompressedTree8) {
+	    ok = compressedTree8.build(sphereTree);
+	    buildTime += compressedTree8.buildTime;
+	} else {
+	    ok = compressedTree16.build(sphereTree);
+	    buildTime += compressedTree16.buildTime;
+	}
+	if (!ok) {
+	    std::cout << "BVH leaves are too large for compressed nodes, "
+		      << "using the wide tree." << std::endl;
+	    built = WideTree;
+	}
+    }
+    if (built == WideTree) {
+	wideTree.build(sphereTree);
+	buildTime += wideTree.buildTime;
+    }
+
+    // the compressed trees and the grid have their own item order
+    const std::vector<int> *order = &sphereTree.items;
+    if (built == CompressedTree8)
+	order = &compressedTree8.items;
+    else if (built == CompressedTree16)
+	order = &compressedTree16.items;
+    else if (built == UniformGrid)
+	order = &grid.items;
+    spheres.resize(boxes.size());
+    for (unsigned int i = 0; i < boxes.size(); i++) {
+	unsigned int item = (*order)[i];
+	if (item < sphereList.size()) {
+	    Sphere *sphere = sphereList[item];
+	    spheres.set(i, sphere->pos, sphere->radius, sphere->color,
+			sphere->getMirror());
+	} else {
+	    const SceneSphere &sphere = bulkSpheres[item - sphereList.size()];
+	    spheres.set(i, sphere.pos, sphere.radius, sphere.color, sphere.mirror);
+	}
+    }
+
+    // the spheres are in leaf order now, the item lists and the binary
+    // nodes of a collapsed tree are not needed anymore
+    std::vector<int>().swap(sphereTree.items);
+    std::vector<int>().swap(compressedTree8.items);
+    std::vector<int>().swap(compressedTree16.items);
+    std::vector<int>().swap(grid.items);
+    if (built != BinaryTree)
+	std::vector<BVHNode>().swap(sphereTree.nodes);
+
+    int triangleTime = buildTriangles(meshList);
+    int instanceTime = buildInstances(instanceList);
+
+    sphereBuildTime = buildTime;
+    triangleBuildTime = triangleTime;
+    instanceBuildTime = instanceTime;
+}
+
+int Scene::buildTriangles(const std::vector<TriangleMesh *> &meshes)
+{
+    // index of the first triangle of every mesh
+    std::vector<int> first(1, 0);
+    for (unsigned int m = 0; m < meshes.size(); m++)
+	first.push_back(first.back() + meshes[m]->triangleCount());
+
+    std::vector<BBox> boxes(first.back());
+    for (unsigned int m = 0; m < meshes.size(); m++) {
+	const TriangleMesh *mesh = meshes[m];
+	for (int t = 0; t < mesh->triangleCount(); t++) {
+	    BBox &box = boxes[first[m] + t];
+	    for (int k = 0; k < 3; k++)
+		box.extend(mesh->vertices[mesh->indices[3 * t + k]]);
+	    bounds.extend(box);
+	}
+    }
+
+    triangleTree.build(boxes);
+    int buildTime = triangleTree.buildTime;
+    std::vector<BBox>().swap(boxes);
+    wideTriangleTree.nodes.clear();
+    if (built != BinaryTree) {
+	wideTriangleTree.build(triangleTree);
+	buildTime += wideTriangleTree.buildTime;
+    }
+
+    triangles.resize(first.back());
+    triangles.meshColors.clear();
+    triangles.meshMirrors.clear();
+    for (unsigned int m = 0; m < meshes.size(); m++)
+	triangles.addMesh(meshes[m]->color, meshes[m]->getMirror());
+    for (int i = 0; i < triangles.size(); i++) {
+	int index = triangleTree.items[i];
+	int m = std::upper_bound(first.begin(), first.end(), index) - first.begin() - 1;
+	const TriangleMesh *mesh = meshes[m];
+	const int *v = &mesh->indices[3 * (index - first[m])];
+	triangles.set(i, mesh->vertices[v[0]], mesh->vertices[v[1]],
+		      mesh->vertices[v[2]], m);
+    }
+
+    std::vector<int>().swap(triangleTree.items);
+    if (built != BinaryTree)
+	std::vector<BVHNode>().swap(triangleTree.nodes);
+    return buildTime;
+}
+
+int Scene::buildInstances(const std::vector<Instance *> &placed)
+{
+    std::vector<BBox> boxes;
+    std::vector<const Instance *> used;
+    for (unsigned int i = 0; i < placed.size(); i++) {
+	const Scene *group = placed[i]->group;
+	if (group->planes.size()) {
+	    qDebug() << "Scene::build error: Groups with planes cannot be instanced";
+	    exit(1);
+	}
+	// an empty group is never hit
+	if (group->bounds.isEmpty())
+	    continue;
+	used.push_back(placed[i]);
+	boxes.push_back(placed[i]->toWorld.box(group->bounds));
+	bounds.extend(boxes.back());
+    }
+
+    instanceTree.build(boxes);
+    int buildTime = instanceTree.buildTime;
+    wideInstanceTree.nodes.clear();
+    if (built != BinaryTree) {
+	wideInstanceTree.build(instanceTree);
+	buildTime += wideInstanceTree.buildTime;
+    }
+
+    instances.resize(used.size());
+    for (unsigned int i = 0; i < used.size(); i++) {
+	const Instance *instance = used[instanceTree.items[i]];
+	instances[i].group = instance->group;
+	instances[i].toObject = instance->toWorld.inverse();
+    }
+
+    std::vector<int>().swap(instanceTree.items);
+    if (built != BinaryTree)
+	std::vector<BVHNode>().swap(instanceTree.nodes);
+    return buildTime;
+}
+
+SceneMemory Scene::memory() const
+{
+    SceneMemory m;
+    m.primitives = spheres.size();
+    m.geometry = spheres.memoryUsage();
+    m.hierarchy = sphereTree.memoryUsage() + wideTree.memoryUsage()
+	+ compressedTree8.memoryUsage() + compressedTree16.memoryUsage()
+	+ grid.memoryUsage();
+    m.nodeName = "nodes";
+    m.triangles = triangles.size();
+    m.meshes = triangles.memoryUsage() + triangleTree.memoryUsage()
+	+ wideTriangleTree.memoryUsage();
+    m.instances = instances.size();
+    m.groups = groups.size();
+    m.instancing = instances.capacity() * sizeof(SceneInstance)
+	+ instanceTree.memoryUsage() + wideInstanceTree.memoryUsage();
+    for (unsigned int i = 0; i < groups.size(); i++)
+	m.instancing += groups[i]->memory().total();
+    m.sphereTime = sphereBuildTime;
+    m.triangleTime = triangleBuildTime;
+    m.instanceTime = instanceBuildTime;
+
+    if (built == WideTree) {
+	m.accelerator = "wide BVH";
+	m.nodes = wideTree.nodes.size();
+	m.nodeSize = sizeof(WideBVHNode);
+    } else if (built == CompressedTree8) {
+	m.accelerator = "compressed 8 bit BVH";
+	m.nodes = compressedTree8.nodes.size();
+	m.nodeSize = sizeof(CompressedBVH<unsigned char>::Node);
+    } else if (built == CompressedTree16) {
+	m.accelerator = "compressed 16 bit BVH";
+	m.nodes = compressedTree16.nodes.size();
+	m.nodeSize = sizeof(CompressedBVH<unsigned short>::Node);
+    } else if (built == UniformGrid) {
+	m.accelerator = "uniform grid";
+	m.nodes = grid.cellCount();
+	m.nodeSize = sizeof(int);
+	m.nodeName = "cells";
+    } else {
+	m.accelerator = "binary BVH";
+	m.nodes = sphereTree.nodes.size();
+	m.nodeSize = sizeof(BVHNode);
+    }
+    return m;
+}
+
+void SceneMemory::report(std::ostream &out) const
+{
+    const double count = std::max(primitives, 1);
+    out << "Memory (" << accelerator << "): " << primitives
+	<< " primitives, " << nodes << " " << nodeName << " of " << nodeSize
+	<< " bytes" << std::endl
+	<< "  hierarchy: " << hierarchy / 1024 << " KB, "
+	<< hierarchy / count << " bytes per primitive" << std::endl
+	<< "  spheres:   " << geometry / 1024 << " KB, "
+	<< geometry / count << " bytes per primitive" << std::endl;
+    if (triangles)
+	out << "  meshes:    " << meshes / 1024 << " KB, "
+	    << meshes / double(triangles) << " bytes per triangle" << std::endl;
+    if (instances)
+	out << "  instances: " << instancing / 1024 << " KB for " << instances
+	    << " instances of " << groups << " groups, "
+	    << instancing / double(instances) << " bytes per instance" << std::endl;
+    out << "  total:     " << total() / 1024 << " KB, "
+	<< total() / double(std::max(primitives + triangles + instances, 1))
+	<< " bytes per primitive" << std::endl;
+    out << "  built in:  " << sphereTime << " ms spheres";
+    if (triangles)
+	out << ", " << triangleTime << " ms triangles";
+    if (instances)
+	out << ", " << instanceTime << " ms instances";
+    out << std::endl;
+}
+
+template <class Leaf>
+void Scene::intersectSpheres(const Ray &ray, float &tmax, Leaf &leaf) const
+{
+    if (built == WideTree)
+	wideTree.intersect(ray, tmax, leaf);
+    else if (built == CompressedTree8)
+	compressedTree8.intersect(ray, tmax, leaf);
+    else if (built == CompressedTree16)
+	compressedTree16.intersect(ray, tmax, leaf);
+    else if (built == UniformGrid)
+	grid.intersect(ray, tmax, leaf);
+    else
+	sphereTree.intersect(ray, tmax, leaf);
+}
+
+template <class Leaf>
+bool Scene::occludedSpheres(const Ray &ray, float tmax, Leaf &leaf) const
+{
+    if (built == WideTree)
+	return wideTree.occluded(ray, tmax, leaf);
+    else if (built == CompressedTree8)
+	return compressedTree8.occluded(ray, tmax, leaf);
+    else if (built == CompressedTree16)
+	return compressedTree16.occluded(ray, tmax, leaf);
+    else if (built == UniformGrid)
+	return grid.occluded(ray, tmax, leaf);
+    return sphereTree.occluded(ray, tmax, leaf);
+}
+
+template <class Leaf>
+void Scene::intersectSpheres(RayPacket &packet, Leaf &leaf) const
+{
+    if (built == WideTree)
+	wideTree.intersect(packet, leaf);
+    else if (built == CompressedTree8)
+	compressedTree8.intersect(packet, leaf);
+    else if (built == CompressedTree16)
+	compressedTree16.intersect(packet, leaf);
+    else if (built == UniformGrid)
+	grid.intersect(packet, leaf);
+    else
+	sphereTree.intersect(packet, leaf);
+}
+
+template <class Leaf>
+void Scene::occludedSpheres(RayPacket &packet, Leaf &leaf) const
+{
+    if (built == WideTree)
+	wideTree.occluded(packet, leaf);
+    else if (built == CompressedTree8)
+	compressedTree8.occluded(packet, leaf);
+    else if (built == CompressedTree16)
+	compressedTree16.occluded(packet, leaf);
+    else if (built == UniformGrid)
+	grid.occluded(packet, leaf);
+    else
+	sphereTree.occluded(packet, leaf);
+}
+
+template <class Leaf>
+void Scene::intersectTree(const BVH &tree, const WideBVH &wide, const Ray &ray,
+			  float &tmax, Leaf &leaf) const
+{
+    if (built == BinaryTree)
+	tree.intersect(ray, tmax, leaf);
+    else
+	wide.intersect(ray, tmax, leaf);
 }
 
-vec Scene::sendRay(Ray ray, int count) const
+template <class Leaf>
+bool Scene::occludedTree(const BVH &tree, const WideBVH &wide, const Ray &ray,
+			 float tmax, Leaf &leaf) const
+{
+    if (built == BinaryTree)
+	return tree.occluded(ray, tmax, leaf);
+    return wide.occluded(ray, tmax, leaf);
+}
+
+template <class Leaf>
+void Scene::intersectTree(const BVH &tree, const WideBVH &wide, RayPacket &packet,
+			  Leaf &leaf) const
+{
+    if (built == BinaryTree)
+	tree.intersect(packet, leaf);
+    else
+	wide.intersect(packet, leaf);
+}
+
+template <class Leaf>
+void Scene::occludedTree(const BVH &tree, const WideBVH &wide, RayPacket &packet,
+			 Leaf &leaf) const
+{
+    if (built == BinaryTree)
+	tree.occluded(packet, leaf);
+    else
+	wide.occluded(packet, leaf);
+}
+
+bool Scene::intersect(const Ray &ray, Hit &hit, TraceContext &context) const
+{
+    bool found = false;
+
+    // planes first, they often limit the bvh traversal
+    STATS(context.stats.tests += planes.size());
+    int index = planes.intersect(ray, 0, planes.size(), hit.length);
+    if (index >= 0) {
+	hit.type = Hit::PlaneHit;
+	hit.index = index;
+	hit.instance = -1;
+	found = true;
+    }
+
+    SetLeaf<SphereSet> leaf(ray, spheres, context.stats);
+    intersectSpheres(ray, hit.length, leaf);
+    if (leaf.hit >= 0) {
+	hit.type = Hit::SphereHit;
+	hit.index = leaf.hit;
+	hit.instance = -1;
+	found = true;
+    }
+
+    SetLeaf<TriangleSet> triangleLeaf(ray, triangles, context.stats);
+    intersectTree(triangleTree, wideTriangleTree, ray, hit.length, triangleLeaf);
+    if (triangleLeaf.hit >= 0) {
+	hit.type = Hit::TriangleHit;
+	hit.index = triangleLeaf.hit;
+	hit.instance = -1;
+	found = true;
+    }
+
+    if (instances.size()) {
+	InstanceLeaf instanceLeaf(ray, instances, context);
+	intersectTree(instanceTree, wideInstanceTree, ray, hit.length, instanceLeaf);
+	if (instanceLeaf.hit.type != Hit::None) {
+	    hit = instanceLeaf.hit;
+	    found = true;
+	}
+    }
+
+    return found;
+}
+
+bool Scene::occluded(const Ray &ray, float tmax, const Hit &skip,
+		     TraceContext &context) const
+{
+    // a surface inside an instance is skipped by the InstanceLeaf
+    bool here = skip.instance < 0;
+    int skipSphere = here && skip.type == Hit::SphereHit ? skip.index : -1;
+
+    // neighboring shadow rays are mostly blocked by the same sphere
+    int last = context.lastOccluder;
+    if (last >= 0 && last != skipSphere) {
+	STATS(context.stats.tests++);
+	if (spheres.occluded(ray, last, last + 1, tmax))
+	    return true;
+    }
+
+    STATS(context.stats.tests += planes.size());
+    if (planes.occluded(ray, 0, planes.size(), tmax,
+			here && skip.type == Hit::PlaneHit ? skip.index : -1))
+	return true;
+
+    SetLeaf<SphereSet> leaf(ray, spheres, context.stats, skipSphere);
+    if (occludedSpheres(ray, tmax, leaf)) {
+	context.lastOccluder = leaf.hit;
+	return true;
+    }
+
+    SetLeaf<TriangleSet> triangleLeaf(ray, triangles, context.stats,
+				      here && skip.type == Hit::TriangleHit ? skip.index : -1);
+    if (occludedTree(triangleTree, wideTriangleTree, ray, tmax, triangleLeaf))
+	return true;
+
+    if (instances.empty())
+	return false;
+    InstanceLeaf instanceLeaf(ray, instances, context, skip);
+    return occludedTree(instanceTree, wideInstanceTree, ray, tmax, instanceLeaf);
+}
+
+// Moves the hits a set left in packet.hit into hits
+static inline void takeHits(RayPacket &packet, Hit *hits, Hit::Type type)
+{
+    for (int i = 0; i < packet.count; i++) {
+	if (packet.hit[i] >= 0) {
+	    hits[i].type = type;
+	    hits[i].index = packet.hit[i];
+	    hits[i].instance = -1;
+	    packet.hit[i] = -1;
+	}
+    }
+}
+
+void Scene::intersect(RayPacket &packet, Hit *hits, TraceContext &context) const
+{
+    // planes first, like the single ray intersect() does
+    STATS(context.stats.tests += planes.size() * packet.count);
+    planes.intersect(packet, 0, planes.size());
+    takeHits(packet, hits, Hit::PlaneHit);
+
+    SetLeaf<SphereSet> leaf(spheres, context.stats);
+    intersectSpheres(packet, leaf);
+    takeHits(packet, hits, Hit::SphereHit);
+
+    SetLeaf<TriangleSet> triangleLeaf(triangles, context.stats);
+    intersectTree(triangleTree, wideTriangleTree, packet, triangleLeaf);
+    takeHits(packet, hits, Hit::TriangleHit);
+
+    if (instances.size()) {
+	InstanceLeaf instanceLeaf(instances, hits, 0, context);
+	intersectTree(instanceTree, wideInstanceTree, packet, instanceLeaf);
+    }
+
+    for (int i = 0; i < packet.count; i++) {
+	if (hits[i].type != Hit::None)
+	    hits[i].length = packet.tmax[i];
+    }
+}
+
+void Scene::occluded(RayPacket &shadows, const Hit *skip, int *blockers,
+		     TraceContext &context) const
+{
+    const int count = shadows.count;
+    for (int i = 0; i < count; i++) {
+	shadows.skip[i] = skip[i].type == Hit::SphereHit && skip[i].instance < 0
+	    ? skip[i].index : -1;
+    }
+
+    // all shadow rays end at the light, so they are coherent too. The
+    // sphere which blocked the last packet is tested first.
+    int last = context.lastOccluder;
+    bool done = false;
+    if (last >= 0) {
+	STATS(context.stats.tests += count);
+	done = spheres.occluded(shadows, last, last + 1);
+    }
+    SetLeaf<SphereSet> leaf(spheres, context.stats);
+    if (!done)
+	occludedSpheres(shadows, leaf);
+
+    // the triangles skip the triangle a ray starts on instead
+    for (int i = 0; i < count; i++) {
+	blockers[i] = shadows.tmax[i] < 0 ? shadows.hit[i] : -1;
+	shadows.skip[i] = skip[i].type == Hit::TriangleHit && skip[i].instance < 0
+	    ? skip[i].index : -1;
+    }
+    if (triangles.size() && shadows.active()) {
+	SetLeaf<TriangleSet> triangleLeaf(triangles, context.stats);
+	occludedTree(triangleTree, wideTriangleTree, shadows, triangleLeaf);
+    }
+
+    if (instances.size() && shadows.active()) {
+	InstanceLeaf instanceLeaf(instances, 0, skip, context);
+	occludedTree(instanceTree, wideInstanceTree, shadows, instanceLeaf);
+    }
+
+    // the few planes are tested per ray
+    for (int i = 0; i < count; i++) {
+	if (shadows.tmax[i] < 0)
+	    continue;
+	STATS(context.stats.tests += planes.size());
+	if (planes.occluded(shadows.ray(i), 0, planes.size(), shadows.tmax[i],
+			    skip[i].type == Hit::PlaneHit ? skip[i].index : -1))
+	    shadows.tmax[i] = -1;
+    }
+}
+
+void Scene::sendPacket(const Ray *rays, int count, vec *colors,
+		       TraceContext &context) const
+{
+    if (!light) {
+	qDebug() << "Scene::sendPacket error: No light defined";
+	exit(1);
+    }
+
+    Hit hits[RayPacket::maxSize];
+    RayPacket packet;
+
+    for (int i = 0; i < count; i++)
+	packet.add(rays[i], HUGE_VALF);
+    packet.finish();
+    STATS(context.stats.primaryRays += count);
+    STATS(context.stats.depth[0] += count);
+
+    intersect(packet, hits, context);
+
+    RayPacket shadows;
+    for (int i = 0; i < count; i++) {
+	if (hits[i].type != Hit::None) {
+	    STATS(context.stats.shadowRays++);
+	    vec p = (rays[i].dir * hits[i].length) + rays[i].pos;
+	    vec toLight = light->pos - p;
+	    shadows.add(Ray(p, toLight), toLight.mag());
+	} else {
+	    shadows.add(rays[i], -1);
+	}
+    }
+    shadows.finish();
+
+    int blockers[RayPacket::maxSize];
+    occluded(shadows, hits, blockers, context);
+
+    for (int i = 0; i < count; i++) {
+	const Hit &hit = hits[i];
+	if (hit.type == Hit::None) {
+	    colors[i] = background(rays[i]);
+	    continue;
+	}
+
+	if (blockers[i] >= 0)
+	    context.lastOccluder = blockers[i];
+
+	// mirror bounces diverge, shade() follows them with single rays
+	colors[i] = shade(rays[i], hit, shadows.tmax[i] < 0, 0, context);
+    }
+}
+
+vec Scene::sendRay(Ray ray, TraceContext &context, int count) const
 {
     if (!light) {
 	qDebug() << "Scene::sendRay error: No light defined";
@@ -46,23 +850,18 @@ vec Scene::sendRay(Ray ray, int count) const
     }
 
     if (count > 100) {
+	STATS(context.stats.infiniteMirrors++);
 	std::cout << "Infinity mirror..." << std::endl;
 	return vec(0.0, 1.0, 1.0);
     }
-  
-    Primitive *prim = 0;
-    float length  = -1;
-    for (PrimsIterator it = prims.begin(); it != prims.end(); it++) {
-	float len = (*it)->intercept(ray);
-	if ( (len > 0.0001) && ((length < 0) || (len < length)) ) {
-	    prim = *it;
-	    length = len;
-	}
-    }
-  
-    if (prim) {
+
+    STATS(count ? context.stats.mirrorRays++ : context.stats.primaryRays++);
+    STATS(context.stats.countDepth(count));
+
+    Hit hit;
+    if (intersect(ray, hit, context)) {
 	// hit point in world coordinates
-	vec p = (ray.dir * length) + ray.pos;
+	vec p = (ray.dir * hit.length) + ray.pos;
     
 	// vector from hit point to light
 	vec toLight = light->pos - p;
@@ -70,62 +869,104 @@ vec Scene::sendRay(Ray ray, int count) const
 	// Cast ray from hit point to light source,
 	// and check if object is between them...
 	Ray sray(p, toLight);
-	bool hit = false;
-	for (PrimsIterator it = prims.begin(); it != prims.end(); it++) {
-	    if (*it == prim)
-		continue;
-	    if ((*it)->intercept(sray) > 0) {
-		hit = true;
-		break;
-	    }
-	}
+	STATS(context.stats.shadowRays++);
+	bool shadow = occluded(sray, toLight.mag(), hit, context);
 
-	// normalized vector from hitpoint to viewer...
-	vec v = (ray.dir * -1).normal();
-    
-	// normalized vector from hitpoint to light...
-	vec l = light->pos - p;
-	float len = l.mag(); // length needed for i below
-	l = l.normal();
+	return shade(ray, hit, shadow, count, context);
+    } else {
+	return background(ray);
+    }
+}
+
+vec Scene::shade(const Ray &ray, const Hit &hit, bool shadow, int count,
+		 TraceContext &context) const
+{
+    // hit point in world coordinates
+    vec p = (ray.dir * hit.length) + ray.pos;
+
+    // normal vector, color and mirror factor for hitpoint...
+    vec n, color;
+    float mirror;
+    bool twoSided;
+    if (hit.instance >= 0) {
+	const SceneInstance &instance = instances[hit.instance];
+	twoSided = instance.group->surface(hit, instance.toObject.point(p), n,
+					   color, mirror);
+	// normals transform with the transposed inverse
+	n = instance.toObject.transposed(n);
+    } else {
+	twoSided = surface(hit, p, n, color, mirror);
+    }
+    n = n.normal();
+    if (twoSided && n.dot(ray.dir) > 0)
+	n = n * -1;
+
+    // normalized vector from hitpoint to viewer...
+    vec v = (ray.dir * -1).normal();
     
-	// normal vector for hitpoint...
-	vec n = prim->normalAt(p).normal();
+    // normalized vector from hitpoint to light...
+    vec l = light->pos - p;
+    float len = l.mag(); // length needed for i below
+    l = l.normal();
     
-	// halfway vector between view and light vector...
-	vec h = (v + l).normal();
+    // halfway vector between view and light vector...
+    vec h = (v + l).normal();
     
-	float i = std::max(1.0 - (len / light->power), 0.0);
+    float i = std::max(1.0 - (len / light->power), 0.0);
     
-	vec col;
+    vec col;
 	
-	if (hit)
-	    col = prim->colorAt(p)
-		* vec(.1, .1, .1);
-	else
-	    col = prim->colorAt(p)
-		* light->color
-		* i
-		* ldexp(std::max(n.dot(h), 0.0f), 3);
+    if (shadow)
+	col = color
+	    * vec(.1, .1, .1);
+    else
+	col = color
+	    * light->color
+	    * i
+	    * ldexp(std::max(n.dot(h), 0.0f), 3);
     
-	if (prim->getMirror() == 0.0) {
-	    return col;
-	} else {
-	    float x = ray.dir.x;
-	    float y = ray.dir.y;
-	    float z = ray.dir.z;
+    if (mirror == 0.0) {
+	return col;
+    } else {
+	float x = ray.dir.x;
+	float y = ray.dir.y;
+	float z = ray.dir.z;
       
-	    vec mirrorRayTo((x*(1-2*n.x*n.x) + -2*y*n.x*n.y     + -2*z*n.x*n.z),
-			    (-2*x*n.y*n.x    +  y*(1-2*n.y*n.y) + -2*z*n.y*n.z),
-			    (-2*x*n.z*n.x    + -2*y*n.z*n.y     + z*(1-2*n.z*n.z)));
+	vec mirrorRayTo((x*(1-2*n.x*n.x) + -2*y*n.x*n.y     + -2*z*n.x*n.z),
+			(-2*x*n.y*n.x    +  y*(1-2*n.y*n.y) + -2*z*n.y*n.z),
+			(-2*x*n.z*n.x    + -2*y*n.z*n.y     + z*(1-2*n.z*n.z)));
       
-	    return 
-		sendRay( Ray(p, mirrorRayTo), count+1) * prim->getMirror()
-		+ col * (1.0 - prim->getMirror());
-	}
-    } else {
-	// calculate world color...
-	vec q = ray.dir * 100;
-	float fac = q.y / 20.0;
-	return vec(1.0 - (0.4 * fac), 1.0 - (0.2 * fac), 1.0);
+	return 
+	    sendRay( Ray(p, mirrorRayTo), context, count+1) * mirror
+	    + col * (1.0 - mirror);
     }
 }
+
+bool Scene::surface(const Hit &hit, const vec &p, vec &normal, vec &color,
+		    float &mirror) const
+{
+    if (hit.type == Hit::SphereHit)
+	return surface(spheres, hit.index, p, normal, color, mirror);
+    else if (hit.type == Hit::TriangleHit)
+	return surface(triangles, hit.index, p, normal, color, mirror);
+    else
+	return surface(planes, hit.index, p, normal, color, mirror);
+}
+
+template <class Set>
+bool Scene::surface(const Set &set, int index, const vec &p, vec &normal,
+		    vec &color, float &mirror) const
+{
+    normal = set.normalAt(index, p);
+    color = set.colorAt(index, p);
+    mirror = set.mirrorAt(index);
+    return Set::twoSided;
+}
+
+vec Scene::background(const Ray &ray) const
+{
+    // calculate world color...
+    vec q = ray.dir * 100;
+    float fac = q.y / 20.0;
+    return vec(1.0 - (0.4 * fac), 1.0 - (0.2 * fac), 1.0);
+}
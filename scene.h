@@ -18,21 +18,213 @@
 #ifndef SCENE_H
 #define SCENE_H
 
+#include <iostream>
 #include <vector>
 
+#include "bvh.h"
 #include "camera.h"
+#include "compressedbvh.h"
+#include "grid.h"
 #include "light.h"
+#include "planes.h"
+#include "spheres.h"
+#include "stats.h"
+#include "transform.h"
+#include "triangles.h"
 #include "vector.h"
+#include "widebvh.h"
 #include "dela.h"
 
+class Instance;
 class Primitive;
+class Scene;
+class TriangleMesh;
 class Ray;
 
 typedef std::vector<Primitive*> Prims;
 typedef Prims::const_iterator PrimsIterator;
 
+struct Hit
+{
+    enum Type { None, SphereHit, PlaneHit, TriangleHit };
+
+    Type type;
+    int index;		// into Scene::spheres, planes or triangles
+    int instance;	// whose group was hit, or -1
+    float length;
+
+    Hit() : type(None), index(-1), instance(-1), length(HUGE_VALF) {};
+};
+
+// A sphere added by Scene::addSphere() instead of as a primitive
+struct SceneSphere
+{
+    vec pos;
+    float radius;
+    vec color;
+    float mirror;
+};
+
+// A group placed by an Instance, as the instance tree stores it
+struct SceneInstance
+{
+    const Scene *group;
+    Transform toObject;
+};
+
+// What one render thread keeps while tracing: its ray counters and
+// the sphere which blocked the last shadow ray. Neighboring shadow
+// rays are likely blocked by the same sphere, so it is tested first.
+struct TraceContext
+{
+    RayStats stats;
+    int lastOccluder;
+
+    TraceContext() : lastOccluder(-1) {};
+};
+
+// Memory held by a built Scene for its spheres, meshes and instances
+struct SceneMemory
+{
+    const char *accelerator;
+    int primitives;
+    // nodes of a hierarchy or cells of a grid, see nodeName
+    int nodes;
+    int nodeSize;
+    const char *nodeName;
+    // nodes, cells and item lists of the acceleration structure
+    unsigned long hierarchy;
+    // sphere arrays
+    unsigned long geometry;
+    // triangle arrays and their BVH
+    int triangles;
+    unsigned long meshes;
+    // instances, their BVH and the groups they place; every group is
+    // counted once
+    int instances;
+    int groups;
+    unsigned long instancing;
+    // milliseconds build() took, without the groups
+    int sphereTime;
+    int triangleTime;
+    int instanceTime;
+
+    inline unsigned long total() const {
+	return hierarchy + geometry + meshes + instancing;
+    };
+
+    // Human readable summary with bytes per primitive
+    void report(std::ostream &out) const;
+};
+
 class Scene : public dela::Scriptable
 {
+public:
+    // Acceleration structure of the spheres: a BVH with binary nodes,
+    // WideBVH::width children per node collapsed from the binary one,
+    // or the same with child bounds compressed to 8 or 16 bits; or a
+    // uniform grid. Automatic picks the grid where Grid::suits the
+    // spheres and the wide BVH otherwise.
+    enum Accelerator { BinaryTree, WideTree, CompressedTree8, CompressedTree16,
+		       UniformGrid, Automatic };
+
+private:
+    static Accelerator defaultAccelerator;
+    Accelerator accelerator;
+    // the one build() chose
+    Accelerator built;
+    // milliseconds the last build() took, see SceneMemory
+    int sphereBuildTime;
+    int triangleBuildTime;
+    int instanceBuildTime;
+
+    // Spheres added in bulk, build() places them after the Sphere
+    // primitives
+    std::vector<SceneSphere> bulkSpheres;
+
+    // Spheres as SIMD arrays in the order of the sphereTree leaves
+    SphereSet spheres;
+    BVH sphereTree;
+    WideBVH wideTree;
+    CompressedBVH<unsigned char> compressedTree8;
+    CompressedBVH<unsigned short> compressedTree16;
+    Grid grid;
+
+    PlaneSet planes;
+
+    // Triangles of all meshes in the order of the triangleTree leaves.
+    // The tree is collapsed into wideTriangleTree unless BinaryTree
+    // is asked for.
+    TriangleSet triangles;
+    BVH triangleTree;
+    WideBVH wideTriangleTree;
+
+    // Instances in the order of the instanceTree leaves, which is
+    // collapsed like the triangleTree. The groups are owned here.
+    std::vector<SceneInstance> instances;
+    BVH instanceTree;
+    WideBVH wideInstanceTree;
+    std::vector<Scene *> groups;
+
+    // of the spheres and triangles, for instances of this scene
+    BBox bounds;
+
+    // Traversal of the structure chosen by build()
+    template <class Leaf>
+    void intersectSpheres(const Ray &ray, float &tmax, Leaf &leaf) const;
+    template <class Leaf>
+    bool occludedSpheres(const Ray &ray, float tmax, Leaf &leaf) const;
+    template <class Leaf>
+    void intersectSpheres(RayPacket &packet, Leaf &leaf) const;
+    template <class Leaf>
+    void occludedSpheres(RayPacket &packet, Leaf &leaf) const;
+    // Traversal of the triangle or instance tree, the binary one or
+    // the wide one depending on what build() chose
+    template <class Leaf>
+    void intersectTree(const BVH &tree, const WideBVH &wide, const Ray &ray,
+		       float &tmax, Leaf &leaf) const;
+    template <class Leaf>
+    bool occludedTree(const BVH &tree, const WideBVH &wide, const Ray &ray,
+		      float tmax, Leaf &leaf) const;
+    template <class Leaf>
+    void intersectTree(const BVH &tree, const WideBVH &wide, RayPacket &packet,
+		       Leaf &leaf) const;
+    template <class Leaf>
+    void occludedTree(const BVH &tree, const WideBVH &wide, RayPacket &packet,
+		      Leaf &leaf) const;
+
+    // Fill triangles, instances and their trees, return the build time
+    int buildTriangles(const std::vector<TriangleMesh *> &meshes);
+    int buildInstances(const std::vector<Instance *> &placed);
+
+    // Nearest hit closer than hit.length
+    bool intersect(const Ray &ray, Hit &hit, TraceContext &context) const;
+    // Any hit between the ray origin and tmax except skip
+    bool occluded(const Ray &ray, float tmax, const Hit &skip,
+		  TraceContext &context) const;
+
+    // Packet versions for the first packet.count rays. intersect()
+    // lowers packet.tmax and fills hits. occluded() sets packet.tmax
+    // of the blocked rays to -1, skip[i] is the surface ray i starts
+    // on and blockers[i] the sphere which blocked it, or -1.
+    void intersect(RayPacket &packet, Hit *hits, TraceContext &context) const;
+    void occluded(RayPacket &packet, const Hit *skip, int *blockers,
+		  TraceContext &context) const;
+
+    vec shade(const Ray &ray, const Hit &hit, bool shadow, int count,
+	      TraceContext &context) const;
+    // Unnormalized normal, color and mirror factor at point p of the
+    // group space; returns whether both sides are lit
+    bool surface(const Hit &hit, const vec &p, vec &normal, vec &color,
+		 float &mirror) const;
+    template <class Set>
+    bool surface(const Set &set, int index, const vec &p, vec &normal,
+		 vec &color, float &mirror) const;
+    vec background(const Ray &ray) const;
+
+    friend class InstanceLeaf;
+    friend class SceneFile;
+
 public:
     Prims prims;
     Light *light;
@@ -41,9 +233,55 @@ public:
     Scene();
     virtual ~Scene();
 
-    vec sendRay(Ray ray, int counter = 0) const;
+    // Compile the primitives into flat arrays and build the
+    // acceleration structure. Has to be called after all primitives
+    // are added and before rendering.
+    void build();
+
+    // Accelerator for scenes created from now on, e.g. by the
+    // command line before the scene file is loaded
+    static inline void setDefaultAccelerator(Accelerator a) {
+	defaultAccelerator = a;
+    };
+    inline Accelerator getAccelerator() const {
+	return accelerator;
+    };
+    // never Automatic
+    inline Accelerator getBuiltAccelerator() const {
+	return built;
+    };
+    // takes effect with the next build()
+    inline void setAccelerator(Accelerator a) {
+	accelerator = a;
+    };
+
+    // Size of the data built by build()
+    SceneMemory memory() const;
+
+    // The context must not be shared between threads.
+    vec sendRay(Ray ray, TraceContext &context, int counter = 0) const;
+
+    // Traces up to RayPacket::maxSize coherent rays together, e.g. the
+    // primary rays of a block of pixels. Writes one color per ray.
+    void sendPacket(const Ray *rays, int count, vec *colors,
+		    TraceContext &context) const;
 
     inline void addPrimitive(Primitive *p) { prims.push_back(p); };
+    // Spheres without a primitive each, for generators of many of
+    // them; reserve room for count more first
+    inline void reserveSpheres(int count) {
+	bulkSpheres.reserve(bulkSpheres.size() + count);
+    };
+    inline void addSphere(const vec &pos, float radius, const vec &color,
+			  float mirror = 0.3) {
+	SceneSphere s = { pos, radius, color, mirror };
+	bulkSpheres.push_back(s);
+    };
+    // Moves the primitives, spheres, groups, camera and light of other,
+    // which is not built, into this scene and leaves other empty
+    void merge(Scene &other);
+    // A group to be placed by instances, deleted with the scene
+    inline void addGroup(Scene *group) { groups.push_back(group); };
     inline void setCamera(Camera *c) {
 	if (camera) delete camera;
 	camera = c;
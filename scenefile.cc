@@ -0,0 +1,443 @@
+/*funray - yet another raytracer
+Copyright (C) 2008  Christian Zeller (chrizel@gmail.com) and
+		    Simon Goller (neosam@gmail.com).
+
+This program is free software; you can redistribute it and/or modify 
+it under the terms of the GNU General Public License as published 
+by the Free Software Foundation; either version 3 of the License, 
+or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful, but 
+WITHOUT ANY WARRANTY; without even the implied warranty of 
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License along 
+with this program; if not, see <http://www.gnu.org/licenses/>. */
+
+
+#include <QCryptographicHash>
+#include <QDateTime>
+#include <QDebug>
+#include <QFile>
+#include <QFileInfo>
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <vector>
+
+#include "camera.h"
+#include "light.h"
+#include "scene.h"
+#include "scenefile.h"
+
+static const char magic[8] = { 'f', 'u', 'n', 'r', 'a', 'y', 's', 'c' };
+
+struct SceneFileHeader
+{
+    char magic[8];
+    qint32 version;
+    // Scene::Accelerator the scene was built for
+    qint32 accelerator;
+    char source[20];
+    // of the whole file, a shorter one was not written completely
+    qint64 size;
+};
+
+// Appends values and arrays to a compiled scene. An array is stored as
+// its length and element size followed by the elements.
+class SceneWriter
+{
+private:
+    QFile &file;
+
+public:
+    bool ok;
+
+    SceneWriter(QFile &file) : file(file), ok(true) {};
+
+    inline void bytes(const void *data, qint64 size) {
+	if (ok && size > 0)
+	    ok = file.write((const char *)data, size) == size;
+    };
+
+    template <class T>
+    inline void value(const T &v) {
+	bytes(&v, sizeof(T));
+    };
+
+    template <class T>
+    inline void array(const T *data, int count) {
+	qint32 header[2] = { count, sizeof(T) };
+	bytes(header, sizeof(header));
+	bytes(data, (qint64)count * sizeof(T));
+    };
+
+    template <class T>
+    inline void array(const std::vector<T> &v) {
+	array(v.empty() ? 0 : &v[0], v.size());
+    };
+};
+
+// Reads what SceneWriter wrote from the mapped file. Any mismatch,
+// like an element size of another build, clears ok.
+class SceneReader
+{
+private:
+    const uchar *pos;
+    const uchar *end;
+
+    // Length of the next array, which has to be count unless count < 0
+    template <class T>
+    inline int length(int count) {
+	qint32 header[2];
+	if (!bytes(header, sizeof(header)) || header[1] != (qint32)sizeof(T)
+	    || header[0] < 0 || (count >= 0 && header[0] != count)
+	    || (qint64)(header[0] * sizeof(T)) > end - pos) {
+	    ok = false;
+	    return 0;
+	}
+	return header[0];
+    };
+
+public:
+    bool ok;
+
+    SceneReader(const uchar *data, qint64 size)
+	: pos(data), end(data + size), ok(true) {};
+
+    inline bool bytes(void *data, qint64 size) {
+	if (!ok || end - pos < size) {
+	    ok = false;
+	    return false;
+	}
+	memcpy(data, pos, size);
+	pos += size;
+	return true;
+    };
+
+    template <class T>
+    inline void value(T &v) {
+	bytes(&v, sizeof(T));
+    };
+
+    // Reads a length and checks that the file has at least that many
+    // elements of size bytes left
+    inline int items(int size) {
+	qint32 n = 0;
+	value(n);
+	if (n < 0 || (qint64)n * size > end - pos)
+	    ok = false;
+	return ok ? n : 0;
+    };
+
+    template <class T>
+    inline void array(T *data, int count) {
+	if (length<T>(count) == count)
+	    bytes(data, (qint64)count * sizeof(T));
+    };
+
+    template <class T>
+    inline void array(std::vector<T> &v) {
+	int count = length<T>(-1);
+	v.resize(count);
+	if (count)
+	    bytes(&v[0], (qint64)count * sizeof(T));
+    };
+};
+
+QByteArray SceneFile::hash(const QString &fileName)
+{
+    QFile file(fileName);
+    if (!file.open(QIODevice::ReadOnly))
+	return QByteArray();
+
+    // in chunks, generated scripts may be too large to read at once
+    QCryptographicHash hash(QCryptographicHash::Sha1);
+    std::vector<char> buffer(1 << 20);
+    qint64 size;
+    while ((size = file.read(&buffer[0], buffer.size())) > 0)
+	hash.addData(&buffer[0], size);
+    if (size < 0)
+	return QByteArray();
+    return hash.result();
+}
+
+bool SceneFile::save(const Scene &scene, const QString &fileName,
+		     const QByteArray &source, const QStringList &dependencies)
+{
+    // written next to it and renamed, other processes may have mapped
+    // the old one
+    QString tempName = fileName + ".tmp";
+    QFile file(tempName);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+	qDebug() << "SceneFile::save error: Cannot write" << tempName;
+	return false;
+    }
+
+    SceneFileHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, magic, sizeof(magic));
+    header.version = version;
+    header.accelerator = scene.accelerator;
+    memcpy(header.source, source.constData(), std::min(source.size(), 20));
+
+    SceneWriter out(file);
+    out.value(header);
+
+    out.value<qint32>(dependencies.size());
+    for (int i = 0; i < dependencies.size(); i++) {
+	QByteArray name = dependencies[i].toLocal8Bit();
+	QFileInfo info(dependencies[i]);
+	out.array(name.constData(), name.size());
+	out.value<qint64>(info.size());
+	out.value<qint64>(info.lastModified().toTime_t());
+    }
+
+    out.value<qint32>(scene.camera != 0);
+    if (scene.camera) {
+	const Camera &c = *scene.camera;
+	out.value(c.pos);
+	out.value(c.dir);
+	out.value(c.up);
+	out.value(c.hlen);
+	out.value(c.vlen);
+	out.value(c.aperture);
+	out.value(c.focus);
+    }
+    out.value<qint32>(scene.light != 0);
+    if (scene.light) {
+	out.value(scene.light->pos);
+	out.value(scene.light->color);
+	out.value(scene.light->power);
+    }
+
+    write(out, scene);
+
+    header.size = file.pos();
+    if (out.ok && file.seek(0))
+	out.value(header);
+    file.close();
+
+    if (!out.ok) {
+	qDebug() << "SceneFile::save error: Cannot write" << tempName;
+	QFile::remove(tempName);
+	return false;
+    }
+    QFile::remove(fileName);
+    if (!QFile::rename(tempName, fileName)) {
+	qDebug() << "SceneFile::save error: Cannot rename" << tempName;
+	return false;
+    }
+    return true;
+}
+
+void SceneFile::write(SceneWriter &out, const Scene &scene)
+{
+    out.value<qint32>(scene.built);
+    out.value(scene.bounds);
+
+    const SphereSet &spheres = scene.spheres;
+    out.value<qint32>(spheres.size());
+    out.array(spheres.cx, spheres.size());
+    out.array(spheres.cy, spheres.size());
+    out.array(spheres.cz, spheres.size());
+    out.array(spheres.r2, spheres.size());
+    out.array(spheres.colors);
+    out.array(spheres.mirrors);
+
+    out.array(scene.sphereTree.nodes);
+    out.array(scene.wideTree.nodes);
+    out.array(scene.compressedTree8.nodes);
+    out.array(scene.compressedTree16.nodes);
+    const Grid &grid = scene.grid;
+    out.value(grid.size);
+    out.value(grid.box);
+    out.value(grid.cellSize);
+    out.array(grid.cells);
+    out.array(grid.runs);
+
+    const PlaneSet &planes = scene.planes;
+    out.array(planes.pos);
+    out.array(planes.normals);
+    out.array(planes.d);
+    out.array(planes.mirrors);
+
+    const TriangleSet &triangles = scene.triangles;
+    out.value<qint32>(triangles.size());
+    const float *vertices[9] = { triangles.ax, triangles.ay, triangles.az,
+				 triangles.bx, triangles.by, triangles.bz,
+				 triangles.cx, triangles.cy, triangles.cz };
+    for (int i = 0; i < 9; i++)
+	out.array(vertices[i], triangles.size());
+    out.array(triangles.meshes);
+    out.array(triangles.meshColors);
+    out.array(triangles.meshMirrors);
+    out.array(scene.triangleTree.nodes);
+    out.array(scene.wideTriangleTree.nodes);
+
+    out.value<qint32>(scene.groups.size());
+    for (unsigned int i = 0; i < scene.groups.size(); i++)
+	write(out, *scene.groups[i]);
+
+    out.value<qint32>(scene.instances.size());
+    for (unsigned int i = 0; i < scene.instances.size(); i++) {
+	const SceneInstance &instance = scene.instances[i];
+	qint32 group = std::find(scene.groups.begin(), scene.groups.end(),
+				 instance.group) - scene.groups.begin();
+	out.value(group);
+	out.value(instance.toObject);
+    }
+    out.array(scene.instanceTree.nodes);
+    out.array(scene.wideInstanceTree.nodes);
+}
+
+Scene *SceneFile::load(const QString &fileName, const QByteArray &source)
+{
+    QFile file(fileName);
+    if (!file.open(QIODevice::ReadOnly))
+	return 0;
+
+    qint64 size = file.size();
+    SceneFileHeader header;
+    const uchar *data = size >= (qint64)sizeof(header) ? file.map(0, size) : 0;
+    if (!data)
+	return 0;
+    memcpy(&header, data, sizeof(header));
+    if (memcmp(header.magic, magic, sizeof(magic)) || header.version != version
+	|| header.size != size) {
+	std::cout << "Compiled scene " << qPrintable(fileName)
+		  << " is incomplete or of another version." << std::endl;
+	return 0;
+    }
+
+    SceneReader in(data + sizeof(header), size - sizeof(header));
+    bool stale = header.accelerator != Scene::defaultAccelerator
+	|| source.size() != 20 || memcmp(header.source, source.constData(), 20);
+    int dependencies = in.items(2 * sizeof(qint64));
+    for (int i = 0; i < dependencies && in.ok; i++) {
+	std::vector<char> name;
+	qint64 fileSize = 0, modified = 0;
+	in.array(name);
+	in.value(fileSize);
+	in.value(modified);
+	QFileInfo info(QString::fromLocal8Bit(name.empty() ? "" : &name[0],
+					      name.size()));
+	if (info.size() != fileSize || info.lastModified().toTime_t() != modified)
+	    stale = true;
+    }
+    if (stale) {
+	std::cout << "Compiled scene " << qPrintable(fileName)
+		  << " is out of date." << std::endl;
+	return 0;
+    }
+
+    Scene *scene = new Scene();
+    qint32 present = 0;
+    in.value(present);
+    if (present) {
+	vec pos, dir, up;
+	float hlen = 0, vlen = 0, aperture = 0, focus = 0;
+	in.value(pos);
+	in.value(dir);
+	in.value(up);
+	in.value(hlen);
+	in.value(vlen);
+	in.value(aperture);
+	in.value(focus);
+	Camera *camera = new Camera(pos, dir, up, hlen, vlen, aperture, focus);
+	// normalized once already, again they could change in the last bit
+	camera->dir = dir;
+	camera->up = up;
+	scene->setCamera(camera);
+    }
+    present = 0;
+    in.value(present);
+    if (present) {
+	vec pos, color;
+	float power = 0;
+	in.value(pos);
+	in.value(color);
+	in.value(power);
+	scene->setLight(new Light(pos, color, power));
+    }
+
+    read(in, *scene);
+    if (!in.ok) {
+	qDebug() << "SceneFile::load error: Broken file" << fileName;
+	delete scene;
+	return 0;
+    }
+    return scene;
+}
+
+void SceneFile::read(SceneReader &in, Scene &scene)
+{
+    qint32 built = Scene::WideTree;
+    in.value(built);
+    scene.built = (Scene::Accelerator)built;
+    in.value(scene.bounds);
+
+    SphereSet &spheres = scene.spheres;
+    spheres.resize(in.items(4 * sizeof(float)));
+    in.array(spheres.cx, spheres.size());
+    in.array(spheres.cy, spheres.size());
+    in.array(spheres.cz, spheres.size());
+    in.array(spheres.r2, spheres.size());
+    in.array(spheres.colors);
+    in.array(spheres.mirrors);
+
+    in.array(scene.sphereTree.nodes);
+    in.array(scene.wideTree.nodes);
+    in.array(scene.compressedTree8.nodes);
+    in.array(scene.compressedTree16.nodes);
+    Grid &grid = scene.grid;
+    in.value(grid.size);
+    in.value(grid.box);
+    in.value(grid.cellSize);
+    in.array(grid.cells);
+    in.array(grid.runs);
+
+    PlaneSet &planes = scene.planes;
+    in.array(planes.pos);
+    in.array(planes.normals);
+    in.array(planes.d);
+    in.array(planes.mirrors);
+
+    TriangleSet &triangles = scene.triangles;
+    triangles.resize(in.items(9 * sizeof(float)));
+    float *vertices[9] = { triangles.ax, triangles.ay, triangles.az,
+			   triangles.bx, triangles.by, triangles.bz,
+			   triangles.cx, triangles.cy, triangles.cz };
+    for (int i = 0; i < 9; i++)
+	in.array(vertices[i], triangles.size());
+    in.array(triangles.meshes);
+    in.array(triangles.meshColors);
+    in.array(triangles.meshMirrors);
+    in.array(scene.triangleTree.nodes);
+    in.array(scene.wideTriangleTree.nodes);
+
+    int count = in.items(1);
+    for (int i = 0; i < count && in.ok; i++) {
+	Scene *group = new Scene();
+	scene.addGroup(group);
+	read(in, *group);
+    }
+
+    count = in.items(sizeof(qint32) + sizeof(Transform));
+    for (int i = 0; i < count && in.ok; i++) {
+	SceneInstance instance;
+	qint32 group = -1;
+	in.value(group);
+	in.value(instance.toObject);
+	if (group < 0 || group >= (int)scene.groups.size()) {
+	    in.ok = false;
+	    break;
+	}
+	instance.group = scene.groups[group];
+	scene.instances.push_back(instance);
+    }
+    in.array(scene.instanceTree.nodes);
+    in.array(scene.wideInstanceTree.nodes);
+}
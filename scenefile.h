@@ -0,0 +1,61 @@
+/*funray - yet another raytracer
+Copyright (C) 2008  Christian Zeller (chrizel@gmail.com) and
+		    Simon Goller (neosam@gmail.com).
+
+This program is free software; you can redistribute it and/or modify 
+it under the terms of the GNU General Public License as published 
+by the Free Software Foundation; either version 3 of the License, 
+or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful, but 
+WITHOUT ANY WARRANTY; without even the implied warranty of 
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License along 
+with this program; if not, see <http://www.gnu.org/licenses/>. */
+
+
+#ifndef SCENEFILE_H
+#define SCENEFILE_H
+
+#include <QByteArray>
+#include <QString>
+#include <QStringList>
+
+class Scene;
+class SceneReader;
+class SceneWriter;
+
+// Compiled scenes: the arrays and acceleration structures of a built
+// Scene with its groups, camera and light in one binary file. Loading
+// maps the file and copies every array out of it in one piece, the
+// script is not run and nothing is built again.
+//
+// A compiled scene remembers the hash of the scene file it was made
+// of, the accelerator and the size and modification time of the mesh
+// files the script loaded. If any of them changed it is stale and
+// load() returns 0. The loaded scene has no prims, build() must not
+// be called on it.
+class SceneFile
+{
+public:
+    enum { version = 1 };
+
+    // Hash of the contents of a scene file
+    static QByteArray hash(const QString &fileName);
+
+    // Writes the built scene, returns false with a message on errors
+    static bool save(const Scene &scene, const QString &fileName,
+		     const QByteArray &source, const QStringList &dependencies);
+
+    // The scene, or 0 if the file is missing, has another version or
+    // is stale
+    static Scene *load(const QString &fileName, const QByteArray &source);
+
+private:
+    static void write(SceneWriter &out, const Scene &scene);
+    static void read(SceneReader &in, Scene &scene);
+};
+
+#endif
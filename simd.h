@@ -0,0 +1,264 @@
+/*funray - yet another raytracer
+Copyright (C) 2008  Christian Zeller (chrizel@gmail.com) and
+		    Simon Goller (neosam@gmail.com).
+
+This program is free software; you can redistribute it and/or modify 
+it under the terms of the GNU General Public License as published 
+by the Free Software Foundation; either version 3 of the License, 
+or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful, but 
+WITHOUT ANY WARRANTY; without even the implied warranty of 
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License along 
+with this program; if not, see <http://www.gnu.org/licenses/>. */
+
+
+#ifndef SIMD_H
+#define SIMD_H
+
+// Thin wrappers around the SIMD registers of the target: 8 floats
+// with AVX, 4 with SSE2 and a plain float otherwise. Kernels written
+// with vfloat and vmask work on SIMD_WIDTH values at once.
+
+#include <cmath>
+#include <cstdlib>
+
+#if defined(__AVX__)
+# include <immintrin.h>
+# define SIMD_WIDTH 8
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+# include <emmintrin.h>
+# define SIMD_WIDTH 4
+#else
+# define SIMD_WIDTH 1
+#endif
+
+// Arrays for vfloat::loadAligned have to be aligned to this
+#define SIMD_ALIGN 32
+
+inline void *simdAlloc(size_t size)
+{
+#if SIMD_WIDTH > 1
+    return _mm_malloc(size, SIMD_ALIGN);
+#else
+    return malloc(size);
+#endif
+}
+
+inline void simdFree(void *p)
+{
+#if SIMD_WIDTH > 1
+    _mm_free(p);
+#else
+    free(p);
+#endif
+}
+
+#if SIMD_WIDTH == 8
+
+struct vmask
+{
+    __m256 v;
+
+    vmask() {};
+    vmask(__m256 v) : v(v) {};
+
+    // one bit per lane
+    inline int bits() const { return _mm256_movemask_ps(v); };
+    inline bool any() const { return bits() != 0; };
+};
+
+struct vfloat
+{
+    __m256 v;
+
+    vfloat() {};
+    vfloat(__m256 v) : v(v) {};
+    vfloat(float f) : v(_mm256_set1_ps(f)) {};
+
+    static inline vfloat load(const float *p) { return _mm256_loadu_ps(p); };
+    static inline vfloat loadAligned(const float *p) { return _mm256_load_ps(p); };
+    // unsigned integers converted to float
+    static inline vfloat load(const unsigned char *p) {
+	__m128i b = _mm_loadl_epi64((const __m128i *)p);
+	return load(_mm_unpacklo_epi8(b, _mm_setzero_si128()));
+    };
+    static inline vfloat load(const unsigned short *p) {
+	return load(_mm_loadu_si128((const __m128i *)p));
+    };
+    inline void store(float *p) const { _mm256_storeu_ps(p, v); };
+
+private:
+    // eight 16 bit integers
+    static inline vfloat load(__m128i w) {
+	__m128i zero = _mm_setzero_si128();
+	__m128 lo = _mm_cvtepi32_ps(_mm_unpacklo_epi16(w, zero));
+	__m128 hi = _mm_cvtepi32_ps(_mm_unpackhi_epi16(w, zero));
+	return _mm256_insertf128_ps(_mm256_castps128_ps256(lo), hi, 1);
+    };
+};
+
+inline vfloat operator+(const vfloat &a, const vfloat &b) { return _mm256_add_ps(a.v, b.v); }
+inline vfloat operator-(const vfloat &a, const vfloat &b) { return _mm256_sub_ps(a.v, b.v); }
+inline vfloat operator*(const vfloat &a, const vfloat &b) { return _mm256_mul_ps(a.v, b.v); }
+inline vfloat operator/(const vfloat &a, const vfloat &b) { return _mm256_div_ps(a.v, b.v); }
+inline vfloat vmin(const vfloat &a, const vfloat &b) { return _mm256_min_ps(a.v, b.v); }
+inline vfloat vmax(const vfloat &a, const vfloat &b) { return _mm256_max_ps(a.v, b.v); }
+inline vfloat vsqrt(const vfloat &a) { return _mm256_sqrt_ps(a.v); }
+
+// comparisons with NaN are false, except for !=
+inline vmask operator<(const vfloat &a, const vfloat &b) { return _mm256_cmp_ps(a.v, b.v, _CMP_LT_OQ); }
+inline vmask operator>(const vfloat &a, const vfloat &b) { return _mm256_cmp_ps(a.v, b.v, _CMP_GT_OQ); }
+inline vmask operator<=(const vfloat &a, const vfloat &b) { return _mm256_cmp_ps(a.v, b.v, _CMP_LE_OQ); }
+inline vmask operator>=(const vfloat &a, const vfloat &b) { return _mm256_cmp_ps(a.v, b.v, _CMP_GE_OQ); }
+inline vmask operator!=(const vfloat &a, const vfloat &b) { return _mm256_cmp_ps(a.v, b.v, _CMP_NEQ_UQ); }
+
+inline vmask operator&(const vmask &a, const vmask &b) { return _mm256_and_ps(a.v, b.v); }
+inline vmask operator|(const vmask &a, const vmask &b) { return _mm256_or_ps(a.v, b.v); }
+
+// per lane m ? a : b
+inline vfloat select(const vmask &m, const vfloat &a, const vfloat &b) { return _mm256_blendv_ps(b.v, a.v, m.v); }
+
+// lanes of the integers at p which are not x, compared as integers
+inline vmask notEqual(const int *p, int x)
+{
+    __m128i v = _mm_set1_epi32(x);
+    __m128i lo = _mm_cmpeq_epi32(_mm_loadu_si128((const __m128i *)p), v);
+    __m128i hi = _mm_cmpeq_epi32(_mm_loadu_si128((const __m128i *)(p + 4)), v);
+    __m256 equal = _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_castsi128_ps(lo)),
+					_mm_castsi128_ps(hi), 1);
+    return _mm256_xor_ps(equal, _mm256_castsi256_ps(_mm256_set1_epi32(-1)));
+}
+
+#elif SIMD_WIDTH == 4
+
+struct vmask
+{
+    __m128 v;
+
+    vmask() {};
+    vmask(__m128 v) : v(v) {};
+
+    // one bit per lane
+    inline int bits() const { return _mm_movemask_ps(v); };
+    inline bool any() const { return bits() != 0; };
+};
+
+struct vfloat
+{
+    __m128 v;
+
+    vfloat() {};
+    vfloat(__m128 v) : v(v) {};
+    vfloat(float f) : v(_mm_set1_ps(f)) {};
+
+    static inline vfloat load(const float *p) { return _mm_loadu_ps(p); };
+    static inline vfloat loadAligned(const float *p) { return _mm_load_ps(p); };
+    // unsigned integers converted to float
+    static inline vfloat load(const unsigned char *p) {
+	__m128i zero = _mm_setzero_si128();
+	__m128i b = _mm_cvtsi32_si128(p[0] | p[1] << 8 | p[2] << 16 | p[3] << 24);
+	return load(_mm_unpacklo_epi8(b, zero));
+    };
+    static inline vfloat load(const unsigned short *p) {
+	return load(_mm_loadl_epi64((const __m128i *)p));
+    };
+    inline void store(float *p) const { _mm_storeu_ps(p, v); };
+
+private:
+    // four 16 bit integers in the low half
+    static inline vfloat load(__m128i w) {
+	return _mm_cvtepi32_ps(_mm_unpacklo_epi16(w, _mm_setzero_si128()));
+    };
+};
+
+inline vfloat operator+(const vfloat &a, const vfloat &b) { return _mm_add_ps(a.v, b.v); }
+inline vfloat operator-(const vfloat &a, const vfloat &b) { return _mm_sub_ps(a.v, b.v); }
+inline vfloat operator*(const vfloat &a, const vfloat &b) { return _mm_mul_ps(a.v, b.v); }
+inline vfloat operator/(const vfloat &a, const vfloat &b) { return _mm_div_ps(a.v, b.v); }
+inline vfloat vmin(const vfloat &a, const vfloat &b) { return _mm_min_ps(a.v, b.v); }
+inline vfloat vmax(const vfloat &a, const vfloat &b) { return _mm_max_ps(a.v, b.v); }
+inline vfloat vsqrt(const vfloat &a) { return _mm_sqrt_ps(a.v); }
+
+// comparisons with NaN are false, except for !=
+inline vmask operator<(const vfloat &a, const vfloat &b) { return _mm_cmplt_ps(a.v, b.v); }
+inline vmask operator>(const vfloat &a, const vfloat &b) { return _mm_cmpgt_ps(a.v, b.v); }
+inline vmask operator<=(const vfloat &a, const vfloat &b) { return _mm_cmple_ps(a.v, b.v); }
+inline vmask operator>=(const vfloat &a, const vfloat &b) { return _mm_cmpge_ps(a.v, b.v); }
+inline vmask operator!=(const vfloat &a, const vfloat &b) { return _mm_cmpneq_ps(a.v, b.v); }
+
+inline vmask operator&(const vmask &a, const vmask &b) { return _mm_and_ps(a.v, b.v); }
+inline vmask operator|(const vmask &a, const vmask &b) { return _mm_or_ps(a.v, b.v); }
+
+// per lane m ? a : b
+inline vfloat select(const vmask &m, const vfloat &a, const vfloat &b) {
+    return _mm_or_ps(_mm_and_ps(m.v, a.v), _mm_andnot_ps(m.v, b.v));
+}
+
+// lanes of the integers at p which are not x, compared as integers
+inline vmask notEqual(const int *p, int x)
+{
+    __m128i equal = _mm_cmpeq_epi32(_mm_loadu_si128((const __m128i *)p), _mm_set1_epi32(x));
+    return _mm_xor_ps(_mm_castsi128_ps(equal), _mm_castsi128_ps(_mm_set1_epi32(-1)));
+}
+
+#else
+
+struct vmask
+{
+    bool v;
+
+    vmask() {};
+    vmask(bool v) : v(v) {};
+
+    inline int bits() const { return v ? 1 : 0; };
+    inline bool any() const { return v; };
+};
+
+struct vfloat
+{
+    float v;
+
+    vfloat() {};
+    vfloat(float f) : v(f) {};
+
+    static inline vfloat load(const float *p) { return *p; };
+    static inline vfloat loadAligned(const float *p) { return *p; };
+    static inline vfloat load(const unsigned char *p) { return *p; };
+    static inline vfloat load(const unsigned short *p) { return *p; };
+    inline void store(float *p) const { *p = v; };
+};
+
+inline vfloat operator+(const vfloat &a, const vfloat &b) { return a.v + b.v; }
+inline vfloat operator-(const vfloat &a, const vfloat &b) { return a.v - b.v; }
+inline vfloat operator*(const vfloat &a, const vfloat &b) { return a.v * b.v; }
+inline vfloat operator/(const vfloat &a, const vfloat &b) { return a.v / b.v; }
+inline vfloat vmin(const vfloat &a, const vfloat &b) { return a.v < b.v ? a.v : b.v; }
+inline vfloat vmax(const vfloat &a, const vfloat &b) { return a.v > b.v ? a.v : b.v; }
+inline vfloat vsqrt(const vfloat &a) { return std::sqrt(a.v); }
+
+inline vmask operator<(const vfloat &a, const vfloat &b) { return a.v < b.v; }
+inline vmask operator>(const vfloat &a, const vfloat &b) { return a.v > b.v; }
+inline vmask operator<=(const vfloat &a, const vfloat &b) { return a.v <= b.v; }
+inline vmask operator>=(const vfloat &a, const vfloat &b) { return a.v >= b.v; }
+inline vmask operator!=(const vfloat &a, const vfloat &b) { return a.v != b.v; }
+
+inline vmask operator&(const vmask &a, const vmask &b) { return a.v && b.v; }
+inline vmask operator|(const vmask &a, const vmask &b) { return a.v || b.v; }
+
+inline vfloat select(const vmask &m, const vfloat &a, const vfloat &b) { return m.v ? a : b; }
+
+inline vmask notEqual(const int *p, int x) { return *p != x; }
+
+#endif
+
+// bit mask of the first n lanes
+inline int laneMask(int n)
+{
+    return n >= SIMD_WIDTH ? (1 << SIMD_WIDTH) - 1 : (1 << n) - 1;
+}
+
+#endif
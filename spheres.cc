@@ -0,0 +1,183 @@
+/*funray - yet another raytracer
+Copyright (C) 2008  Christian Zeller (chrizel@gmail.com) and
+		    Simon Goller (neosam@gmail.com).
+
+This program is free software; you can redistribute it and/or modify 
+it under the terms of the GNU General Public License as published 
+by the Free Software Foundation; either version 3 of the License, 
+or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful, but 
+WITHOUT ANY WARRANTY; without even the implied warranty of 
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License along 
+with this program; if not, see <http://www.gnu.org/licenses/>. */
+
+
+#include <cstring>
+
+#include "simd.h"
+#include "spheres.h"
+#include "vector.h"
+
+SphereSet::SphereSet()
+    : data(0), count(0), cx(0), cy(0), cz(0), r2(0)
+{
+}
+
+SphereSet::~SphereSet()
+{
+    simdFree(data);
+}
+
+void SphereSet::resize(int count)
+{
+    simdFree(data);
+
+    // kernels load whole registers starting at any index < count
+    int padded = (count + 2 * SIMD_WIDTH - 1) / SIMD_WIDTH * SIMD_WIDTH;
+
+    data = (float *)simdAlloc(4 * padded * sizeof(float));
+    memset(data, 0, 4 * padded * sizeof(float));
+
+    this->count = count;
+    colors.resize(count);
+    mirrors.resize(count);
+    cx = data;
+    cy = data + padded;
+    cz = data + 2 * padded;
+    r2 = data + 3 * padded;
+}
+
+unsigned long SphereSet::memoryUsage() const
+{
+    int padded = (count + 2 * SIMD_WIDTH - 1) / SIMD_WIDTH * SIMD_WIDTH;
+    return 4 * padded * sizeof(float) + colors.capacity() * sizeof(vec)
+	+ mirrors.capacity() * sizeof(float);
+}
+
+// The ray sphere test for SIMD_WIDTH spheres:
+// e = center - origin, a = e.dir, t = a - sqrt(r^2 - e.e + a^2).
+// A miss gives sqrt of a negative number, NaN fails every comparison.
+static inline vfloat distances(const SphereSet &s, int i, const vfloat &ox,
+			       const vfloat &oy, const vfloat &oz, const vfloat &dx,
+			       const vfloat &dy, const vfloat &dz)
+{
+    vfloat ex = vfloat::load(s.cx + i) - ox;
+    vfloat ey = vfloat::load(s.cy + i) - oy;
+    vfloat ez = vfloat::load(s.cz + i) - oz;
+    vfloat a = ex * dx + ey * dy + ez * dz;
+    vfloat f = vsqrt(vfloat::load(s.r2 + i) - (ex * ex + ey * ey + ez * ez) + a * a);
+    return a - f;
+}
+
+int SphereSet::intersect(const Ray &ray, int begin, int end, float &tmax) const
+{
+    const vfloat ox(ray.pos.x), oy(ray.pos.y), oz(ray.pos.z);
+    const vfloat dx(ray.dir.x), dy(ray.dir.y), dz(ray.dir.z);
+    const vfloat tmin(0.0001f);
+
+    int hit = -1;
+    for (int i = begin; i < end; i += SIMD_WIDTH) {
+	vfloat t = distances(*this, i, ox, oy, oz, dx, dy, dz);
+	int bits = ((t > tmin) & (t < vfloat(tmax))).bits() & laneMask(end - i);
+	if (bits) {
+	    float ts[SIMD_WIDTH];
+	    t.store(ts);
+	    for (int k = 0; bits; k++, bits >>= 1) {
+		if ((bits & 1) && ts[k] < tmax) {
+		    tmax = ts[k];
+		    hit = i + k;
+		}
+	    }
+	}
+    }
+
+    return hit;
+}
+
+int SphereSet::occluder(const Ray &ray, int begin, int end, float tmax, int skip) const
+{
+    const vfloat ox(ray.pos.x), oy(ray.pos.y), oz(ray.pos.z);
+    const vfloat dx(ray.dir.x), dy(ray.dir.y), dz(ray.dir.z);
+    const vfloat zero(0.0f);
+
+    for (int i = begin; i < end; i += SIMD_WIDTH) {
+	vfloat t = distances(*this, i, ox, oy, oz, dx, dy, dz);
+	int bits = ((t > zero) & (t < vfloat(tmax))).bits() & laneMask(end - i);
+	if (skip >= i && skip < i + SIMD_WIDTH)
+	    bits &= ~(1 << (skip - i));
+	if (bits) {
+	    int k = 0;
+	    while (!(bits & (1 << k)))
+		k++;
+	    return i + k;
+	}
+    }
+
+    return -1;
+}
+
+// The packet versions test one sphere against SIMD_WIDTH rays at a
+// time instead, the rays already are in structure of arrays layout.
+static inline vfloat distances(const RayPacket &p, int i, const vfloat &cx,
+			       const vfloat &cy, const vfloat &cz, const vfloat &r2)
+{
+    vfloat ex = cx - vfloat::load(p.ox + i);
+    vfloat ey = cy - vfloat::load(p.oy + i);
+    vfloat ez = cz - vfloat::load(p.oz + i);
+    vfloat a = ex * vfloat::load(p.dx + i) + ey * vfloat::load(p.dy + i)
+	+ ez * vfloat::load(p.dz + i);
+    vfloat f = vsqrt(r2 - (ex * ex + ey * ey + ez * ez) + a * a);
+    return a - f;
+}
+
+void SphereSet::intersect(RayPacket &packet, int begin, int end) const
+{
+    const vfloat tmin(0.0001f);
+    const int size = packet.size();
+
+    for (int s = begin; s < end; s++) {
+	const vfloat x(cx[s]), y(cy[s]), z(cz[s]), rr(r2[s]);
+	for (int i = 0; i < size; i += SIMD_WIDTH) {
+	    vfloat t = distances(packet, i, x, y, z, rr);
+	    vfloat tmax = vfloat::load(packet.tmax + i);
+	    vmask m = (t > tmin) & (t < tmax);
+	    int bits = m.bits();
+	    if (bits) {
+		select(m, t, tmax).store(packet.tmax + i);
+		for (int k = 0; bits; k++, bits >>= 1) {
+		    if (bits & 1)
+			packet.hit[i + k] = s;
+		}
+	    }
+	}
+    }
+}
+
+bool SphereSet::occluded(RayPacket &packet, int begin, int end) const
+{
+    const vfloat zero(0.0f), blocked(-1.0f);
+    const int size = packet.size();
+
+    for (int s = begin; s < end; s++) {
+	const vfloat x(cx[s]), y(cy[s]), z(cz[s]), rr(r2[s]);
+	for (int i = 0; i < size; i += SIMD_WIDTH) {
+	    vfloat t = distances(packet, i, x, y, z, rr);
+	    vfloat tmax = vfloat::load(packet.tmax + i);
+	    vmask m = (t > zero) & (t < tmax) & notEqual(packet.skip + i, s);
+	    int bits = m.bits();
+	    if (bits) {
+		select(m, blocked, tmax).store(packet.tmax + i);
+		for (int k = 0; bits; k++, bits >>= 1) {
+		    if (bits & 1)
+			packet.hit[i + k] = s;
+		}
+	    }
+	}
+    }
+
+    return !packet.active();
+}
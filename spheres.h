@@ -0,0 +1,109 @@
+/*funray - yet another raytracer
+Copyright (C) 2008  Christian Zeller (chrizel@gmail.com) and
+		    Simon Goller (neosam@gmail.com).
+
+This program is free software; you can redistribute it and/or modify 
+it under the terms of the GNU General Public License as published 
+by the Free Software Foundation; either version 3 of the License, 
+or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful, but 
+WITHOUT ANY WARRANTY; without even the implied warranty of 
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License along 
+with this program; if not, see <http://www.gnu.org/licenses/>. */
+
+
+#ifndef SPHERES_H
+#define SPHERES_H
+
+#include <vector>
+
+#include "packet.h"
+#include "simd.h"
+#include "vector.h"
+
+// Sphere centers and squared radii as structure of arrays, so that
+// one ray is tested against SIMD_WIDTH spheres at once. The arrays
+// are padded, so a whole register can be loaded at every index.
+// Colors and mirror factors are only needed for shading and are kept
+// apart from them.
+class SphereSet
+{
+private:
+    float *data;
+    int count;
+
+    SphereSet(const SphereSet &);
+    SphereSet &operator=(const SphereSet &);
+
+public:
+    // shading uses the outside only
+    enum { twoSided = 0 };
+
+    float *cx;
+    float *cy;
+    float *cz;
+    float *r2;
+
+    std::vector<vec> colors;
+    std::vector<float> mirrors;
+
+    SphereSet();
+    ~SphereSet();
+
+    void resize(int count);
+    inline int size() const {
+	return count;
+    };
+
+    // bytes used by the arrays
+    unsigned long memoryUsage() const;
+
+    inline void set(int i, const vec &pos, float radius, const vec &color,
+		    float mirror) {
+	cx[i] = pos.x;
+	cy[i] = pos.y;
+	cz[i] = pos.z;
+	r2[i] = radius * radius;
+	colors[i] = color;
+	mirrors[i] = mirror;
+    };
+
+    inline const vec normalAt(int i, const vec &point) const {
+	return (point - vec(cx[i], cy[i], cz[i])).normal();
+    };
+
+    inline const vec colorAt(int i, const vec & /* point */) const {
+	return colors[i];
+    };
+
+    inline float mirrorAt(int i) const {
+	return mirrors[i];
+    };
+
+    // Nearest sphere in [begin, end) hit between 0.0001 and tmax.
+    // Returns its index and lowers tmax, or returns -1.
+    int intersect(const Ray &ray, int begin, int end, float &tmax) const;
+
+    // Any sphere in [begin, end) except skip which is hit between 0
+    // and tmax, or -1
+    int occluder(const Ray &ray, int begin, int end, float tmax, int skip = -1) const;
+    inline bool occluded(const Ray &ray, int begin, int end, float tmax,
+			 int skip = -1) const {
+	return occluder(ray, begin, end, tmax, skip) >= 0;
+    };
+
+    // Closest hits of all rays of a packet with the spheres in
+    // [begin, end), lowers packet.tmax and sets packet.hit.
+    void intersect(RayPacket &packet, int begin, int end) const;
+
+    // Sets tmax of the packet rays blocked by a sphere in [begin, end)
+    // to -1 and hit to the blocking sphere. Returns true when no ray
+    // is left.
+    bool occluded(RayPacket &packet, int begin, int end) const;
+};
+
+#endif
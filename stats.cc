@@ -0,0 +1,72 @@
+/*funray - yet another raytracer
+Copyright (C) 2008  Christian Zeller (chrizel@gmail.com) and
+		    Simon Goller (neosam@gmail.com).
+
+This program is free software; you can redistribute it and/or modify 
+it under the terms of the GNU General Public License as published 
+by the Free Software Foundation; either version 3 of the License, 
+or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful, but 
+WITHOUT ANY WARRANTY; without even the implied warranty of 
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License along 
+with this program; if not, see <http://www.gnu.org/licenses/>. */
+
+#include <iostream>
+
+#include "stats.h"
+
+void RayStats::clear()
+{
+    primaryRays = shadowRays = mirrorRays = tests = infiniteMirrors = 0;
+    for (int i = 0; i < depthBuckets; i++)
+	depth[i] = 0;
+}
+
+void RayStats::add(const RayStats &other)
+{
+    primaryRays += other.primaryRays;
+    shadowRays += other.shadowRays;
+    mirrorRays += other.mirrorRays;
+    tests += other.tests;
+    infiniteMirrors += other.infiniteMirrors;
+    for (int i = 0; i < depthBuckets; i++)
+	depth[i] += other.depth[i];
+}
+
+void RayStats::report(std::ostream &out) const
+{
+    if (!enabled()) {
+	out << "Ray statistics are not compiled in, "
+	    << "rebuild with qmake CONFIG+=stats." << std::endl;
+	return;
+    }
+
+    out << "Rays: " << totalRays() << " (" << primaryRays << " primary, "
+	<< shadowRays << " shadow, " << mirrorRays << " mirror)" << std::endl
+	<< "Intersection tests: " << tests << std::endl
+	<< "Infinity mirror cutoffs: " << infiniteMirrors << std::endl
+	<< "Rays by depth:";
+
+    int last = depthBuckets - 1;
+    while (last > 0 && !depth[last])
+	last--;
+    for (int i = 0; i <= last; i++) {
+	out << " " << depth[i];
+	if (i == depthBuckets - 1)
+	    out << " (" << i << "+)";
+    }
+    out << std::endl;
+}
+
+bool RayStats::enabled()
+{
+#ifdef FUNRAY_STATS
+    return true;
+#else
+    return false;
+#endif
+}
@@ -0,0 +1,73 @@
+/*funray - yet another raytracer
+Copyright (C) 2008  Christian Zeller (chrizel@gmail.com) and
+		    Simon Goller (neosam@gmail.com).
+
+This program is free software; you can redistribute it and/or modify 
+it under the terms of the GNU General Public License as published 
+by the Free Software Foundation; either version 3 of the License, 
+or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful, but 
+WITHOUT ANY WARRANTY; without even the implied warranty of 
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License along 
+with this program; if not, see <http://www.gnu.org/licenses/>. */
+
+#ifndef STATS_H
+#define STATS_H
+
+#include <iostream>
+
+#include <QtGlobal>
+
+// The counters are only updated when FUNRAY_STATS is defined, e.g.
+// with qmake CONFIG+=stats. Otherwise STATS() statements vanish and
+// the render loops pay nothing for them.
+#ifdef FUNRAY_STATS
+# define STATS(statement) statement
+#else
+# define STATS(statement)
+#endif
+
+// Ray counters of a rendering. Every render thread counts into its
+// own RayStats, Renderer::render adds them up at the end.
+struct RayStats
+{
+    // rays by recursion depth of Scene::sendRay, deeper rays are
+    // counted in the last bucket
+    enum { depthBuckets = 16 };
+
+    quint64 primaryRays;
+    quint64 shadowRays;
+    quint64 mirrorRays;
+    // ray primitive intersection tests
+    quint64 tests;
+    // rays cut off by the "Infinity mirror" depth limit
+    quint64 infiniteMirrors;
+    quint64 depth[depthBuckets];
+
+    RayStats() {
+	clear();
+    };
+
+    void clear();
+    void add(const RayStats &other);
+
+    inline quint64 totalRays() const {
+	return primaryRays + shadowRays + mirrorRays;
+    };
+
+    inline void countDepth(int count) {
+	depth[count < depthBuckets ? count : depthBuckets - 1]++;
+    };
+
+    // Human readable summary
+    void report(std::ostream &out) const;
+
+    // false when the counters are compiled out
+    static bool enabled();
+};
+
+#endif
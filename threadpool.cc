@@ -0,0 +1,252 @@
+/*funray - yet another raytracer
+Copyright (C) 2008  Christian Zeller (chrizel@gmail.com) and
+		    Simon Goller (neosam@gmail.com).
+
+This program is free software; you can redistribute it and/or modify 
+it under the terms of the GNU General Public License as published 
+by the Free Software Foundation; either version 3 of the License, 
+or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful, but 
+WITHOUT ANY WARRANTY; without even the implied warranty of 
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License along 
+with this program; if not, see <http://www.gnu.org/licenses/>. */
+
+
+#include <QMutexLocker>
+#include <QThread>
+
+#include <algorithm>
+
+#include "threadpool.h"
+
+RangeJob::RangeJob(int begin, int end, int grain)
+    : begin(begin), end(end)
+{
+    // a few chunks per thread leave some room for stealing
+    int max = ThreadPool::instance().threadCount() * 4;
+    chunks = std::max(1, std::min(max, (end - begin) / std::max(grain, 1)));
+}
+
+void RangeJob::execute(int index, int thread)
+{
+    int count = end - begin;
+    range(begin + (int)((qlonglong)count * index / chunks),
+	  begin + (int)((qlonglong)count * (index + 1) / chunks),
+	  index, thread);
+}
+
+PoolThread::PoolThread(ThreadPool &pool, int index)
+    : pool(pool),
+      index(index)
+{
+}
+
+void PoolThread::run()
+{
+    pool.work(index);
+}
+
+ThreadPool::ThreadPool(int count)
+    : queues(0), job(0), generation(0), remaining(0), busy(0), quit(false)
+{
+    startThreads(count);
+}
+
+ThreadPool::~ThreadPool()
+{
+    stopThreads();
+}
+
+ThreadPool & ThreadPool::instance()
+{
+    static ThreadPool pool;
+    return pool;
+}
+
+void ThreadPool::startThreads(int count)
+{
+    if (count <= 0)
+	count = QThread::idealThreadCount();
+    if (count <= 0)
+	count = 1;
+
+    queues = new Queue[count];
+    for (int t = 0; t < count; t++) {
+	queues[t].begin = queues[t].end = 0;
+	PoolThread *thread = new PoolThread(*this, t);
+	threads.append(thread);
+	thread->start();
+    }
+}
+
+void ThreadPool::stopThreads()
+{
+    mutex.lock();
+    quit = true;
+    workAvailable.wakeAll();
+    mutex.unlock();
+
+    for (int t = 0; t < threads.size(); t++) {
+	threads[t]->wait();
+	delete threads[t];
+    }
+    threads.clear();
+
+    delete [] queues;
+    queues = 0;
+    quit = false;
+}
+
+void ThreadPool::setThreadCount(int count)
+{
+    QMutexLocker lock(&runMutex);
+
+    if (count <= 0)
+	count = QThread::idealThreadCount();
+    if (count == threads.size())
+	return;
+
+    stopThreads();
+    startThreads(count);
+}
+
+bool ThreadPool::take(int thread, int &index)
+{
+    QMutexLocker lock(&queues[thread].mutex);
+    Queue &q = queues[thread];
+    if (q.begin < q.end) {
+	index = q.begin++;
+	return true;
+    }
+    return false;
+}
+
+bool ThreadPool::steal(int thread, int &index)
+{
+    const int count = threads.size();
+
+    for (int i = 1; i < count; i++) {
+	Queue &victim = queues[(thread + i) % count];
+
+	// Take the upper half of the victim's remaining items...
+	victim.mutex.lock();
+	int begin = victim.begin + (victim.end - victim.begin) / 2;
+	int end = victim.end;
+	victim.end = begin;
+	victim.mutex.unlock();
+
+	if (begin < end) {
+	    // ...run the first one and keep the rest for ourselves
+	    Queue &own = queues[thread];
+	    own.mutex.lock();
+	    own.begin = begin + 1;
+	    own.end = end;
+	    own.mutex.unlock();
+
+	    index = begin;
+	    return true;
+	}
+    }
+
+    return false;
+}
+
+void ThreadPool::work(int thread)
+{
+    int seen = 0;
+
+    for (;;) {
+	mutex.lock();
+	while (!quit && (generation == seen || !job))
+	    workAvailable.wait(&mutex);
+	if (quit) {
+	    mutex.unlock();
+	    return;
+	}
+	seen = generation;
+	Job *current = job;
+	busy++;
+	mutex.unlock();
+
+	int index;
+	while (take(thread, index) || steal(thread, index)) {
+	    current->execute(index, thread);
+
+	    mutex.lock();
+	    done.append(index);
+	    remaining--;
+	    itemDone.wakeAll();
+	    mutex.unlock();
+	}
+
+	mutex.lock();
+	busy--;
+	itemDone.wakeAll();
+	mutex.unlock();
+    }
+}
+
+int ThreadPool::currentThread() const
+{
+    QThread *current = QThread::currentThread();
+    for (int t = 0; t < threads.size(); t++) {
+	if (threads[t] == current)
+	    return t;
+    }
+    return -1;
+}
+
+void ThreadPool::run(Job &job, int count)
+{
+    // Nested run from a job: the other threads may be waiting for
+    // this one, so just do the work here.
+    int thread = currentThread();
+    if (thread >= 0) {
+	for (int i = 0; i < count; i++) {
+	    job.execute(i, thread);
+	    job.completed(i);
+	}
+	return;
+    }
+
+    QMutexLocker lock(&runMutex);
+
+    if (count <= 0)
+	return;
+
+    // Hand out contiguous blocks, stealing evens out the rest
+    const int n = threads.size();
+    for (int t = 0; t < n; t++) {
+	QMutexLocker queueLock(&queues[t].mutex);
+	queues[t].begin = (int)((qlonglong)count * t / n);
+	queues[t].end = (int)((qlonglong)count * (t + 1) / n);
+    }
+
+    mutex.lock();
+    this->job = &job;
+    remaining = count;
+    done.clear();
+    generation++;
+    workAvailable.wakeAll();
+
+    for (;;) {
+	while (!done.isEmpty()) {
+	    int index = done.takeFirst();
+	    mutex.unlock();
+	    job.completed(index);
+	    mutex.lock();
+	}
+
+	if (remaining == 0 && busy == 0)
+	    break;
+
+	itemDone.wait(&mutex);
+    }
+
+    this->job = 0;
+    mutex.unlock();
+}
@@ -0,0 +1,130 @@
+/*funray - yet another raytracer
+Copyright (C) 2008  Christian Zeller (chrizel@gmail.com) and
+		    Simon Goller (neosam@gmail.com).
+
+This program is free software; you can redistribute it and/or modify 
+it under the terms of the GNU General Public License as published 
+by the Free Software Foundation; either version 3 of the License, 
+or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful, but 
+WITHOUT ANY WARRANTY; without even the implied warranty of 
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License along 
+with this program; if not, see <http://www.gnu.org/licenses/>. */
+
+
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include <QList>
+#include <QMutex>
+#include <QThread>
+#include <QWaitCondition>
+
+class ThreadPool;
+
+// A Job is a set of independent work items numbered 0..count-1.
+// execute() runs on the pool threads, completed() is called on the
+// thread that called ThreadPool::run once an item is done.
+class Job
+{
+public:
+    virtual ~Job() {};
+    virtual void execute(int index, int thread) = 0;
+    virtual void completed(int /* index */) {};
+};
+
+// A Job over the index range [begin, end) which is cut into chunks of
+// at least grain indices, range() is called once per chunk with the
+// chunk number.
+class RangeJob : public Job
+{
+private:
+    int begin;
+    int end;
+    int chunks;
+
+public:
+    RangeJob(int begin, int end, int grain = 1);
+
+    inline int chunkCount() const {
+	return chunks;
+    };
+
+    virtual void execute(int index, int thread);
+    virtual void range(int begin, int end, int chunk, int thread) = 0;
+};
+
+class PoolThread : public QThread
+{
+private:
+    ThreadPool &pool;
+    int index;
+
+public:
+    PoolThread(ThreadPool &pool, int index);
+    void run();
+};
+
+class ThreadPool
+{
+    friend class PoolThread;
+
+private:
+    // Per-thread range of unclaimed work items. The owner takes
+    // items from the front, other threads steal from the back.
+    struct Queue {
+	QMutex mutex;
+	int begin;
+	int end;
+    };
+
+    QList<PoolThread *> threads;
+    Queue *queues;
+
+    QMutex mutex;
+    QWaitCondition workAvailable;
+    QWaitCondition itemDone;
+    QMutex runMutex;
+
+    Job *job;
+    int generation;
+    int remaining;
+    int busy;
+    bool quit;
+    QList<int> done;
+
+    void startThreads(int count);
+    void stopThreads();
+
+    bool take(int thread, int &index);
+    bool steal(int thread, int &index);
+    void work(int thread);
+
+public:
+    ThreadPool(int count = 0);
+    virtual ~ThreadPool();
+
+    static ThreadPool & instance();
+
+    // count <= 0 selects one thread per hardware core
+    void setThreadCount(int count);
+    inline int threadCount() const {
+	return threads.size();
+    };
+
+    // Execute all items of job and block until they are finished.
+    // Called from inside a job, the items run on the calling thread.
+    void run(Job &job, int count);
+    inline void run(RangeJob &job) {
+	run(job, job.chunkCount());
+    };
+
+    // Index of the calling pool thread, or -1 for other threads
+    int currentThread() const;
+};
+
+#endif
@@ -0,0 +1,136 @@
+/*funray - yet another raytracer
+Copyright (C) 2008  Christian Zeller (chrizel@gmail.com) and
+		    Simon Goller (neosam@gmail.com).
+
+This program is free software; you can redistribute it and/or modify 
+it under the terms of the GNU General Public License as published 
+by the Free Software Foundation; either version 3 of the License, 
+or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful, but 
+WITHOUT ANY WARRANTY; without even the implied warranty of 
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License along 
+with this program; if not, see <http://www.gnu.org/licenses/>. */
+
+
+#ifndef TRANSFORM_H
+#define TRANSFORM_H
+
+#include <cmath>
+
+#include "vector.h"
+
+// Affine transform: a 3x3 matrix followed by a translation
+class Transform
+{
+public:
+    float m[3][3];
+    vec offset;
+
+    // identity
+    Transform() {
+	for (int i = 0; i < 3; i++) {
+	    for (int j = 0; j < 3; j++)
+		m[i][j] = i == j ? 1 : 0;
+	}
+    };
+
+    static Transform translation(const vec &v) {
+	Transform t;
+	t.offset = v;
+	return t;
+    };
+
+    static Transform scaling(const vec &s) {
+	Transform t;
+	t.m[0][0] = s.x;
+	t.m[1][1] = s.y;
+	t.m[2][2] = s.z;
+	return t;
+    };
+
+    // Rotation by the angles in degrees around the x, then the y and
+    // then the z axis
+    static Transform rotation(const vec &degrees) {
+	const float toRadians = M_PI / 180;
+	Transform x, y, z;
+	float s = sin(degrees.x * toRadians), c = cos(degrees.x * toRadians);
+	x.m[1][1] = c; x.m[1][2] = -s;
+	x.m[2][1] = s; x.m[2][2] = c;
+	s = sin(degrees.y * toRadians); c = cos(degrees.y * toRadians);
+	y.m[0][0] = c; y.m[0][2] = s;
+	y.m[2][0] = -s; y.m[2][2] = c;
+	s = sin(degrees.z * toRadians); c = cos(degrees.z * toRadians);
+	z.m[0][0] = c; z.m[0][1] = -s;
+	z.m[1][0] = s; z.m[1][1] = c;
+	return z * y * x;
+    };
+
+    // other first, then this
+    Transform operator*(const Transform &other) const {
+	Transform t;
+	for (int i = 0; i < 3; i++) {
+	    for (int j = 0; j < 3; j++) {
+		t.m[i][j] = m[i][0] * other.m[0][j] + m[i][1] * other.m[1][j]
+		    + m[i][2] * other.m[2][j];
+	    }
+	}
+	t.offset = point(other.offset);
+	return t;
+    };
+
+    // The matrix has to be invertible
+    Transform inverse() const {
+	Transform t;
+	t.m[0][0] = m[1][1] * m[2][2] - m[1][2] * m[2][1];
+	t.m[0][1] = m[0][2] * m[2][1] - m[0][1] * m[2][2];
+	t.m[0][2] = m[0][1] * m[1][2] - m[0][2] * m[1][1];
+	t.m[1][0] = m[1][2] * m[2][0] - m[1][0] * m[2][2];
+	t.m[1][1] = m[0][0] * m[2][2] - m[0][2] * m[2][0];
+	t.m[1][2] = m[0][2] * m[1][0] - m[0][0] * m[1][2];
+	t.m[2][0] = m[1][0] * m[2][1] - m[1][1] * m[2][0];
+	t.m[2][1] = m[0][1] * m[2][0] - m[0][0] * m[2][1];
+	t.m[2][2] = m[0][0] * m[1][1] - m[0][1] * m[1][0];
+	float det = m[0][0] * t.m[0][0] + m[0][1] * t.m[1][0] + m[0][2] * t.m[2][0];
+	for (int i = 0; i < 3; i++) {
+	    for (int j = 0; j < 3; j++)
+		t.m[i][j] /= det;
+	}
+	t.offset = t.vector(offset) * -1;
+	return t;
+    };
+
+    inline vec vector(const vec &v) const {
+	return vec(m[0][0] * v.x + m[0][1] * v.y + m[0][2] * v.z,
+		   m[1][0] * v.x + m[1][1] * v.y + m[1][2] * v.z,
+		   m[2][0] * v.x + m[2][1] * v.y + m[2][2] * v.z);
+    };
+
+    inline vec point(const vec &p) const {
+	return vector(p) + offset;
+    };
+
+    // Multiplies with the transposed matrix. Normals are transformed
+    // by the transposed inverse, so this is used on the inverse.
+    inline vec transposed(const vec &v) const {
+	return vec(m[0][0] * v.x + m[1][0] * v.y + m[2][0] * v.z,
+		   m[0][1] * v.x + m[1][1] * v.y + m[2][1] * v.z,
+		   m[0][2] * v.x + m[1][2] * v.y + m[2][2] * v.z);
+    };
+
+    // Bounds of the transformed corners of box
+    BBox box(const BBox &box) const {
+	BBox result;
+	for (int i = 0; i < 8; i++) {
+	    result.extend(point(vec(i & 1 ? box.max.x : box.min.x,
+				    i & 2 ? box.max.y : box.min.y,
+				    i & 4 ? box.max.z : box.min.z)));
+	}
+	return result;
+    };
+};
+
+#endif
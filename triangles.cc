@@ -0,0 +1,223 @@
+/*funray - yet another raytracer
+Copyright (C) 2008  Christian Zeller (chrizel@gmail.com) and
+		    Simon Goller (neosam@gmail.com).
+
+This program is free software; you can redistribute it and/or modify 
+it under the terms of the GNU General Public License as published 
+by the Free Software Foundation; either version 3 of the License, 
+or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful, but 
+WITHOUT ANY WARRANTY; without even the implied warranty of 
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License along 
+with this program; if not, see <http://www.gnu.org/licenses/>. */
+
+#include <cmath>
+#include <cstring>
+
+#include "simd.h"
+#include "triangles.h"
+#include "vector.h"
+
+TriangleSet::TriangleSet()
+    : data(0), count(0), ax(0), ay(0), az(0), bx(0), by(0), bz(0),
+      cx(0), cy(0), cz(0)
+{
+}
+
+TriangleSet::~TriangleSet()
+{
+    simdFree(data);
+}
+
+void TriangleSet::resize(int count)
+{
+    simdFree(data);
+
+    // kernels load whole registers starting at any index < count
+    int padded = (count + 2 * SIMD_WIDTH - 1) / SIMD_WIDTH * SIMD_WIDTH;
+
+    data = (float *)simdAlloc(9 * padded * sizeof(float));
+    memset(data, 0, 9 * padded * sizeof(float));
+
+    this->count = count;
+    meshes.resize(count);
+    ax = data;
+    ay = data + padded;
+    az = data + 2 * padded;
+    bx = data + 3 * padded;
+    by = data + 4 * padded;
+    bz = data + 5 * padded;
+    cx = data + 6 * padded;
+    cy = data + 7 * padded;
+    cz = data + 8 * padded;
+}
+
+unsigned long TriangleSet::memoryUsage() const
+{
+    int padded = (count + 2 * SIMD_WIDTH - 1) / SIMD_WIDTH * SIMD_WIDTH;
+    return 9 * padded * sizeof(float) + meshes.capacity() * sizeof(int)
+	+ meshColors.capacity() * sizeof(vec) + meshMirrors.capacity() * sizeof(float);
+}
+
+// Edge function of the edge from p to q, seen from the ray: the sign
+// tells on which side of the edge the ray passes. p and q are relative
+// to the ray origin. Swapping them negates the result exactly, so two
+// triangles sharing an edge never both miss a ray passing along it,
+// which the Moeller-Trumbore barycentrics do not guarantee.
+static inline vfloat edge(const vfloat &px, const vfloat &py, const vfloat &pz,
+			  const vfloat &qx, const vfloat &qy, const vfloat &qz,
+			  const vfloat &dx, const vfloat &dy, const vfloat &dz)
+{
+    return dx * (py * qz - pz * qy) + dy * (pz * qx - px * qz) + dz * (px * qy - py * qx);
+}
+
+// The ray triangle test for SIMD_WIDTH triangles or rays. The ray hits
+// when the three edge functions have the same sign, from either side.
+// The hit point is the weighted sum of the vertices, its distance
+// along the unit direction is t. Misses return NaN.
+static inline vfloat distances(const vfloat &ox, const vfloat &oy, const vfloat &oz,
+			       const vfloat &dx, const vfloat &dy, const vfloat &dz,
+			       vfloat ax, vfloat ay, vfloat az,
+			       vfloat bx, vfloat by, vfloat bz,
+			       vfloat cx, vfloat cy, vfloat cz)
+{
+    const vfloat zero(0.0f), nan(NAN);
+
+    ax = ax - ox;
+    ay = ay - oy;
+    az = az - oz;
+    bx = bx - ox;
+    by = by - oy;
+    bz = bz - oz;
+    cx = cx - ox;
+    cy = cy - oy;
+    cz = cz - oz;
+
+    vfloat u = edge(bx, by, bz, cx, cy, cz, dx, dy, dz);
+    vfloat v = edge(cx, cy, cz, ax, ay, az, dx, dy, dz);
+    vfloat w = edge(ax, ay, az, bx, by, bz, dx, dy, dz);
+    vfloat sum = u + v + w;
+
+    vfloat t = (u * (ax * dx + ay * dy + az * dz) + v * (bx * dx + by * dy + bz * dz)
+		+ w * (cx * dx + cy * dy + cz * dz)) / sum;
+    vmask front = (u >= zero) & (v >= zero) & (w >= zero);
+    vmask back = (u <= zero) & (v <= zero) & (w <= zero);
+    return select((front | back) & (sum != zero), t, nan);
+}
+
+static inline vfloat distances(const TriangleSet &s, int i, const vfloat &ox,
+			       const vfloat &oy, const vfloat &oz, const vfloat &dx,
+			       const vfloat &dy, const vfloat &dz)
+{
+    return distances(ox, oy, oz, dx, dy, dz,
+		     vfloat::load(s.ax + i), vfloat::load(s.ay + i), vfloat::load(s.az + i),
+		     vfloat::load(s.bx + i), vfloat::load(s.by + i), vfloat::load(s.bz + i),
+		     vfloat::load(s.cx + i), vfloat::load(s.cy + i), vfloat::load(s.cz + i));
+}
+
+int TriangleSet::intersect(const Ray &ray, int begin, int end, float &tmax) const
+{
+    const vfloat ox(ray.pos.x), oy(ray.pos.y), oz(ray.pos.z);
+    const vfloat dx(ray.dir.x), dy(ray.dir.y), dz(ray.dir.z);
+    const vfloat tmin(0.0001f);
+
+    int hit = -1;
+    for (int i = begin; i < end; i += SIMD_WIDTH) {
+	vfloat t = distances(*this, i, ox, oy, oz, dx, dy, dz);
+	int bits = ((t > tmin) & (t < vfloat(tmax))).bits() & laneMask(end - i);
+	if (bits) {
+	    float ts[SIMD_WIDTH];
+	    t.store(ts);
+	    for (int k = 0; bits; k++, bits >>= 1) {
+		if ((bits & 1) && ts[k] < tmax) {
+		    tmax = ts[k];
+		    hit = i + k;
+		}
+	    }
+	}
+    }
+
+    return hit;
+}
+
+int TriangleSet::occluder(const Ray &ray, int begin, int end, float tmax, int skip) const
+{
+    const vfloat ox(ray.pos.x), oy(ray.pos.y), oz(ray.pos.z);
+    const vfloat dx(ray.dir.x), dy(ray.dir.y), dz(ray.dir.z);
+    const vfloat tmin(0.0001f);
+
+    for (int i = begin; i < end; i += SIMD_WIDTH) {
+	vfloat t = distances(*this, i, ox, oy, oz, dx, dy, dz);
+	int bits = ((t > tmin) & (t < vfloat(tmax))).bits() & laneMask(end - i);
+	if (skip >= i && skip < i + SIMD_WIDTH)
+	    bits &= ~(1 << (skip - i));
+	if (bits) {
+	    int k = 0;
+	    while (!(bits & (1 << k)))
+		k++;
+	    return i + k;
+	}
+    }
+
+    return -1;
+}
+
+// The packet versions test one triangle against SIMD_WIDTH rays
+static inline vfloat distances(const RayPacket &p, int i, const TriangleSet &s, int k)
+{
+    return distances(vfloat::load(p.ox + i), vfloat::load(p.oy + i), vfloat::load(p.oz + i),
+		     vfloat::load(p.dx + i), vfloat::load(p.dy + i), vfloat::load(p.dz + i),
+		     vfloat(s.ax[k]), vfloat(s.ay[k]), vfloat(s.az[k]),
+		     vfloat(s.bx[k]), vfloat(s.by[k]), vfloat(s.bz[k]),
+		     vfloat(s.cx[k]), vfloat(s.cy[k]), vfloat(s.cz[k]));
+}
+
+void TriangleSet::intersect(RayPacket &packet, int begin, int end) const
+{
+    const vfloat tmin(0.0001f);
+    const int size = packet.size();
+
+    for (int s = begin; s < end; s++) {
+	for (int i = 0; i < size; i += SIMD_WIDTH) {
+	    vfloat t = distances(packet, i, *this, s);
+	    vfloat tmax = vfloat::load(packet.tmax + i);
+	    vmask m = (t > tmin) & (t < tmax);
+	    int bits = m.bits();
+	    if (bits) {
+		select(m, t, tmax).store(packet.tmax + i);
+		for (int k = 0; bits; k++, bits >>= 1) {
+		    if (bits & 1)
+			packet.hit[i + k] = s;
+		}
+	    }
+	}
+    }
+}
+
+bool TriangleSet::occluded(RayPacket &packet, int begin, int end) const
+{
+    const vfloat tmin(0.0001f), blocked(-1.0f);
+    const int size = packet.size();
+
+    for (int s = begin; s < end; s++) {
+	for (int i = 0; i < size; i += SIMD_WIDTH) {
+	    vfloat t = distances(packet, i, *this, s);
+	    vfloat tmax = vfloat::load(packet.tmax + i);
+	    vmask m = (t > tmin) & (t < tmax) & notEqual(packet.skip + i, s);
+	    int bits = m.bits();
+	    if (bits) {
+		select(m, blocked, tmax).store(packet.tmax + i);
+		for (int k = 0; bits; k++, bits >>= 1) {
+		    if (bits & 1)
+			packet.hit[i + k] = s;
+		}
+	    }
+	}
+    }
+
+    return !packet.active();
+}
@@ -0,0 +1,107 @@
+/*funray - yet another raytracer
+Copyright (C) 2008  Christian Zeller (chrizel@gmail.com) and
+		    Simon Goller (neosam@gmail.com).
+
+This program is free software; you can redistribute it and/or modify 
+it under the terms of the GNU General Public License as published 
+by the Free Software Foundation; either version 3 of the License, 
+or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful, but 
+WITHOUT ANY WARRANTY; without even the implied warranty of 
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License along 
+with this program; if not, see <http://www.gnu.org/licenses/>. */
+
+#ifndef TRIANGLES_H
+#define TRIANGLES_H
+
+#include <vector>
+
+#include "packet.h"
+#include "simd.h"
+#include "vector.h"
+
+// Triangles of all meshes as structure of arrays of their three
+// vertices, padded like the ones of SphereSet. Color and mirror factor
+// are stored once per mesh.
+class TriangleSet
+{
+private:
+    float *data;
+    int count;
+
+    TriangleSet(const TriangleSet &);
+    TriangleSet &operator=(const TriangleSet &);
+
+public:
+    // triangles are lit from both sides
+    enum { twoSided = 1 };
+
+    float *ax, *ay, *az;
+    float *bx, *by, *bz;
+    float *cx, *cy, *cz;
+
+    std::vector<int> meshes;
+    std::vector<vec> meshColors;
+    std::vector<float> meshMirrors;
+
+    TriangleSet();
+    ~TriangleSet();
+
+    void resize(int count);
+    inline int size() const {
+	return count;
+    };
+
+    // bytes used by the arrays
+    unsigned long memoryUsage() const;
+
+    // mesh has to be added with addMesh() before
+    inline void set(int i, const vec &a, const vec &b, const vec &c, int mesh) {
+	ax[i] = a.x;
+	ay[i] = a.y;
+	az[i] = a.z;
+	bx[i] = b.x;
+	by[i] = b.y;
+	bz[i] = b.z;
+	cx[i] = c.x;
+	cy[i] = c.y;
+	cz[i] = c.z;
+	meshes[i] = mesh;
+    };
+
+    inline int addMesh(const vec &color, float mirror) {
+	meshColors.push_back(color);
+	meshMirrors.push_back(mirror);
+	return meshColors.size() - 1;
+    };
+
+    inline const vec normalAt(int i, const vec & /* point */) const {
+	vec a(ax[i], ay[i], az[i]);
+	return xproduct(vec(bx[i], by[i], bz[i]) - a, vec(cx[i], cy[i], cz[i]) - a);
+    };
+
+    inline const vec colorAt(int i, const vec & /* point */) const {
+	return meshColors[meshes[i]];
+    };
+
+    inline float mirrorAt(int i) const {
+	return meshMirrors[meshes[i]];
+    };
+
+    // Same interface as SphereSet, except that occlusion ignores hits
+    // closer than 0.0001 too: shadow rays start on the surface.
+    int intersect(const Ray &ray, int begin, int end, float &tmax) const;
+    int occluder(const Ray &ray, int begin, int end, float tmax, int skip = -1) const;
+    inline bool occluded(const Ray &ray, int begin, int end, float tmax,
+			 int skip = -1) const {
+	return occluder(ray, begin, end, tmax, skip) >= 0;
+    };
+    void intersect(RayPacket &packet, int begin, int end) const;
+    bool occluded(RayPacket &packet, int begin, int end) const;
+};
+
+#endif
@@ -93,4 +93,72 @@ public:
     vec dir;
 };
 
+// Per component 1/v with zero components replaced by a huge finite
+// value, so that slab tests never compute 0 * inf = NaN.
+inline vec safeInverse(const vec &v)
+{
+    const float huge = 1e30f;
+    return vec(v.x != 0 ? 1 / v.x : huge,
+	       v.y != 0 ? 1 / v.y : huge,
+	       v.z != 0 ? 1 / v.z : huge);
+}
+
+// Axis aligned bounding box
+class BBox
+{
+public:
+    BBox() : min(HUGE_VALF, HUGE_VALF, HUGE_VALF),
+	     max(-HUGE_VALF, -HUGE_VALF, -HUGE_VALF) {};
+    BBox(const vec &min, const vec &max) : min(min), max(max) {};
+
+    vec min;
+    vec max;
+
+    bool isEmpty() const {
+	return min.x > max.x || min.y > max.y || min.z > max.z;
+    };
+
+    void extend(const vec &p) {
+	min = vec(std::min(min.x, p.x), std::min(min.y, p.y), std::min(min.z, p.z));
+	max = vec(std::max(max.x, p.x), std::max(max.y, p.y), std::max(max.z, p.z));
+    };
+
+    void extend(const BBox &b) {
+	min = vec(std::min(min.x, b.min.x), std::min(min.y, b.min.y), std::min(min.z, b.min.z));
+	max = vec(std::max(max.x, b.max.x), std::max(max.y, b.max.y), std::max(max.z, b.max.z));
+    };
+
+    const vec center() const {
+	return (min + max) * 0.5;
+    };
+
+    float area() const {
+	if (isEmpty())
+	    return 0;
+	vec d = max - min;
+	return 2 * (d.x * d.y + d.y * d.z + d.z * d.x);
+    };
+
+    // Slab test with invDir from safeInverse(ray.dir). Returns the
+    // entry distance in tnear if the box is hit between 0 and tfar.
+    bool intersect(const Ray &ray, const vec &invDir, float tfar, float &tnear) const {
+	float t0 = (min.x - ray.pos.x) * invDir.x;
+	float t1 = (max.x - ray.pos.x) * invDir.x;
+	tnear = std::max(0.0f, std::min(t0, t1));
+	tfar = std::min(tfar, std::max(t0, t1));
+
+	t0 = (min.y - ray.pos.y) * invDir.y;
+	t1 = (max.y - ray.pos.y) * invDir.y;
+	tnear = std::max(tnear, std::min(t0, t1));
+	tfar = std::min(tfar, std::max(t0, t1));
+
+	t0 = (min.z - ray.pos.z) * invDir.z;
+	t1 = (max.z - ray.pos.z) * invDir.z;
+	tnear = std::max(tnear, std::min(t0, t1));
+	tfar = std::min(tfar, std::max(t0, t1));
+
+	return tnear <= tfar;
+    };
+};
+
 #endif
@@ -0,0 +1,105 @@
+/*funray - yet another raytracer
+Copyright (C) 2008  Christian Zeller (chrizel@gmail.com) and
+		    Simon Goller (neosam@gmail.com).
+
+This program is free software; you can redistribute it and/or modify 
+it under the terms of the GNU General Public License as published 
+by the Free Software Foundation; either version 3 of the License, 
+or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful, but 
+WITHOUT ANY WARRANTY; without even the implied warranty of 
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License along 
+with this program; if not, see <http://www.gnu.org/licenses/>. */
+
+#include <QTime>
+
+#include <vector>
+
+#include "bvh.h"
+#include "vector.h"
+#include "widebvh.h"
+
+void WideBVH::build(const BVH &bvh)
+{
+    QTime t;
+    t.start();
+
+    nodes.clear();
+    if (!bvh.isEmpty()) {
+	nodes.reserve(bvh.nodes.size() / (width - 1) + 1);
+	collapse(bvh, 0);
+    }
+
+    buildTime = t.elapsed();
+}
+
+// Turns the binary node at index into a wide node: the inner child
+// with the largest surface is replaced by its two children until the
+// node is full. Returns the index of the new node.
+int WideBVH::collapse(const BVH &bvh, int index)
+{
+    std::vector<int> children;
+    const BVHNode &root = bvh.nodes[index];
+    if (root.count) {
+	children.push_back(index);
+    } else {
+	children.push_back(index + 1);
+	children.push_back(root.offset);
+    }
+
+    while ((int)children.size() < width) {
+	int best = -1;
+	float bestArea = -1;
+	for (unsigned int i = 0; i < children.size(); i++) {
+	    const BVHNode &child = bvh.nodes[children[i]];
+	    if (!child.count && child.box.area() > bestArea) {
+		best = i;
+		bestArea = child.box.area();
+	    }
+	}
+	if (best < 0)
+	    break;
+
+	int opened = children[best];
+	children[best] = opened + 1;
+	children.push_back(bvh.nodes[opened].offset);
+    }
+
+    const int node = nodes.size();
+    nodes.push_back(WideBVHNode());
+    nodes[node].used = 0;
+    for (int c = 0; c < width; c++) {
+	nodes[node].minX[c] = nodes[node].minY[c] = nodes[node].minZ[c] = 0;
+	nodes[node].maxX[c] = nodes[node].maxY[c] = nodes[node].maxZ[c] = 0;
+	nodes[node].offset[c] = nodes[node].count[c] = 0;
+    }
+
+    for (unsigned int c = 0; c < children.size(); c++) {
+	const BVHNode &child = bvh.nodes[children[c]];
+
+	// collapse() adds nodes, so nodes[node] is looked up again
+	int offset = child.count ? child.offset : collapse(bvh, children[c]);
+
+	WideBVHNode &n = nodes[node];
+	n.minX[c] = child.box.min.x;
+	n.minY[c] = child.box.min.y;
+	n.minZ[c] = child.box.min.z;
+	n.maxX[c] = child.box.max.x;
+	n.maxY[c] = child.box.max.y;
+	n.maxZ[c] = child.box.max.z;
+	n.offset[c] = offset;
+	n.count[c] = child.count;
+	n.used |= 1 << c;
+    }
+
+    return node;
+}
+
+unsigned long WideBVH::memoryUsage() const
+{
+    return nodes.capacity() * sizeof(WideBVHNode);
+}
@@ -0,0 +1,287 @@
+/*funray - yet another raytracer
+Copyright (C) 2008  Christian Zeller (chrizel@gmail.com) and
+		    Simon Goller (neosam@gmail.com).
+
+This program is free software; you can redistribute it and/or modify 
+it under the terms of the GNU General Public License as published 
+by the Free Software Foundation; either version 3 of the License, 
+or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful, but 
+WITHOUT ANY WARRANTY; without even the implied warranty of 
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License along 
+with this program; if not, see <http://www.gnu.org/licenses/>. */
+
+#ifndef WIDEBVH_H
+#define WIDEBVH_H
+
+#include <vector>
+
+#include "bvh.h"
+#include "packet.h"
+#include "simd.h"
+#include "vector.h"
+
+// Children per node, one SIMD register of boxes
+#if SIMD_WIDTH > 1
+# define WIDEBVH_WIDTH SIMD_WIDTH
+#else
+# define WIDEBVH_WIDTH 4
+#endif
+
+// Node with up to WIDEBVH_WIDTH children. Their boxes are stored as
+// structure of arrays, so a ray is tested against all of them at once.
+struct WideBVHNode
+{
+    enum { width = WIDEBVH_WIDTH };
+
+    float minX[width], minY[width], minZ[width];
+    float maxX[width], maxY[width], maxZ[width];
+
+    // count > 0: leaf with the items [offset, offset + count)
+    // count == 0: inner node, offset is its index in WideBVH::nodes
+    int offset[width];
+    int count[width];
+
+    // one bit per used child
+    int used;
+
+    inline BBox box(int i) const {
+	return BBox(vec(minX[i], minY[i], minZ[i]), vec(maxX[i], maxY[i], maxZ[i]));
+    };
+};
+
+// Traversal stack entry: a child and the distance its box is entered
+struct WideBVHEntry
+{
+    int offset;
+    int count;
+    float tnear;
+
+    WideBVHEntry() {};
+    WideBVHEntry(int offset, int count, float tnear)
+	: offset(offset), count(count), tnear(tnear) {};
+};
+
+// A ray broadcast to all lanes for the child box tests
+struct WideBVHRay
+{
+    vfloat ox, oy, oz;
+    vfloat ix, iy, iz;
+
+    WideBVHRay(const Ray &ray) {
+	vec inv = safeInverse(ray.dir);
+	ox = vfloat(ray.pos.x);
+	oy = vfloat(ray.pos.y);
+	oz = vfloat(ray.pos.z);
+	ix = vfloat(inv.x);
+	iy = vfloat(inv.y);
+	iz = vfloat(inv.z);
+    };
+
+    // Slab test of BBox::intersect against all children, returns one
+    // bit per child hit before tmax and the entry distances in tnear
+    inline int hits(const WideBVHNode &node, float tmax, float *tnear) const {
+	const vfloat zero(0.0f), far(tmax);
+	int bits = 0;
+	for (int c = 0; c < WideBVHNode::width; c += SIMD_WIDTH) {
+	    vfloat t0 = (vfloat::load(node.minX + c) - ox) * ix;
+	    vfloat t1 = (vfloat::load(node.maxX + c) - ox) * ix;
+	    vfloat tn = vmax(zero, vmin(t0, t1));
+	    vfloat tf = vmin(far, vmax(t0, t1));
+
+	    t0 = (vfloat::load(node.minY + c) - oy) * iy;
+	    t1 = (vfloat::load(node.maxY + c) - oy) * iy;
+	    tn = vmax(tn, vmin(t0, t1));
+	    tf = vmin(tf, vmax(t0, t1));
+
+	    t0 = (vfloat::load(node.minZ + c) - oz) * iz;
+	    t1 = (vfloat::load(node.maxZ + c) - oz) * iz;
+	    tn = vmax(tn, vmin(t0, t1));
+	    tf = vmin(tf, vmax(t0, t1));
+
+	    tn.store(tnear + c);
+	    bits |= (tn <= tf).bits() << c;
+	}
+	return bits & node.used;
+    };
+};
+
+// Bounding volume hierarchy with WIDEBVH_WIDTH children per node,
+// made by collapsing a binary BVH. The leaves are the ones of the
+// binary hierarchy and refer to its items, so the caller keeps the
+// object order of BVH::items.
+class WideBVH
+{
+public:
+    enum { width = WIDEBVH_WIDTH, maxStack = BVH::maxDepth * WIDEBVH_WIDTH };
+
+    std::vector<WideBVHNode> nodes;
+
+    // milliseconds spent in the last build()
+    int buildTime;
+
+    WideBVH() : buildTime(0) {};
+
+    void build(const BVH &bvh);
+
+    // bytes used by the nodes
+    unsigned long memoryUsage() const;
+
+    inline bool isEmpty() const {
+	return nodes.empty();
+    };
+
+    // Same interface as BVH
+    template <class Leaf>
+    void intersect(const Ray &ray, float &tmax, Leaf &leaf) const;
+    template <class Leaf>
+    bool occluded(const Ray &ray, float tmax, Leaf &leaf) const;
+    template <class Leaf>
+    void intersect(RayPacket &packet, Leaf &leaf) const;
+    template <class Leaf>
+    void occluded(RayPacket &packet, Leaf &leaf) const;
+
+private:
+    int collapse(const BVH &bvh, int index);
+};
+
+template <class Leaf>
+void WideBVH::intersect(const Ray &ray, float &tmax, Leaf &leaf) const
+{
+    if (nodes.empty())
+	return;
+
+    const WideBVHRay r(ray);
+    WideBVHEntry stack[maxStack];
+    int sp = 0;
+    float tnear[width];
+
+    stack[sp++] = WideBVHEntry(0, 0, 0);
+    while (sp) {
+	const WideBVHEntry e = stack[--sp];
+	if (e.tnear > tmax)
+	    continue;
+
+	if (e.count) {
+	    leaf.intersect(e.offset, e.offset + e.count, tmax);
+	    continue;
+	}
+
+	// push the children far to near, so the nearest is next
+	const WideBVHNode &node = nodes[e.offset];
+	const int first = sp;
+	int bits = r.hits(node, tmax, tnear);
+	for (int c = 0; bits; c++, bits >>= 1) {
+	    if (!(bits & 1))
+		continue;
+	    WideBVHEntry child(node.offset[c], node.count[c], tnear[c]);
+	    int j = sp++;
+	    while (j > first && stack[j - 1].tnear < child.tnear) {
+		stack[j] = stack[j - 1];
+		j--;
+	    }
+	    stack[j] = child;
+	}
+    }
+}
+
+template <class Leaf>
+bool WideBVH::occluded(const Ray &ray, float tmax, Leaf &leaf) const
+{
+    if (nodes.empty())
+	return false;
+
+    const WideBVHRay r(ray);
+    WideBVHEntry stack[maxStack];
+    int sp = 0;
+    float tnear[width];
+
+    stack[sp++] = WideBVHEntry(0, 0, 0);
+    while (sp) {
+	const WideBVHEntry e = stack[--sp];
+	if (e.count) {
+	    if (leaf.occluded(e.offset, e.offset + e.count, tmax))
+		return true;
+	    continue;
+	}
+
+	const WideBVHNode &node = nodes[e.offset];
+	int bits = r.hits(node, tmax, tnear);
+	for (int c = 0; bits; c++, bits >>= 1) {
+	    if (bits & 1)
+		stack[sp++] = WideBVHEntry(node.offset[c], node.count[c], tnear[c]);
+	}
+    }
+
+    return false;
+}
+
+template <class Leaf>
+void WideBVH::intersect(RayPacket &packet, Leaf &leaf) const
+{
+    if (nodes.empty() || !packet.count)
+	return;
+
+    // the rays are coherent, the first one orders the children
+    const vec dir(packet.dx[0], packet.dy[0], packet.dz[0]);
+    WideBVHEntry stack[maxStack];
+    int sp = 0;
+
+    stack[sp++] = WideBVHEntry(0, 0, 0);
+    while (sp) {
+	const WideBVHEntry e = stack[--sp];
+	if (e.count) {
+	    leaf.intersect(e.offset, e.offset + e.count, packet);
+	    continue;
+	}
+
+	const WideBVHNode &node = nodes[e.offset];
+	const int first = sp;
+	for (int c = 0; c < width; c++) {
+	    if (!(node.used & (1 << c)))
+		continue;
+	    BBox box = node.box(c);
+	    if (!packet.hits(box))
+		continue;
+	    WideBVHEntry child(node.offset[c], node.count[c], box.center().dot(dir));
+	    int j = sp++;
+	    while (j > first && stack[j - 1].tnear < child.tnear) {
+		stack[j] = stack[j - 1];
+		j--;
+	    }
+	    stack[j] = child;
+	}
+    }
+}
+
+template <class Leaf>
+void WideBVH::occluded(RayPacket &packet, Leaf &leaf) const
+{
+    if (nodes.empty() || !packet.count)
+	return;
+
+    WideBVHEntry stack[maxStack];
+    int sp = 0;
+
+    stack[sp++] = WideBVHEntry(0, 0, 0);
+    while (sp) {
+	const WideBVHEntry e = stack[--sp];
+	if (e.count) {
+	    if (leaf.occluded(e.offset, e.offset + e.count, packet))
+		return;
+	    continue;
+	}
+
+	const WideBVHNode &node = nodes[e.offset];
+	for (int c = 0; c < width; c++) {
+	    if ((node.used & (1 << c)) && packet.hits(node.box(c)))
+		stack[sp++] = WideBVHEntry(node.offset[c], node.count[c], 0);
+	}
+    }
+}
+
+#endif